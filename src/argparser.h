@@ -6,12 +6,20 @@
 #include <cassert>
 #include <string>
 #include <random>
+#include <glm/glm.hpp>
+
+#include "parallel.h"
 
 // VISUALIZATION MODES FOR RADIOSITY
 #define NUM_RENDER_MODES 6
 enum RENDER_MODE { RENDER_MATERIALS, RENDER_RADIANCE, RENDER_FORM_FACTORS, 
 		   RENDER_LIGHTS, RENDER_UNDISTRIBUTED, RENDER_ABSORBED };
 
+// THE RADIOSITY SOLVERS
+// shooting: progressive refinement, shoot the light of one patch per iteration
+// jacobi & gauss seidel: gather the light of all patches per iteration
+enum RADIOSITY_SOLVER { RADIOSITY_SHOOTING, RADIOSITY_JACOBI, RADIOSITY_GAUSS_SEIDEL };
+
 // ================================================================================
 // ================================================================================
 
@@ -68,9 +76,57 @@ public:
 	width = atoi(argv[i]);
 	i++; assert (i < argc); 
          height = atoi(argv[i]);
+      } else if (std::string(argv[i]) == std::string("-output") ||
+                 std::string(argv[i]) == std::string("-o")) {
+	i++; assert (i < argc); 
+	output_file = argv[i];
+      } else if (std::string(argv[i]) == std::string("-sequence")) {
+	i++; assert (i < argc); 
+	sequence_output = argv[i];
+	render_sequence = true;
+      } else if (std::string(argv[i]) == std::string("-solve_radiosity")) {
+	solve_radiosity = true;
+      } else if (std::string(argv[i]) == std::string("-num_threads")) {
+	i++; assert (i < argc); 
+	num_threads = atoi(argv[i]);
+	assert (num_threads > 0);
+      } else if (std::string(argv[i]) == std::string("-seed")) {
+	i++; assert (i < argc); 
+	seed = atoi(argv[i]);
+	assert (seed >= 0);
       } else if (std::string(argv[i]) == std::string("-num_form_factor_samples")) {
 	i++; assert (i < argc); 
 	num_form_factor_samples = atoi(argv[i]);
+      } else if (std::string(argv[i]) == std::string("-form_factor_threshold")) {
+	i++; assert (i < argc); 
+	form_factor_threshold = atof(argv[i]);
+	assert (form_factor_threshold >= 0);
+      } else if (std::string(argv[i]) == std::string("-quantize_form_factors")) {
+	quantize_form_factors = true;
+      } else if (std::string(argv[i]) == std::string("-radiosity_solver")) {
+	i++; assert (i < argc); 
+	if (std::string(argv[i]) == std::string("shooting")) {
+	  radiosity_solver = RADIOSITY_SHOOTING;
+	} else if (std::string(argv[i]) == std::string("jacobi")) {
+	  radiosity_solver = RADIOSITY_JACOBI;
+	} else if (std::string(argv[i]) == std::string("gauss_seidel")) {
+	  radiosity_solver = RADIOSITY_GAUSS_SEIDEL;
+	} else {
+	  std::cout << "ERROR: unknown radiosity solver '" << argv[i] 
+		    << "' (shooting, jacobi or gauss_seidel)" << std::endl;
+	  exit(1);
+	}
+      } else if (std::string(argv[i]) == std::string("-hierarchical_radiosity")) {
+	i++; assert (i < argc); 
+	hierarchical_radiosity = atof(argv[i]);
+	assert (hierarchical_radiosity >= 0);
+      } else if (std::string(argv[i]) == std::string("-lazy_form_factors")) {
+	i++; assert (i < argc); 
+	lazy_form_factors = atoi(argv[i]);
+	assert (lazy_form_factors >= 0);
+      } else if (std::string(argv[i]) == std::string("-radiosity_cache")) {
+	i++; assert (i < argc); 
+	radiosity_cache = argv[i];
       } else if (std::string(argv[i]) == std::string("-sphere_rasterization")) {
 	i++; assert (i < argc); 
 	sphere_horiz = atoi(argv[i]);
@@ -87,6 +143,10 @@ public:
       } else if (std::string(argv[i]) == std::string("-num_shadow_samples")) {
 	i++; assert (i < argc); 
 	num_shadow_samples = atoi(argv[i]);
+      } else if (std::string(argv[i]) == std::string("-num_light_samples")) {
+	i++; assert (i < argc); 
+	num_light_samples = atoi(argv[i]);
+	assert (num_light_samples >= 0);
       } else if (std::string(argv[i]) == std::string("-num_antialias_samples")) {
 	i++; assert (i < argc); 
 	num_antialias_samples = atoi(argv[i]);
@@ -109,6 +169,15 @@ public:
       } else if (std::string(argv[i]) == std::string("-num_photons_to_collect")) {
 	i++; assert (i < argc);
 	num_photons_to_collect = atoi(argv[i]);
+      } else if (std::string(argv[i]) == std::string("-photon_map")) {
+	i++; assert (i < argc);
+	photon_map = argv[i];
+      } else if (std::string(argv[i]) == std::string("-irradiance_cache")) {
+	i++; assert (i < argc);
+	irradiance_cache = atof(argv[i]);
+	assert (irradiance_cache >= 0);
+      } else if (std::string(argv[i]) == std::string("-precompute_irradiance")) {
+	precompute_irradiance = true;
       } else if (std::string(argv[i]) == std::string("-gather_indirect")) {
 	gather_indirect = true;
       } else {
@@ -119,18 +188,6 @@ public:
     }
   }
 
-  double rand() {
-#if 1
-    // random seed
-    static std::random_device rd;    
-    static std::mt19937 engine(rd());
-#else
-    // deterministic randomness
-    static std::mt19937 engine(37);
-#endif
-    static std::uniform_real_distribution<double> dist(0.0, 1.0);
-    return dist(engine);
-  }
 
   void DefaultValues() {
     // BASIC RENDERING PARAMETERS
@@ -142,19 +199,32 @@ public:
     radiosity_animation = false;
     render_to_file = false;
     render_sequence = false;
+    output_file = "test.ppm";
+    sequence_output = "output";
+    num_threads = DefaultNumThreads();
+    // a different random seed every run (unless one is given)
+    seed = std::random_device{}() & 0x7fffffff;
 
     // RADIOSITY PARAMETERS
     render_mode = RENDER_MATERIALS;
     interpolate = false;
     wireframe = false;
     num_form_factor_samples = 1;
+    form_factor_threshold = 0;
+    quantize_form_factors = false;
+    lazy_form_factors = 0;
+    radiosity_solver = RADIOSITY_SHOOTING;
+    hierarchical_radiosity = 0;
+    radiosity_cache = "";
     sphere_horiz = 8;
     sphere_vert = 6;
     cylinder_ring_rasterization = 20; 
+    solve_radiosity = false;
 
     // RAYTRACING PARAMETERS
     num_bounces = 0;
     num_shadow_samples = 0;
+    num_light_samples = 0;
     num_antialias_samples = 1;
     num_glossy_samples = 1;
     ambient_light = glm::vec3(0.1,0.1,0.1);
@@ -165,6 +235,9 @@ public:
     render_kdtree = true;
     num_photons_to_shoot = 10000;
     num_photons_to_collect = 100;
+    photon_map = "";
+    irradiance_cache = 0;
+    precompute_irradiance = false;
     gather_indirect = false;
   }
 
@@ -181,19 +254,43 @@ public:
   bool radiosity_animation;
   bool render_to_file;
   bool render_sequence;
+  std::string output_file;
+  // a directory of .ppm frames, a .y4m or .rgb file, or "|command"
+  std::string sequence_output;
+  int num_threads;
+  // the seed of all the random sampling (see Sampler)
+  int seed;
 
   // RADIOSITY PARAMETERS
   enum RENDER_MODE render_mode;
   bool interpolate;
   bool wireframe;
   int num_form_factor_samples;
+  // form factors smaller than this are not stored
+  float form_factor_threshold;
+  // store the form factors as 16 bits
+  bool quantize_form_factors;
+  // if > 0, compute the form factors of each shooting patch when it is
+  // needed, caching this many columns (rather than the whole matrix)
+  int lazy_form_factors;
+  enum RADIOSITY_SOLVER radiosity_solver;
+  // if > 0, use hierarchical radiosity, linking patches at the level
+  // where a link carries at most this fraction of the emitted power
+  float hierarchical_radiosity;
+  // if not empty, the form factors & the converged solution are saved
+  // to this file & read back by later runs of the same scene & settings
+  std::string radiosity_cache;
   int sphere_horiz;
   int sphere_vert;
   int cylinder_ring_rasterization;
+  bool solve_radiosity;
 
   // RAYTRACING PARAMETERS
   int num_bounces;
   int num_shadow_samples;
+  // the lightning lighting each hit is estimated from this many
+  // segments (chosen by importance), 0 to use every segment
+  int num_light_samples;
   int num_antialias_samples;
   int num_glossy_samples;
   glm::vec3 ambient_light;
@@ -202,6 +299,15 @@ public:
   // PHOTON MAPPING PARAMETERS
   int num_photons_to_shoot;
   int num_photons_to_collect;
+  // if not empty, the traced photons are saved to this file & mapped
+  // back by later runs of the same scene & settings (no tracing)
+  std::string photon_map;
+  // if > 0, interpolate the gathered indirect light from nearby gathers
+  // with at most this error (as a fraction of the gather radius)
+  float irradiance_cache;
+  // estimate the irradiance at some of the photons once (after they
+  // are traced), a gather is then the closest of those estimates
+  bool precompute_irradiance;
   bool render_photons;
   bool render_kdtree;
   bool gather_indirect;
@@ -0,0 +1,327 @@
+#include <algorithm>
+
+#include "bvh.h"
+#include "boundingbox.h"
+#include "face.h"
+#include "primitive.h"
+#include "ray.h"
+#include "hit.h"
+#include "utils.h"
+
+#define BVH_NUM_BINS 12
+// (at most FACE_PACKET_SIZE, the quads of a leaf fit in one packet)
+#define BVH_MAX_LEAF_SIZE 4
+#define BVH_MAX_DEPTH 64
+// below this depth only median splits are made, bounding the depth
+#define BVH_MAX_SAH_DEPTH 40
+// relative cost of a node traversal step vs. a ray/object intersection
+#define BVH_TRAVERSAL_COST 0.5f
+
+// ==================================================================
+// HELPER FUNCTIONS
+
+inline float SurfaceArea(const glm::vec3 &min, const glm::vec3 &max) {
+  glm::vec3 d = max - min;
+  return 2 * (d.x*d.y + d.y*d.z + d.z*d.x);
+}
+
+inline void ExtendBounds(glm::vec3 &min, glm::vec3 &max, const glm::vec3 &a, const glm::vec3 &b) {
+  min = glm::vec3(std::min(min.x,a.x),std::min(min.y,a.y),std::min(min.z,a.z));
+  max = glm::vec3(std::max(max.x,b.x),std::max(max.y,b.y),std::max(max.z,b.z));
+}
+
+// slab test against the box of a node, the ray is only interesting
+// between the origin and the closest hit found so far
+inline bool IntersectNodeBox(const BVHNode &node, const glm::vec3 &origin,
+                             const glm::vec3 &inv_dir, float tmax) {
+  float tmin = 0;
+  for (int i = 0; i < 3; i++) {
+    float t0 = (node.min[i] - origin[i]) * inv_dir[i];
+    float t1 = (node.max[i] - origin[i]) * inv_dir[i];
+    if (t0 > t1) std::swap(t0,t1);
+    // NOTE: written so that a NaN (origin on a slab of a flat box,
+    // parallel ray) does not reject the box
+    if (t0 > tmin) tmin = t0;
+    if (t1 < tmax) tmax = t1;
+    if (tmin > tmax) return false;
+  }
+  return true;
+}
+
+
+// ==================================================================
+// BUILD
+// ==================================================================
+
+void BVH::Build(const std::vector<Face*> &faces, const std::vector<Primitive*> &primitives) {
+  nodes.clear();
+  items.clear();
+  packets.clear();
+
+  std::vector<BuildItem> build_items;
+  for (unsigned int i = 0; i < faces.size(); i++) {
+    BuildItem b;
+    b.min = b.max = (*faces[i])[0]->get();
+    for (int j = 1; j < 4; j++) {
+      ExtendBounds(b.min,b.max,(*faces[i])[j]->get(),(*faces[i])[j]->get());
+    }
+    b.item.face = faces[i];
+    b.item.primitive = NULL;
+    build_items.push_back(b);
+  }
+  for (unsigned int i = 0; i < primitives.size(); i++) {
+    BuildItem b;
+    BoundingBox bb = primitives[i]->getBoundingBox();
+    b.min = bb.getMin();
+    b.max = bb.getMax();
+    b.item.face = NULL;
+    b.item.primitive = primitives[i];
+    build_items.push_back(b);
+  }
+  if (build_items.empty()) return;
+
+  // pad the boxes so axis aligned quads (flat boxes) are not lost to
+  // round off in the slab test
+  for (unsigned int i = 0; i < build_items.size(); i++) {
+    build_items[i].min -= glm::vec3(EPSILON);
+    build_items[i].max += glm::vec3(EPSILON);
+    build_items[i].centroid = 0.5f * (build_items[i].min + build_items[i].max);
+  }
+
+  nodes.reserve(2*build_items.size());
+  items.reserve(build_items.size());
+  BuildRecursive(build_items,0,build_items.size(),0);
+}
+
+
+int BVH::MakeLeaf(std::vector<BuildItem> &build_items, int begin, int end,
+                  const glm::vec3 &min, const glm::vec3 &max) {
+  assert (end - begin > 0 && end - begin <= BVH_MAX_LEAF_SIZE);
+  assert (BVH_MAX_LEAF_SIZE <= FACE_PACKET_SIZE);
+  BVHNode node;
+  node.min = min;
+  node.max = max;
+  node.offset = items.size();
+  node.num_faces = 0;
+  node.num_primitives = 0;
+  node.axis = 0;
+  node.unused = 0;
+  // store the quads of the leaf before the primitives (and packed in
+  // the packet of the leaf)
+  int num_faces = 0;
+  for (int i = begin; i < end; i++) {
+    if (build_items[i].item.face != NULL) num_faces++;
+  }
+  if (num_faces > 0) {
+    BVHItem empty = { NULL, NULL };
+    while (items.size() % FACE_PACKET_SIZE != 0) items.push_back(empty);
+    node.offset = items.size();
+    packets.resize(node.offset / FACE_PACKET_SIZE + 1);
+  }
+  for (int i = begin; i < end; i++) {
+    if (build_items[i].item.face == NULL) continue;
+    packets[node.offset / FACE_PACKET_SIZE].Set(node.num_faces,build_items[i].item.face);
+    items.push_back(build_items[i].item);
+    node.num_faces++;
+  }
+  for (int i = begin; i < end; i++) {
+    if (build_items[i].item.face != NULL) continue;
+    items.push_back(build_items[i].item);
+    node.num_primitives++;
+  }
+  nodes.push_back(node);
+  return nodes.size()-1;
+}
+
+
+int BVH::BuildRecursive(std::vector<BuildItem> &build_items, int begin, int end, int depth) {
+  int count = end - begin;
+  assert (count > 0);
+
+  // bounds of the objects and of their centroids
+  glm::vec3 min = build_items[begin].min;
+  glm::vec3 max = build_items[begin].max;
+  glm::vec3 cmin = build_items[begin].centroid;
+  glm::vec3 cmax = build_items[begin].centroid;
+  for (int i = begin+1; i < end; i++) {
+    ExtendBounds(min,max,build_items[i].min,build_items[i].max);
+    ExtendBounds(cmin,cmax,build_items[i].centroid,build_items[i].centroid);
+  }
+  if (count == 1) return MakeLeaf(build_items,begin,end,min,max);
+
+  // split along the axis with the largest centroid extent
+  glm::vec3 extent = cmax - cmin;
+  int axis = 0;
+  if (extent.y > extent.x) axis = 1;
+  if (extent.z > extent[axis]) axis = 2;
+
+  int mid = -1;
+  if (extent[axis] > 0 && depth < BVH_MAX_SAH_DEPTH) {
+    // bin the centroids and evaluate the surface area heuristic at
+    // each of the bin boundaries
+    int bin_count[BVH_NUM_BINS];
+    glm::vec3 bin_min[BVH_NUM_BINS], bin_max[BVH_NUM_BINS];
+    for (int b = 0; b < BVH_NUM_BINS; b++) {
+      bin_count[b] = 0;
+      bin_min[b] = glm::vec3(FLT_MAX);
+      bin_max[b] = glm::vec3(-FLT_MAX);
+    }
+    float scale = BVH_NUM_BINS / extent[axis];
+    for (int i = begin; i < end; i++) {
+      int b = std::min(BVH_NUM_BINS-1,int((build_items[i].centroid[axis]-cmin[axis])*scale));
+      bin_count[b]++;
+      ExtendBounds(bin_min[b],bin_max[b],build_items[i].min,build_items[i].max);
+    }
+    // sweep from the right to get the area & count right of each boundary
+    float right_area[BVH_NUM_BINS];
+    int right_count[BVH_NUM_BINS];
+    glm::vec3 rmin(FLT_MAX), rmax(-FLT_MAX);
+    int rcount = 0;
+    for (int b = BVH_NUM_BINS-1; b > 0; b--) {
+      ExtendBounds(rmin,rmax,bin_min[b],bin_max[b]);
+      rcount += bin_count[b];
+      right_area[b] = (rcount > 0) ? SurfaceArea(rmin,rmax) : 0;
+      right_count[b] = rcount;
+    }
+    // then sweep from the left to find the cheapest boundary
+    float best_cost = FLT_MAX;
+    int best_bin = -1;
+    glm::vec3 lmin(FLT_MAX), lmax(-FLT_MAX);
+    int lcount = 0;
+    for (int b = 1; b < BVH_NUM_BINS; b++) {
+      ExtendBounds(lmin,lmax,bin_min[b-1],bin_max[b-1]);
+      lcount += bin_count[b-1];
+      if (lcount == 0 || right_count[b] == 0) continue;
+      float cost = SurfaceArea(lmin,lmax) * lcount + right_area[b] * right_count[b];
+      if (cost < best_cost) {
+        best_cost = cost;
+        best_bin = b;
+      }
+    }
+    float node_area = SurfaceArea(min,max);
+    best_cost = BVH_TRAVERSAL_COST + best_cost / node_area;
+    if (best_bin != -1 && (best_cost < count || count > BVH_MAX_LEAF_SIZE)) {
+      BuildItem *first = &build_items[0] + begin;
+      BuildItem *split = std::partition(first, &build_items[0] + end, [&](const BuildItem &b) {
+          return std::min(BVH_NUM_BINS-1,int((b.centroid[axis]-cmin[axis])*scale)) < best_bin; });
+      mid = begin + (split - first);
+    } else if (count <= BVH_MAX_LEAF_SIZE) {
+      // cheaper to intersect everything than to split
+      return MakeLeaf(build_items,begin,end,min,max);
+    }
+  } else if (count <= BVH_MAX_LEAF_SIZE) {
+    return MakeLeaf(build_items,begin,end,min,max);
+  }
+  assert (depth < BVH_MAX_DEPTH-1);
+
+  if (mid <= begin || mid >= end) {
+    // the binning could not separate the objects (e.g., identical
+    // centroids), fall back to splitting the list in half
+    mid = begin + count/2;
+    std::nth_element(&build_items[0] + begin, &build_items[0] + mid, &build_items[0] + end,
+                     [&](const BuildItem &a, const BuildItem &b) { return a.centroid[axis] < b.centroid[axis]; });
+  }
+
+  // create the interior node, the first child directly follows it
+  BVHNode node;
+  node.min = min;
+  node.max = max;
+  node.offset = -1;
+  node.num_faces = 0;
+  node.num_primitives = 0;
+  node.axis = axis;
+  node.unused = 0;
+  int index = nodes.size();
+  nodes.push_back(node);
+  BuildRecursive(build_items,begin,mid,depth+1);
+  nodes[index].offset = BuildRecursive(build_items,mid,end,depth+1);
+  return index;
+}
+
+
+// ==================================================================
+// TRAVERSAL
+// ==================================================================
+
+bool BVH::intersect(const Ray &r, Hit &h, bool intersect_backfacing) const {
+  if (nodes.empty()) return false;
+  const glm::vec3 &origin = r.getOrigin();
+  const glm::vec3 &dir = r.getDirection();
+  glm::vec3 inv_dir(1.0f/dir.x, 1.0f/dir.y, 1.0f/dir.z);
+
+  bool answer = false;
+  // explicitly store the nodes that must still be checked (rather
+  // than write a recursive function)
+  int todo[BVH_MAX_DEPTH];
+  int num_todo = 0;
+  int current = 0;
+  while (true) {
+    const BVHNode &node = nodes[current];
+    if (IntersectNodeBox(node,origin,inv_dir,h.getT())) {
+      if (node.isLeaf()) {
+        if (node.num_faces > 0 &&
+            packets[node.offset / FACE_PACKET_SIZE].intersect(r,h,intersect_backfacing)) answer = true;
+        int i = node.offset + node.num_faces;
+        for (int n = 0; n < node.num_primitives; n++, i++) {
+          if (items[i].primitive->intersect(r,h)) answer = true;
+        }
+      } else {
+        // visit the child closer to the ray origin first
+        assert (num_todo < BVH_MAX_DEPTH);
+        if (dir[node.axis] < 0) {
+          todo[num_todo++] = current+1;
+          current = node.offset;
+        } else {
+          todo[num_todo++] = node.offset;
+          current = current+1;
+        }
+        continue;
+      }
+    }
+    if (num_todo == 0) break;
+    current = todo[--num_todo];
+  }
+  return answer;
+}
+
+
+bool BVH::occluded(const Ray &r, float tmax, bool intersect_backfacing) const {
+  if (nodes.empty()) return false;
+  const glm::vec3 &origin = r.getOrigin();
+  const glm::vec3 &dir = r.getDirection();
+  glm::vec3 inv_dir(1.0f/dir.x, 1.0f/dir.y, 1.0f/dir.z);
+
+  // any hit will do, so the children are visited in the same order
+  // as for closest hits (likely to find a blocker early)
+  int todo[BVH_MAX_DEPTH];
+  int num_todo = 0;
+  int current = 0;
+  while (true) {
+    const BVHNode &node = nodes[current];
+    if (IntersectNodeBox(node,origin,inv_dir,tmax)) {
+      if (node.isLeaf()) {
+        if (node.num_faces > 0 &&
+            packets[node.offset / FACE_PACKET_SIZE].occluded(r,tmax,intersect_backfacing)) return true;
+        int i = node.offset + node.num_faces;
+        for (int n = 0; n < node.num_primitives; n++, i++) {
+          if (items[i].primitive->occluded(r,tmax)) return true;
+        }
+      } else {
+        assert (num_todo < BVH_MAX_DEPTH);
+        if (dir[node.axis] < 0) {
+          todo[num_todo++] = current+1;
+          current = node.offset;
+        } else {
+          todo[num_todo++] = node.offset;
+          current = current+1;
+        }
+        continue;
+      }
+    }
+    if (num_todo == 0) break;
+    current = todo[--num_todo];
+  }
+  return false;
+}
+
+// ==================================================================
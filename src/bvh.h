@@ -0,0 +1,91 @@
+#ifndef _BVH_H_
+#define _BVH_H_
+
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "facepacket.h"
+
+class Face;
+class Primitive;
+class Ray;
+class Hit;
+
+// ====================================================================
+// A single node of the flattened hierarchy (32 bytes).  The nodes are
+// stored depth first: the first child of an interior node immediately
+// follows its parent, so only the index of the second child is kept.
+
+struct BVHNode {
+  glm::vec3 min;
+  int offset;                    // leaf: first item, interior: second child
+  glm::vec3 max;
+  unsigned char num_faces;       // leaf: the items are num_faces quads (also
+                                 //   packed in packets[offset/4])
+  unsigned char num_primitives;  //   followed by num_primitives primitives
+  unsigned char axis;            // interior: the split axis
+  unsigned char unused;
+  bool isLeaf() const { return num_faces + num_primitives > 0; }
+};
+
+// one entry of the leaf item array, exactly one of the pointers is set
+struct BVHItem {
+  Face *face;
+  Primitive *primitive;
+};
+
+// ====================================================================
+// ====================================================================
+// A bounding volume hierarchy over the quads and primitives of the
+// scene, built top down with the surface area heuristic.  It replaces
+// the linear scan over every object in RayTracer::CastRay.
+
+class BVH {
+
+public:
+
+  // ========================
+  // CONSTRUCTOR & BUILD
+  BVH() {}
+  void Build(const std::vector<Face*> &faces, const std::vector<Primitive*> &primitives);
+
+  // =========
+  // ACCESSORS
+  int numNodes() const { return nodes.size(); }
+  int numItems() const { return items.size(); }
+
+  // ==========
+  // RAYTRACING
+  // finds the closest hit (closer than the current h.getT())
+  bool intersect(const Ray &r, Hit &h, bool intersect_backfacing) const;
+  // true if anything is hit closer than tmax, stops at the first hit
+  bool occluded(const Ray &r, float tmax, bool intersect_backfacing) const;
+
+private:
+
+  // temporary per object data used only while building
+  struct BuildItem {
+    glm::vec3 min;
+    glm::vec3 max;
+    glm::vec3 centroid;
+    BVHItem item;
+  };
+
+  // HELPER FUNCTIONS
+  int BuildRecursive(std::vector<BuildItem> &build_items, int begin, int end, int depth);
+  int MakeLeaf(std::vector<BuildItem> &build_items, int begin, int end,
+               const glm::vec3 &min, const glm::vec3 &max);
+
+  // REPRESENTATION
+  std::vector<BVHNode> nodes;
+  std::vector<BVHItem> items;
+  // the quads of each leaf are intersected together, the quads of a
+  // leaf start at an item index divisible by 4 so no extra index is
+  // needed in the node (the unused item slots are left empty)
+  std::vector<FacePacket> packets;
+};
+
+// ====================================================================
+// ====================================================================
+
+#endif
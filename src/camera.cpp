@@ -1,4 +1,3 @@
-#include "glCanvas.h"
 #include "camera.h"
 #include "utils.h"
 
@@ -38,8 +37,10 @@ PerspectiveCamera::PerspectiveCamera
 // Construct the ViewMatrix & ProjectionMatrix for GL Rendering
 // ====================================================================
 
+// NOTE: the width & height of the camera must be set beforehand (the
+// viewer uses the size of the window)
+
 void OrthographicCamera::glPlaceCamera() {
-  glfwGetWindowSize(GLCanvas::window, &width, &height);
   float aspect = width / (float)height;
   float w;
   float h;
@@ -56,7 +57,6 @@ void OrthographicCamera::glPlaceCamera() {
 }
 
 void PerspectiveCamera::glPlaceCamera() {
-  glfwGetWindowSize(GLCanvas::window, &width, &height);
   float aspect = width / (float)height;
   // must convert angle from degrees to radians
   ProjectionMatrix = glm::perspective<float>(glm::radians(angle), aspect, 0.1f, 1000.0f);
@@ -128,10 +128,10 @@ void Camera::rotateCamera(float rx, float ry) {
 
   glm::vec3 h = getHorizontal();
   glm::mat4 m; 
-  m = glm::translate<GLfloat>(m,glm::vec3(point_of_interest));
-  m *= glm::rotate<GLfloat>(glm::radians(rx),up);
-  m *= glm::rotate<GLfloat>(glm::radians(ry),h);
-  m = glm::translate<GLfloat>(m,glm::vec3(-point_of_interest));
+  m = glm::translate<float>(m,glm::vec3(point_of_interest));
+  m *= glm::rotate<float>(glm::radians(rx),up);
+  m *= glm::rotate<float>(glm::radians(ry),h);
+  m = glm::translate<float>(m,glm::vec3(-point_of_interest));
   glm::vec4 tmp(camera_position,1);
   tmp = m * tmp;
   camera_position = glm::vec3(tmp.x,tmp.y,tmp.z);
@@ -110,6 +110,16 @@ bool CylinderRing::intersect(const Ray &r, Hit &h) const {
   return answer;
 } 
 
+BoundingBox CylinderRing::getBoundingBox() const {
+  glm::vec3 extent(outer_radius,height/2.0,outer_radius);
+  BoundingBox bb(center-extent,center+extent);
+  // NOTE: IntersectFiniteCylinder places the walls around the y axis
+  // rather than around the center, so the box must cover both
+  glm::vec3 axis_point(0,center.y,0);
+  bb.Extend(BoundingBox(axis_point-extent,axis_point+extent));
+  return bb;
+}
+
 // ====================================================================
 // ====================================================================
 
@@ -22,6 +22,7 @@ public:
 
   // for ray tracing
   bool intersect(const Ray &r, Hit &h) const;
+  BoundingBox getBoundingBox() const;
   
   // for lightning
   glm::vec3 closestPoint(glm::vec3 start);
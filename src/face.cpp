@@ -20,14 +20,14 @@ float Face::getArea() const {
 
 // =========================================================================
 
-glm::vec3 Face::RandomPoint() const {
+glm::vec3 Face::RandomPoint(Sampler &sampler) const {
   glm::vec3 a = (*this)[0]->get();
   glm::vec3 b = (*this)[1]->get();
   glm::vec3 c = (*this)[2]->get();
   glm::vec3 d = (*this)[3]->get();
 
-  float s = GLCanvas::args->rand(); // random real in [0,1]
-  float t = GLCanvas::args->rand(); // random real in [0,1]
+  float s = sampler.rand(); // random real in [0,1]
+  float t = sampler.rand(); // random real in [0,1]
 
   glm::vec3 answer = s*t*a + s*(1-t)*b + (1-s)*t*d + (1-s)*(1-t)*c;
   return answer;
@@ -51,6 +51,24 @@ bool Face::triangle_intersect(const Ray &r, Hit &h, Vertex *a, Vertex *b, Vertex
   Hit h2 = Hit(h);
   if (!plane_intersect(r,h2,intersect_backfacing)) return 0;  
 
+  float beta, gamma;
+  if (triangle_contains(r,a,b,c,beta,gamma)) {
+    h = h2;
+    // interpolate the texture coordinates
+    float alpha = 1 - beta - gamma;
+    float t_s = alpha * a->get_s() + beta * b->get_s() + gamma * c->get_s();
+    float t_t = alpha * a->get_t() + beta * b->get_t() + gamma * c->get_t();
+    h.setTextureCoords(t_s,t_t);
+    assert (h.getT() >= EPSILON);
+    return 1;
+  }
+
+  return 0;
+}
+
+
+bool Face::triangle_contains(const Ray &r, Vertex *a, Vertex *b, Vertex *c, float &beta, float &gamma) const {
+
   // figure out the barycentric coordinates:
   glm::vec3 Ro = r.getOrigin();
   glm::vec3 Rd = r.getDirection();
@@ -75,23 +93,25 @@ bool Face::triangle_intersect(const Ray &r, Hit &h, Vertex *a, Vertex *b, Vertex
                       a->get().y-b->get().y,a->get().y-Ro.y,Rd.y,
                       a->get().z-b->get().z,a->get().z-Ro.z,Rd.z);
 
-  float beta = glm::determinant(beta_mat) / detA;
-  float gamma = glm::determinant(gamma_mat) / detA;
+  beta = glm::determinant(beta_mat) / detA;
+  gamma = glm::determinant(gamma_mat) / detA;
 
-  if (beta >= -0.00001 && beta <= 1.00001 &&
-      gamma >= -0.00001 && gamma <= 1.00001 &&
-      beta + gamma <= 1.00001) {
-    h = h2;
-    // interpolate the texture coordinates
-    float alpha = 1 - beta - gamma;
-    float t_s = alpha * a->get_s() + beta * b->get_s() + gamma * c->get_s();
-    float t_t = alpha * a->get_t() + beta * b->get_t() + gamma * c->get_t();
-    h.setTextureCoords(t_s,t_t);
-    assert (h.getT() >= EPSILON);
-    return 1;
-  }
+  return (beta >= -0.00001 && beta <= 1.00001 &&
+          gamma >= -0.00001 && gamma <= 1.00001 &&
+          beta + gamma <= 1.00001);
+}
 
-  return 0;
+
+// only answers whether the quad is hit closer than tmax (the hit
+// point, material & texture coordinates are not needed for shadows)
+bool Face::occluded(const Ray &r, float tmax, bool intersect_backfacing) const {
+  // both triangles use the plane of the whole quad
+  Hit h;
+  h.set(tmax,NULL,glm::vec3(0,0,0));
+  if (!plane_intersect(r,h,intersect_backfacing)) return 0;
+  float beta, gamma;
+  return triangle_contains(r,(*this)[0],(*this)[1],(*this)[2],beta,gamma) ||
+    triangle_contains(r,(*this)[0],(*this)[2],(*this)[3],beta,gamma);
 }
 
 
@@ -7,6 +7,7 @@
 #include "hit.h"
 
 class Material;
+class Sampler;
 
 // ==============================================================
 // Simple class to store quads for use in radiosity & raytracing.
@@ -44,7 +45,7 @@ public:
   }
   Material* getMaterial() const { return material; }
   float getArea() const;
-  glm::vec3 RandomPoint() const;
+  glm::vec3 RandomPoint(Sampler &sampler) const;
   glm::vec3 computeNormal() const;
 
   // =========
@@ -58,6 +59,8 @@ public:
   // ==========
   // RAYTRACING
   bool intersect(const Ray &r, Hit &h, bool intersect_backfacing) const;
+  // true if the quad is hit closer than tmax
+  bool occluded(const Ray &r, float tmax, bool intersect_backfacing) const;
 
   // =========
   // RADIOSITY
@@ -68,6 +71,7 @@ protected:
 
   // helper functions
   bool triangle_intersect(const Ray &r, Hit &h, Vertex *a, Vertex *b, Vertex *c, bool intersect_backfacing) const;
+  bool triangle_contains(const Ray &r, Vertex *a, Vertex *b, Vertex *c, float &beta, float &gamma) const;
   bool plane_intersect(const Ray &r, Hit &h, bool intersect_backfacing) const;
 
   // don't use this constructor
@@ -0,0 +1,225 @@
+#include <cmath>
+#include <cassert>
+
+#include "facepacket.h"
+#include "face.h"
+#include "ray.h"
+#include "hit.h"
+#include "utils.h"
+
+// use SSE2 where available (every x86-64 compiler), otherwise the
+// lanes are intersected one after the other with the same math
+#if defined(__SSE2__) || defined(_M_X64)
+#define FACE_PACKET_SSE
+#include <emmintrin.h>
+#endif
+
+// the tolerances of Face::triangle_intersect
+#define FACE_PACKET_MIN_DET 0.000001f
+#define FACE_PACKET_BARY_TOLERANCE 0.00001f
+
+// ====================================================================
+// CONSTRUCTOR & MODIFIERS
+// ====================================================================
+
+FacePacket::FacePacket() {
+  for (int i = 0; i < FACE_PACKET_SIZE; i++) {
+    // a zero normal is parallel to every ray, so the lane is never hit
+    nx[i] = ny[i] = nz[i] = d[i] = 0;
+    ax[i] = ay[i] = az[i] = 0;
+    e1x[i] = e1y[i] = e1z[i] = 0;
+    e2x[i] = e2y[i] = e2z[i] = 0;
+    e3x[i] = e3y[i] = e3z[i] = 0;
+    for (int j = 0; j < 4; j++) {
+      tex_s[j][i] = 0;
+      tex_t[j][i] = 0;
+    }
+    material[i] = NULL;
+  }
+}
+
+
+void FacePacket::Set(int lane, Face *f) {
+  assert (lane >= 0 && lane < FACE_PACKET_SIZE);
+  Vertex *v[4] = { (*f)[0], (*f)[1], (*f)[2], (*f)[3] };
+  glm::vec3 normal = f->computeNormal();
+  nx[lane] = normal.x;
+  ny[lane] = normal.y;
+  nz[lane] = normal.z;
+  d[lane] = glm::dot(normal,v[0]->get());
+  glm::vec3 a = v[0]->get();
+  glm::vec3 e1 = v[1]->get() - a;
+  glm::vec3 e2 = v[2]->get() - a;
+  glm::vec3 e3 = v[3]->get() - a;
+  ax[lane] = a.x;   ay[lane] = a.y;   az[lane] = a.z;
+  e1x[lane] = e1.x; e1y[lane] = e1.y; e1z[lane] = e1.z;
+  e2x[lane] = e2.x; e2y[lane] = e2.y; e2z[lane] = e2.z;
+  e3x[lane] = e3.x; e3y[lane] = e3.y; e3z[lane] = e3.z;
+  for (int j = 0; j < 4; j++) {
+    tex_s[j][lane] = v[j]->get_s();
+    tex_t[j][lane] = v[j]->get_t();
+  }
+  material[lane] = f->getMaterial();
+}
+
+
+// ====================================================================
+// RAYTRACING
+// ====================================================================
+
+// The hit distance is the intersection with the plane of the quad.
+// Each triangle is then tested with Moller-Trumbore, which gives the
+// same barycentric coordinates (and the same determinant, up to sign)
+// as the Cramer's rule solve in Face::triangle_intersect.
+
+#ifdef FACE_PACKET_SSE
+
+int FacePacket::IntersectLanes(const Ray &r, float tmax, bool intersect_backfacing,
+                               float t_out[FACE_PACKET_SIZE], float beta_out[FACE_PACKET_SIZE],
+                               float gamma_out[FACE_PACKET_SIZE], int &second) const {
+  const glm::vec3 &o = r.getOrigin();
+  const glm::vec3 &dir = r.getDirection();
+  __m128 ox = _mm_set1_ps(o.x), oy = _mm_set1_ps(o.y), oz = _mm_set1_ps(o.z);
+  __m128 dx = _mm_set1_ps(dir.x), dy = _mm_set1_ps(dir.y), dz = _mm_set1_ps(dir.z);
+  __m128 zero = _mm_setzero_ps();
+
+  // the plane of the quad
+  __m128 Nx = _mm_loadu_ps(nx), Ny = _mm_loadu_ps(ny), Nz = _mm_loadu_ps(nz);
+  __m128 denom = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx,Nx),_mm_mul_ps(dy,Ny)),_mm_mul_ps(dz,Nz));
+  __m128 numer = _mm_sub_ps(_mm_loadu_ps(d),
+                            _mm_add_ps(_mm_add_ps(_mm_mul_ps(ox,Nx),_mm_mul_ps(oy,Ny)),_mm_mul_ps(oz,Nz)));
+  __m128 t = _mm_div_ps(numer,denom);
+  __m128 valid = _mm_cmpneq_ps(denom,zero);
+  if (!intersect_backfacing) valid = _mm_and_ps(valid,_mm_cmplt_ps(denom,zero));
+  valid = _mm_and_ps(valid,_mm_cmpgt_ps(t,_mm_set1_ps(EPSILON)));
+  valid = _mm_and_ps(valid,_mm_cmplt_ps(t,_mm_set1_ps(tmax)));
+  if (_mm_movemask_ps(valid) == 0) return 0;
+
+  __m128 tx = _mm_sub_ps(ox,_mm_loadu_ps(ax));
+  __m128 ty = _mm_sub_ps(oy,_mm_loadu_ps(ay));
+  __m128 tz = _mm_sub_ps(oz,_mm_loadu_ps(az));
+  __m128 min_det = _mm_set1_ps(FACE_PACKET_MIN_DET);
+  __m128 lo = _mm_set1_ps(-FACE_PACKET_BARY_TOLERANCE);
+  __m128 hi = _mm_set1_ps(1+FACE_PACKET_BARY_TOLERANCE);
+  __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+
+  // the triangle spanned by the edges (u,v) from the first vertex
+  __m128 beta[2], gamma[2], inside[2];
+  const float *ux[2] = { e1x, e2x }, *uy[2] = { e1y, e2y }, *uz[2] = { e1z, e2z };
+  const float *vx[2] = { e2x, e3x }, *vy[2] = { e2y, e3y }, *vz[2] = { e2z, e3z };
+  for (int k = 0; k < 2; k++) {
+    __m128 Ux = _mm_loadu_ps(ux[k]), Uy = _mm_loadu_ps(uy[k]), Uz = _mm_loadu_ps(uz[k]);
+    __m128 Vx = _mm_loadu_ps(vx[k]), Vy = _mm_loadu_ps(vy[k]), Vz = _mm_loadu_ps(vz[k]);
+    // p = dir x v
+    __m128 px = _mm_sub_ps(_mm_mul_ps(dy,Vz),_mm_mul_ps(dz,Vy));
+    __m128 py = _mm_sub_ps(_mm_mul_ps(dz,Vx),_mm_mul_ps(dx,Vz));
+    __m128 pz = _mm_sub_ps(_mm_mul_ps(dx,Vy),_mm_mul_ps(dy,Vx));
+    __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(Ux,px),_mm_mul_ps(Uy,py)),_mm_mul_ps(Uz,pz));
+    __m128 inv_det = _mm_div_ps(_mm_set1_ps(1.0f),det);
+    // q = (o - a) x u
+    __m128 qx = _mm_sub_ps(_mm_mul_ps(ty,Uz),_mm_mul_ps(tz,Uy));
+    __m128 qy = _mm_sub_ps(_mm_mul_ps(tz,Ux),_mm_mul_ps(tx,Uz));
+    __m128 qz = _mm_sub_ps(_mm_mul_ps(tx,Uy),_mm_mul_ps(ty,Ux));
+    beta[k] = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx,px),_mm_mul_ps(ty,py)),_mm_mul_ps(tz,pz)),inv_det);
+    gamma[k] = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx,qx),_mm_mul_ps(dy,qy)),_mm_mul_ps(dz,qz)),inv_det);
+    __m128 in = _mm_cmpgt_ps(_mm_and_ps(det,abs_mask),min_det);
+    in = _mm_and_ps(in,_mm_cmpge_ps(beta[k],lo));
+    in = _mm_and_ps(in,_mm_cmple_ps(beta[k],hi));
+    in = _mm_and_ps(in,_mm_cmpge_ps(gamma[k],lo));
+    in = _mm_and_ps(in,_mm_cmple_ps(gamma[k],hi));
+    in = _mm_and_ps(in,_mm_cmple_ps(_mm_add_ps(beta[k],gamma[k]),hi));
+    inside[k] = in;
+  }
+
+  // the first triangle is preferred (as in Face::intersect)
+  __m128 hit_first = _mm_and_ps(valid,inside[0]);
+  __m128 hit_second = _mm_andnot_ps(inside[0],_mm_and_ps(valid,inside[1]));
+  int mask = _mm_movemask_ps(_mm_or_ps(hit_first,hit_second));
+  if (mask == 0) return 0;
+  second = _mm_movemask_ps(hit_second);
+  _mm_storeu_ps(t_out,t);
+  _mm_storeu_ps(beta_out,_mm_or_ps(_mm_and_ps(hit_first,beta[0]),_mm_andnot_ps(hit_first,beta[1])));
+  _mm_storeu_ps(gamma_out,_mm_or_ps(_mm_and_ps(hit_first,gamma[0]),_mm_andnot_ps(hit_first,gamma[1])));
+  return mask;
+}
+
+#else
+
+int FacePacket::IntersectLanes(const Ray &r, float tmax, bool intersect_backfacing,
+                               float t_out[FACE_PACKET_SIZE], float beta_out[FACE_PACKET_SIZE],
+                               float gamma_out[FACE_PACKET_SIZE], int &second) const {
+  const glm::vec3 &o = r.getOrigin();
+  const glm::vec3 &dir = r.getDirection();
+  int mask = 0;
+  second = 0;
+  for (int i = 0; i < FACE_PACKET_SIZE; i++) {
+    // the plane of the quad
+    float denom = dir.x*nx[i] + dir.y*ny[i] + dir.z*nz[i];
+    if (denom == 0) continue;
+    if (!intersect_backfacing && denom >= 0) continue;
+    float t = (d[i] - (o.x*nx[i] + o.y*ny[i] + o.z*nz[i])) / denom;
+    if (!(t > EPSILON && t < tmax)) continue;
+
+    glm::vec3 tvec(o.x-ax[i],o.y-ay[i],o.z-az[i]);
+    glm::vec3 e[3] = { glm::vec3(e1x[i],e1y[i],e1z[i]),
+                       glm::vec3(e2x[i],e2y[i],e2z[i]),
+                       glm::vec3(e3x[i],e3y[i],e3z[i]) };
+    // the first triangle is preferred (as in Face::intersect)
+    for (int k = 0; k < 2; k++) {
+      glm::vec3 p = glm::cross(dir,e[k+1]);
+      float det = glm::dot(e[k],p);
+      if (!(std::fabs(det) > FACE_PACKET_MIN_DET)) continue;
+      glm::vec3 q = glm::cross(tvec,e[k]);
+      float beta = glm::dot(tvec,p) / det;
+      float gamma = glm::dot(dir,q) / det;
+      if (beta >= -FACE_PACKET_BARY_TOLERANCE && beta <= 1+FACE_PACKET_BARY_TOLERANCE &&
+          gamma >= -FACE_PACKET_BARY_TOLERANCE && gamma <= 1+FACE_PACKET_BARY_TOLERANCE &&
+          beta + gamma <= 1+FACE_PACKET_BARY_TOLERANCE) {
+        mask |= 1 << i;
+        if (k == 1) second |= 1 << i;
+        t_out[i] = t;
+        beta_out[i] = beta;
+        gamma_out[i] = gamma;
+        break;
+      }
+    }
+  }
+  return mask;
+}
+
+#endif
+
+
+bool FacePacket::intersect(const Ray &r, Hit &h, bool intersect_backfacing) const {
+  float t[FACE_PACKET_SIZE], beta[FACE_PACKET_SIZE], gamma[FACE_PACKET_SIZE];
+  int second;
+  int mask = IntersectLanes(r,h.getT(),intersect_backfacing,t,beta,gamma,second);
+  if (mask == 0) return false;
+
+  // the closest lane, the earlier lane on a tie
+  int best = -1;
+  for (int i = 0; i < FACE_PACKET_SIZE; i++) {
+    if (!(mask & (1 << i))) continue;
+    if (best == -1 || t[i] < t[best]) best = i;
+  }
+  h.set(t[best],material[best],glm::vec3(nx[best],ny[best],nz[best]));
+
+  // interpolate the texture coordinates over triangle (a,b,c) or (a,c,d)
+  int j = (second & (1 << best)) ? 2 : 1;
+  float alpha = 1 - beta[best] - gamma[best];
+  float t_s = alpha * tex_s[0][best] + beta[best] * tex_s[j][best] + gamma[best] * tex_s[j+1][best];
+  float t_t = alpha * tex_t[0][best] + beta[best] * tex_t[j][best] + gamma[best] * tex_t[j+1][best];
+  h.setTextureCoords(t_s,t_t);
+  assert (h.getT() >= EPSILON);
+  return true;
+}
+
+
+bool FacePacket::occluded(const Ray &r, float tmax, bool intersect_backfacing) const {
+  float t[FACE_PACKET_SIZE], beta[FACE_PACKET_SIZE], gamma[FACE_PACKET_SIZE];
+  int second;
+  return IntersectLanes(r,tmax,intersect_backfacing,t,beta,gamma,second) != 0;
+}
+
+// ====================================================================
+// ====================================================================
@@ -0,0 +1,71 @@
+#ifndef _FACE_PACKET_H_
+#define _FACE_PACKET_H_
+
+class Face;
+class Material;
+class Ray;
+class Hit;
+
+// the number of quads intersected at once (one SSE register)
+#define FACE_PACKET_SIZE 4
+
+// ====================================================================
+// ====================================================================
+// A flat structure-of-arrays copy of (up to) 4 quads, stored so that
+// all 4 can be intersected with a ray at once.  Everything the
+// intersection needs is precomputed: the plane of each quad, the
+// first vertex & the edge vectors of its two triangles (a,b,c) and
+// (a,c,d), and the texture coordinates of the 4 corners.  This avoids
+// walking the half edges to find the vertices, recomputing the face
+// normal and copying Hits for every test in Face::intersect.
+//
+// The same points are accepted as by Face::intersect: the hit
+// distance comes from the plane of the quad (with the averaged
+// normal) and each triangle is tested with the same tolerances on the
+// barycentric coordinates.
+
+class FacePacket {
+
+public:
+
+  // ========================
+  // CONSTRUCTOR & MODIFIERS
+  // all lanes start out empty (never hit)
+  FacePacket();
+  void Set(int lane, Face *f);
+
+  // ==========
+  // RAYTRACING
+  // finds the closest hit of the packet (closer than h.getT())
+  bool intersect(const Ray &r, Hit &h, bool intersect_backfacing) const;
+  // true if any quad of the packet is hit closer than tmax
+  bool occluded(const Ray &r, float tmax, bool intersect_backfacing) const;
+
+private:
+
+  // HELPER FUNCTIONS
+  // intersects all lanes, returns a bit mask of the lanes hit closer
+  // than tmax (second: the lanes where only triangle (a,c,d) was hit)
+  int IntersectLanes(const Ray &r, float tmax, bool intersect_backfacing,
+                     float t[FACE_PACKET_SIZE], float beta[FACE_PACKET_SIZE],
+                     float gamma[FACE_PACKET_SIZE], int &second) const;
+
+  // REPRESENTATION
+  // the plane of each quad: dot(normal,p) = d
+  float nx[FACE_PACKET_SIZE], ny[FACE_PACKET_SIZE], nz[FACE_PACKET_SIZE];
+  float d[FACE_PACKET_SIZE];
+  // the first vertex, and the edges to the other three vertices
+  float ax[FACE_PACKET_SIZE], ay[FACE_PACKET_SIZE], az[FACE_PACKET_SIZE];
+  float e1x[FACE_PACKET_SIZE], e1y[FACE_PACKET_SIZE], e1z[FACE_PACKET_SIZE];
+  float e2x[FACE_PACKET_SIZE], e2y[FACE_PACKET_SIZE], e2z[FACE_PACKET_SIZE];
+  float e3x[FACE_PACKET_SIZE], e3y[FACE_PACKET_SIZE], e3z[FACE_PACKET_SIZE];
+  // the texture coordinates of the 4 corners
+  float tex_s[4][FACE_PACKET_SIZE];
+  float tex_t[4][FACE_PACKET_SIZE];
+  Material *material[FACE_PACKET_SIZE];
+};
+
+// ====================================================================
+// ====================================================================
+
+#endif
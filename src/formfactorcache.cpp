@@ -0,0 +1,51 @@
+#include <algorithm>
+
+#include "formfactorcache.h"
+
+// ==================================================================
+
+float FormFactorColumn::getValue(int i) const {
+  std::vector<int>::const_iterator found = std::lower_bound(rows.begin(),rows.end(),i);
+  if (found == rows.end() || *found != i) return 0;
+  return values[found-rows.begin()];
+}
+
+// ==================================================================
+
+void FormFactorCache::Reset(int num_patches, int capacity) {
+  assert (num_patches >= 0 && capacity >= 0);
+  slot_of_patch.assign(num_patches,-1);
+  columns.assign(std::min(capacity,num_patches),FormFactorColumn());
+  patch_of_slot.assign(columns.size(),-1);
+  last_used.assign(columns.size(),-1);
+  clock = 0;
+}
+
+
+const FormFactorColumn* FormFactorCache::Find(int j) {
+  assert (j >= 0 && j < numPatches());
+  int slot = slot_of_patch[j];
+  if (slot == -1) return NULL;
+  last_used[slot] = clock++;
+  return &columns[slot];
+}
+
+
+FormFactorColumn& FormFactorCache::Insert(int j) {
+  assert (j >= 0 && j < numPatches());
+  assert (slot_of_patch[j] == -1);
+  assert (getCapacity() > 0);
+  // an unused slot, or else the least recently used one (the column
+  // is far more expensive to compute than this search)
+  int slot = std::min_element(last_used.begin(),last_used.end()) - last_used.begin();
+  if (patch_of_slot[slot] != -1) {
+    slot_of_patch[patch_of_slot[slot]] = -1;
+  }
+  slot_of_patch[j] = slot;
+  patch_of_slot[slot] = j;
+  last_used[slot] = clock++;
+  columns[slot].clear();
+  return columns[slot];
+}
+
+// ==================================================================
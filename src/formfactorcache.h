@@ -0,0 +1,62 @@
+#ifndef _FORM_FACTOR_CACHE_H_
+#define _FORM_FACTOR_CACHE_H_
+
+#include <cassert>
+#include <vector>
+
+// ====================================================================
+// The non zero form factors of one column j of the matrix, F_i,j for
+// each receiving patch i, sorted by i.
+
+struct FormFactorColumn {
+  std::vector<int> rows;
+  std::vector<float> values;
+  void clear() { rows.clear(); values.clear(); }
+  // F_i,j (0 if not stored)
+  float getValue(int i) const;
+};
+
+// ====================================================================
+// ====================================================================
+// A bounded cache of form factor columns, for computing the form
+// factors on demand (-lazy_form_factors) rather than the whole matrix
+// up front.  When the cache is full the least recently used column
+// is replaced, so the memory is O(num_patches * capacity).
+
+class FormFactorCache {
+
+public:
+
+  // ========================
+  // CONSTRUCTOR & RESET
+  FormFactorCache() { Reset(0,0); }
+  void Reset(int num_patches, int capacity);
+
+  // =========
+  // ACCESSORS
+  int numPatches() const { return slot_of_patch.size(); }
+  int getCapacity() const { return columns.size(); }
+  // the column of patch j if it is cached (NULL otherwise)
+  const FormFactorColumn* Find(int j);
+  // an empty column for patch j (replacing the least recently used
+  // column if the cache is full), which the caller must fill
+  FormFactorColumn& Insert(int j);
+
+private:
+
+  // ==============
+  // REPRESENTATION
+  // the slot of each patch's column (-1 if not cached)
+  std::vector<int> slot_of_patch;
+  // per slot: the column, which patch it belongs to (-1 if unused)
+  // and when it was last used
+  std::vector<FormFactorColumn> columns;
+  std::vector<int> patch_of_slot;
+  std::vector<long long> last_used;
+  long long clock;
+};
+
+// ====================================================================
+// ====================================================================
+
+#endif
@@ -0,0 +1,306 @@
+#include <algorithm>
+#include <cstring>
+
+#include "formfactormatrix.h"
+#include "parallel.h"
+
+// ==================================================================
+// BUILD
+// ==================================================================
+
+void FormFactorMatrix::Clear() {
+  file.Close();
+  num_patches = 0;
+  quantized = false;
+  column_start_storage.clear();
+  rows_storage.clear();
+  values_storage.clear();
+  quantized_values_storage.clear();
+  column_scale_storage.clear();
+  occluded_storage.clear();
+  row_start.clear();
+  row_columns.clear();
+  row_values.clear();
+  SetArrays();
+}
+
+
+// (swapping the vectors keeps their data where it is, so the pointers
+// remain valid, as do the pointers into the mapping)
+void FormFactorMatrix::Swap(FormFactorMatrix &other) {
+  std::swap(num_patches,other.num_patches);
+  std::swap(num_entries,other.num_entries);
+  std::swap(quantized,other.quantized);
+  std::swap(column_start,other.column_start);
+  std::swap(rows,other.rows);
+  std::swap(values,other.values);
+  std::swap(quantized_values,other.quantized_values);
+  std::swap(column_scale,other.column_scale);
+  std::swap(occluded,other.occluded);
+  column_start_storage.swap(other.column_start_storage);
+  rows_storage.swap(other.rows_storage);
+  values_storage.swap(other.values_storage);
+  quantized_values_storage.swap(other.quantized_values_storage);
+  column_scale_storage.swap(other.column_scale_storage);
+  occluded_storage.swap(other.occluded_storage);
+  file.Swap(other.file);
+  row_start.swap(other.row_start);
+  row_columns.swap(other.row_columns);
+  row_values.swap(other.row_values);
+}
+
+
+void FormFactorMatrix::SetArrays() {
+  num_entries = rows_storage.size();
+  column_start = column_start_storage.data();
+  rows = rows_storage.data();
+  values = values_storage.data();
+  quantized_values = quantized_values_storage.data();
+  column_scale = column_scale_storage.data();
+  occluded = occluded_storage.data();
+}
+
+
+void FormFactorMatrix::Build(int n, std::vector<FormFactorEntry> &entries,
+                             float threshold, bool quantize, int num_threads) {
+  assert (n > 0);
+  Clear();
+  num_patches = n;
+  std::vector<int> &column_start = column_start_storage;
+  std::vector<int> &rows = rows_storage;
+  std::vector<float> &values = values_storage;
+
+  // count the entries of each column that will be kept
+  column_start.assign(num_patches+1,0);
+  for (unsigned int e = 0; e < entries.size(); e++) {
+    const FormFactorEntry &entry = entries[e];
+    assert (entry.row >= 0 && entry.row < num_patches);
+    assert (entry.column >= 0 && entry.column < num_patches);
+    if (entry.value <= 0 || entry.value < threshold) continue;
+    column_start[entry.column+1]++;
+  }
+  for (int j = 0; j < num_patches; j++) {
+    column_start[j+1] += column_start[j];
+  }
+
+  // put each entry in its column
+  num_entries = column_start[num_patches];
+  std::vector<FormFactorEntry> sorted(num_entries);
+  std::vector<int> next(column_start.begin(),column_start.end()-1);
+  for (unsigned int e = 0; e < entries.size(); e++) {
+    const FormFactorEntry &entry = entries[e];
+    if (entry.value <= 0 || entry.value < threshold) continue;
+    sorted[next[entry.column]++] = entry;
+  }
+  std::vector<FormFactorEntry>().swap(entries);
+
+  // sort each column by row
+  ParallelFor(num_patches, num_threads, [&](int j) {
+      std::sort(sorted.begin()+column_start[j],sorted.begin()+column_start[j+1],
+                [](const FormFactorEntry &a, const FormFactorEntry &b) { return a.row < b.row; });
+    });
+  rows.resize(num_entries);
+  values.resize(num_entries);
+  occluded_storage.assign((num_entries+31)/32,0);
+  for (int k = 0; k < num_entries; k++) {
+    rows[k] = sorted[k].row;
+    values[k] = sorted[k].value;
+    if (sorted[k].occluded) occluded_storage[k/32] |= 1u << (k%32);
+  }
+  std::vector<FormFactorEntry>().swap(sorted);
+
+  // now we need to normalize the form factors, each row to sum to 1
+  std::vector<double> row_sum(num_patches,0.0);
+  for (int k = 0; k < num_entries; k++) {
+    row_sum[rows[k]] += values[k];
+  }
+  ParallelFor(num_patches, num_threads, [&](int j) {
+      for (int k = column_start[j]; k < column_start[j+1]; k++) {
+        values[k] = values[k] / row_sum[rows[k]];
+      }
+    });
+
+  if (quantize) Quantize(num_threads);
+  SetArrays();
+}
+
+
+// (on the storage, before SetArrays)
+void FormFactorMatrix::Quantize(int num_threads) {
+  const std::vector<int> &column_start = column_start_storage;
+  std::vector<float> &values = values_storage;
+  std::vector<uint16_t> &quantized_values = quantized_values_storage;
+  std::vector<float> &column_scale = column_scale_storage;
+  quantized_values.resize(num_entries);
+  column_scale.resize(num_patches);
+  ParallelFor(num_patches, num_threads, [&](int j) {
+      float max = 0;
+      for (int k = column_start[j]; k < column_start[j+1]; k++) {
+        max = std::max(max,values[k]);
+      }
+      column_scale[j] = max / 65535.0f;
+      for (int k = column_start[j]; k < column_start[j+1]; k++) {
+        quantized_values[k] = uint16_t(values[k] / max * 65535.0f + 0.5f);
+      }
+    });
+  std::vector<float>().swap(values);
+  quantized = true;
+}
+
+
+void FormFactorMatrix::BuildRows() {
+  if (hasRows()) return;
+  row_start.assign(num_patches+1,0);
+  for (int k = 0; k < num_entries; k++) {
+    row_start[rows[k]+1]++;
+  }
+  for (int i = 0; i < num_patches; i++) {
+    row_start[i+1] += row_start[i];
+  }
+  // visiting the columns in order leaves each row sorted by column
+  row_columns.resize(num_entries);
+  row_values.resize(num_entries);
+  std::vector<int> next(row_start.begin(),row_start.end()-1);
+  for (int j = 0; j < num_patches; j++) {
+    for (int k = column_start[j]; k < column_start[j+1]; k++) {
+      int e = next[rows[k]]++;
+      row_columns[e] = j;
+      row_values[e] = getValue(j,k);
+    }
+  }
+}
+
+
+// ==================================================================
+// ACCESSORS
+// ==================================================================
+
+// (of the arrays mapped from a file too)
+size_t FormFactorMatrix::getMemory() const {
+  if (num_patches == 0) return 0;
+  size_t value_size = quantized ? sizeof(uint16_t) : sizeof(float);
+  return (num_patches+1) * sizeof(int) +
+    num_entries * (sizeof(int) + value_size) +
+    (quantized ? num_patches * sizeof(float) : 0) +
+    (num_entries+31)/32 * sizeof(uint32_t) +
+    row_start.size() * sizeof(int) +
+    row_columns.size() * sizeof(int) +
+    row_values.size() * sizeof(float);
+}
+
+
+float FormFactorMatrix::getFormFactor(int i, int j) const {
+  assert (i >= 0 && i < num_patches);
+  int begin = columnBegin(j);
+  int end = columnEnd(j);
+  const int *found = std::lower_bound(rows+begin,rows+end,i);
+  if (found == rows+end || *found != i) return 0;
+  return getValue(j,found-rows);
+}
+
+
+bool FormFactorMatrix::isOccluded(int i, int j) const {
+  assert (i >= 0 && i < num_patches);
+  int begin = columnBegin(j);
+  int end = columnEnd(j);
+  const int *found = std::lower_bound(rows+begin,rows+end,i);
+  if (found == rows+end || *found != i) return false;
+  int k = found-rows;
+  return (occluded[k/32] >> (k%32)) & 1;
+}
+
+// ==================================================================
+// FILE I/O
+// ==================================================================
+
+// The matrix in a file is (in the byte order of the machine that wrote
+// it) the header, then each array, every array starting at a multiple
+// of FORM_FACTOR_ALIGNMENT bytes from the start of the matrix.  The
+// arrays the matrix doesn't have (the values or the quantized values &
+// scales) are empty.
+
+#define FORM_FACTOR_NUM_ARRAYS 6
+
+struct FormFactorHeader {
+  int32_t num_patches;
+  int32_t quantized;
+  int32_t num_entries;
+  int32_t padding;
+};
+
+
+// the offset (from the start of the matrix) & the size (in bytes) of
+// each array, returns the size of the matrix
+static size_t FormFactorLayout(int num_patches, int num_entries, bool quantized,
+                               size_t offsets[FORM_FACTOR_NUM_ARRAYS],
+                               size_t sizes[FORM_FACTOR_NUM_ARRAYS]) {
+  sizes[0] = (num_patches+1) * sizeof(int);
+  sizes[1] = num_entries * sizeof(int);
+  sizes[2] = quantized ? 0 : num_entries * sizeof(float);
+  sizes[3] = quantized ? num_entries * sizeof(uint16_t) : 0;
+  sizes[4] = quantized ? num_patches * sizeof(float) : 0;
+  sizes[5] = (num_entries+31)/32 * sizeof(uint32_t);
+  size_t offset = sizeof(FormFactorHeader);
+  for (int a = 0; a < FORM_FACTOR_NUM_ARRAYS; a++) {
+    offset = (offset + FORM_FACTOR_ALIGNMENT - 1) / FORM_FACTOR_ALIGNMENT * FORM_FACTOR_ALIGNMENT;
+    offsets[a] = offset;
+    offset += sizes[a];
+  }
+  return offset;
+}
+
+
+bool FormFactorMatrix::Write(FILE *f) const {
+  FormFactorHeader header;
+  memset(&header, 0, sizeof(header));
+  header.num_patches = num_patches;
+  header.quantized = quantized;
+  header.num_entries = num_entries;
+  size_t offsets[FORM_FACTOR_NUM_ARRAYS], sizes[FORM_FACTOR_NUM_ARRAYS];
+  size_t total = FormFactorLayout(num_patches, num_entries, quantized, offsets, sizes);
+  const void *arrays[FORM_FACTOR_NUM_ARRAYS] =
+    { column_start, rows, values, quantized_values, column_scale, occluded };
+
+  bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+  size_t written = sizeof(header);
+  char zeros[FORM_FACTOR_ALIGNMENT] = { 0 };
+  for (int a = 0; ok && a < FORM_FACTOR_NUM_ARRAYS; a++) {
+    size_t padding = offsets[a] - written;
+    ok = fwrite(zeros, 1, padding, f) == padding &&
+      (sizes[a] == 0 || fwrite(arrays[a], 1, sizes[a], f) == sizes[a]);
+    written = offsets[a] + sizes[a];
+  }
+  assert (!ok || written == total);
+  return ok;
+}
+
+
+bool FormFactorMatrix::Read(MappedFile &mapped, size_t offset) {
+  assert (offset % FORM_FACTOR_ALIGNMENT == 0);
+  FormFactorHeader header;
+  if (mapped.getSize() < offset + sizeof(header)) return false;
+  memcpy(&header, mapped.getData() + offset, sizeof(header));
+  if (header.num_patches <= 0 || header.num_entries < 0) return false;
+  size_t offsets[FORM_FACTOR_NUM_ARRAYS], sizes[FORM_FACTOR_NUM_ARRAYS];
+  if (offset + FormFactorLayout(header.num_patches, header.num_entries, header.quantized != 0,
+                                offsets, sizes) != mapped.getSize()) return false;
+  const char *data = mapped.getData() + offset;
+  const int *starts = (const int*)(data + offsets[0]);
+  if (starts[0] != 0 || starts[header.num_patches] != header.num_entries) return false;
+
+  Clear();
+  file.Swap(mapped);
+  data = file.getData() + offset;
+  num_patches = header.num_patches;
+  num_entries = header.num_entries;
+  quantized = header.quantized != 0;
+  column_start = (const int*)(data + offsets[0]);
+  rows = (const int*)(data + offsets[1]);
+  values = (const float*)(data + offsets[2]);
+  quantized_values = (const uint16_t*)(data + offsets[3]);
+  column_scale = (const float*)(data + offsets[4]);
+  occluded = (const uint32_t*)(data + offsets[5]);
+  return true;
+}
+
+// ==================================================================
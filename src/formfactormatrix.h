@@ -0,0 +1,156 @@
+#ifndef _FORM_FACTOR_MATRIX_H_
+#define _FORM_FACTOR_MATRIX_H_
+
+#include <cassert>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "mappedfile.h"
+
+// the arrays of a matrix in a file start at multiples of this (from
+// the start of the matrix, see FormFactorMatrix::Write)
+#define FORM_FACTOR_ALIGNMENT 64
+
+// ====================================================================
+// A single (not yet normalized) form factor, F_row,column, and if
+// some of the shadow rays between the patches were blocked
+struct FormFactorEntry {
+  int row;
+  int column;
+  float value;
+  bool occluded;
+};
+
+// ====================================================================
+// ====================================================================
+// The radiosity form factors as a sparse matrix.  Most pairs of
+// patches don't see each other (occluded, back facing or tiny), so
+// only the non zero form factors (above a threshold) are stored.
+//
+// The entries are stored in compressed columns: the entries of
+// column j (the energy each patch receives when patch j shoots) are
+// consecutive and sorted by row, which is the access pattern of the
+// progressive radiosity solver.  The values may optionally be stored
+// as 16 bits, scaled by the largest value of the column.  The
+// gathering solvers need the rows instead, those build a second copy
+// of the entries.
+//
+// The entry arrays are also the layout of the matrix in a file, so a
+// matrix read from file is used straight from the mapped pages.
+
+class FormFactorMatrix {
+
+public:
+
+  // ========================
+  // CONSTRUCTOR & BUILD
+  FormFactorMatrix() { Clear(); }
+  // empty the matrix
+  void Clear();
+  // exchange the contents of the two matrices
+  void Swap(FormFactorMatrix &other);
+  // replaces the current contents of the matrix, entries smaller
+  // than the threshold are dropped, then the rows are normalized to
+  // sum to 1 (entries is used as scratch space)
+  void Build(int num_patches, std::vector<FormFactorEntry> &entries,
+             float threshold, bool quantize, int num_threads);
+
+  // =========
+  // ACCESSORS
+  int numPatches() const { return num_patches; }
+  int numEntries() const { return num_entries; }
+  bool isQuantized() const { return quantized; }
+  // the memory used by the entries, in bytes
+  size_t getMemory() const;
+  // F_i,j radiant energy leaving i arriving at j (0 if not stored)
+  float getFormFactor(int i, int j) const;
+  // were the patches of a stored form factor partly occluded?
+  bool isOccluded(int i, int j) const;
+
+  // the entries of column j are [columnBegin(j),columnEnd(j))
+  int columnBegin(int j) const {
+    assert (j >= 0 && j < num_patches);
+    return column_start[j]; }
+  int columnEnd(int j) const {
+    assert (j >= 0 && j < num_patches);
+    return column_start[j+1]; }
+  int getRow(int k) const { return rows[k]; }
+  float getValue(int j, int k) const {
+    assert (k >= columnBegin(j) && k < columnEnd(j));
+    if (quantized) return quantized_values[k] * column_scale[j];
+    return values[k]; }
+
+  // the entries may also be stored by row (for the gathering solvers,
+  // see BuildRows), the entries of row i are [rowBegin(i),rowEnd(i))
+  bool hasRows() const { return !row_start.empty(); }
+  int rowBegin(int i) const {
+    assert (hasRows() && i >= 0 && i < num_patches);
+    return row_start[i]; }
+  int rowEnd(int i) const {
+    assert (hasRows() && i >= 0 && i < num_patches);
+    return row_start[i+1]; }
+  const int* getRowColumns() const { return row_columns.data(); }
+  const float* getRowValues() const { return row_values.data(); }
+
+  // =========
+  // MODIFIERS
+  // a second copy of the entries, stored by row (as floats)
+  void BuildRows();
+
+  // =========
+  // FILE I/O
+  // the entries (not the copy by row) in binary, the file must be at
+  // a multiple of FORM_FACTOR_ALIGNMENT.  False if the write failed
+  bool Write(FILE *file) const;
+  // replaces the contents of the matrix with the entries stored by
+  // Write at offset (a multiple of FORM_FACTOR_ALIGNMENT) of the file.
+  // The matrix then uses (& keeps open) the mapping, false if the file
+  // ends too soon
+  bool Read(MappedFile &file, size_t offset);
+
+private:
+
+  // don't copy, the mapped file belongs to one matrix (see Swap)
+  FormFactorMatrix(const FormFactorMatrix&) { assert(0); }
+  FormFactorMatrix& operator=(const FormFactorMatrix&) { assert(0); return *this; }
+
+  // HELPER FUNCTIONS
+  void Quantize(int num_threads);
+  // point the arrays at the storage
+  void SetArrays();
+
+  // ==============
+  // REPRESENTATION
+  int num_patches;
+  int num_entries;
+  bool quantized;
+  // num_patches+1 offsets into the entry arrays
+  const int *column_start;
+  const int *rows;
+  // either the values, or the quantized values & a scale per column
+  const float *values;
+  const uint16_t *quantized_values;
+  const float *column_scale;
+  // one bit per entry
+  const uint32_t *occluded;
+  // the arrays above are either in this storage (built) or in the
+  // mapped file (read)
+  std::vector<int> column_start_storage;
+  std::vector<int> rows_storage;
+  std::vector<float> values_storage;
+  std::vector<uint16_t> quantized_values_storage;
+  std::vector<float> column_scale_storage;
+  std::vector<uint32_t> occluded_storage;
+  MappedFile file;
+  // the optional copy by row
+  std::vector<int> row_start;
+  std::vector<int> row_columns;
+  std::vector<float> row_values;
+};
+
+// ====================================================================
+// ====================================================================
+
+#endif
@@ -0,0 +1,170 @@
+#include <iostream>
+#include <sys/stat.h>
+
+#include "framewriter.h"
+#include "utils.h"
+
+#if defined(_WIN32)
+#define popen _popen
+#define pclose _pclose
+#define FRAME_WRITER_PIPE_MODE "wb"
+#else
+#define FRAME_WRITER_PIPE_MODE "w"
+#endif
+
+// ====================================================================
+// CONSTRUCTOR, OPEN & CLOSE
+// ====================================================================
+
+FrameWriter::FrameWriter() {
+  format = FRAME_PPM_FILES;
+  width = 0;
+  height = 0;
+  file = NULL;
+  is_pipe = false;
+  closing = false;
+  failed = false;
+}
+
+
+static bool EndsWith(const std::string &s, const std::string &suffix) {
+  return s.size() >= suffix.size() &&
+    s.compare(s.size()-suffix.size(), suffix.size(), suffix) == 0;
+}
+
+
+bool FrameWriter::Open(const std::string &t, int w, int h) {
+  assert (!thread.joinable());
+  assert (w > 0 && h > 0);
+  target = t;
+  width = w;
+  height = h;
+  closing = false;
+  failed = false;
+  if (target.size() > 1 && target[0] == '|') {
+    format = FRAME_Y4M;
+    is_pipe = true;
+    file = popen(target.c_str()+1, FRAME_WRITER_PIPE_MODE);
+  } else if (EndsWith(target,".y4m") || EndsWith(target,".rgb")) {
+    format = EndsWith(target,".y4m") ? FRAME_Y4M : FRAME_RGB;
+    is_pipe = false;
+    file = fopen(target.c_str(), "wb");
+  } else {
+    format = FRAME_PPM_FILES;
+    if (mkdir(target.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) == -1) {
+      std::cerr << "ERROR: could not create directory " << target << std::endl;
+      return false;
+    }
+  }
+  if (format != FRAME_PPM_FILES && file == NULL) {
+    std::cerr << "ERROR: could not open " << target << std::endl;
+    return false;
+  }
+  if (format == FRAME_Y4M) {
+    fprintf(file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n", width, height, FRAME_WRITER_FPS);
+  } else if (format == FRAME_RGB) {
+    std::cout << "writing raw " << width << "x" << height << " RGB frames to " << target << std::endl;
+  }
+  thread = std::thread(&FrameWriter::WriterThread, this);
+  return true;
+}
+
+
+bool FrameWriter::Close() {
+  if (!thread.joinable()) return !failed;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    closing = true;
+  }
+  changed.notify_all();
+  thread.join();
+  if (file != NULL) {
+    int err = is_pipe ? pclose(file) : fclose(file);
+    if (err != 0) failed = true;
+    file = NULL;
+  }
+  return !failed;
+}
+
+// ====================================================================
+// WRITING
+// ====================================================================
+
+void FrameWriter::AddFrame(const std::vector<glm::vec3> &colors) {
+  assert (thread.joinable());
+  assert ((int)colors.size() == width*height);
+  std::unique_lock<std::mutex> lock(mutex);
+  changed.wait(lock, [this] { return queue.size() < FRAME_WRITER_MAX_QUEUED; });
+  queue.push_back(colors);
+  lock.unlock();
+  changed.notify_all();
+}
+
+
+void FrameWriter::WriterThread() {
+  int index = 0;
+  while (true) {
+    std::vector<glm::vec3> colors;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      changed.wait(lock, [this] { return closing || !queue.empty(); });
+      if (queue.empty()) return;
+      colors.swap(queue.front());
+      queue.pop_front();
+    }
+    // there is room for another frame
+    changed.notify_all();
+    if (!WriteFrame(colors, index)) failed = true;
+    index++;
+  }
+}
+
+
+bool FrameWriter::WriteFrame(const std::vector<glm::vec3> &colors, int index) {
+  // the sRGB bytes of each row, from the top
+  std::vector<unsigned char> rgb(3*width*height);
+  for (int row = 0; row < height; row++) {
+    for (int x = 0; x < width; x++) {
+      const glm::vec3 &color = colors[x*height + height-1-row];
+      unsigned char *pixel = &rgb[3*(row*width+x)];
+      for (int c = 0; c < 3; c++) {
+        float byte = 255 * linear_to_srgb(color[c]);
+        pixel[c] = byte >= 255 ? 255 : (byte > 0 ? (unsigned char)byte : 0);
+      }
+    }
+  }
+
+  if (format == FRAME_PPM_FILES) {
+    char filename[1024];
+    snprintf(filename, 1024, "%s/out%d.ppm", target.c_str(), index);
+    FILE *fp = fopen(filename, "wb");
+    if (fp == NULL) {
+      std::cerr << "ERROR: could not write " << filename << std::endl;
+      return false;
+    }
+    fprintf(fp, "P6\n%d %d\n255\n", width, height);
+    bool ok = fwrite(rgb.data(), 1, rgb.size(), fp) == rgb.size();
+    ok = (fclose(fp) == 0) && ok;
+    if (ok) std::cout << "File " << filename << " written" << std::endl;
+    return ok;
+  }
+
+  if (format == FRAME_RGB) {
+    return fwrite(rgb.data(), 1, rgb.size(), file) == rgb.size();
+  }
+
+  // Y'CbCr (BT.601, studio range) planes
+  int n = width*height;
+  std::vector<unsigned char> yuv(3*n);
+  for (int i = 0; i < n; i++) {
+    float r = rgb[3*i], g = rgb[3*i+1], b = rgb[3*i+2];
+    yuv[i]     = (unsigned char)(16.5f + (65.738f*r + 129.057f*g + 25.064f*b) / 256);
+    yuv[n+i]   = (unsigned char)(128.5f + (-37.945f*r - 74.494f*g + 112.439f*b) / 256);
+    yuv[2*n+i] = (unsigned char)(128.5f + (112.439f*r - 94.154f*g - 18.285f*b) / 256);
+  }
+  return fputs("FRAME\n", file) >= 0 &&
+    fwrite(yuv.data(), 1, yuv.size(), file) == yuv.size();
+}
+
+// ====================================================================
+// ====================================================================
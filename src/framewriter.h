@@ -0,0 +1,87 @@
+#ifndef _FRAME_WRITER_H_
+#define _FRAME_WRITER_H_
+
+#include <cassert>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <glm/glm.hpp>
+
+// the rendering waits once this many frames are waiting to be written
+#define FRAME_WRITER_MAX_QUEUED 2
+// the frame rate recorded in .y4m streams
+#define FRAME_WRITER_FPS 24
+
+// ====================================================================
+// ====================================================================
+// Writes the frames of an animation (e.g., the lightning sequence) as
+// they are rendered.  The target is one of
+//
+//   frames         a directory (created) with one .ppm file per frame
+//   movie.y4m      a YUV4MPEG2 stream (8 bit 4:4:4), which most video
+//                  tools read directly
+//   movie.rgb      the raw 8 bit RGB frames, top row first, no header
+//   "|command"     a .y4m stream to the standard input of the command
+//                  (e.g., "|ffmpeg -i - movie.mp4")
+//
+// The frames are converted & written by a background thread, so the
+// next frame is rendered meanwhile.
+
+class FrameWriter {
+
+public:
+
+  // ========================
+  // CONSTRUCTOR & DESTRUCTOR
+  FrameWriter();
+  ~FrameWriter() { Close(); }
+  // false if the target can't be created
+  bool Open(const std::string &target, int width, int height);
+  // write the remaining frames, false if any of the frames couldn't be
+  // written
+  bool Close();
+
+  // =========
+  // MODIFIERS
+  // queue a frame of linear colors (stored by column, colors[x*height+y]
+  // with y = 0 the bottom row), waits if the writer is behind
+  void AddFrame(const std::vector<glm::vec3> &colors);
+
+private:
+
+  enum FRAME_FORMAT { FRAME_PPM_FILES, FRAME_Y4M, FRAME_RGB };
+
+  // don't copy, the thread & file belong to one object
+  FrameWriter(const FrameWriter&) { assert(0); }
+  FrameWriter& operator=(const FrameWriter&) { assert(0); return *this; }
+
+  // HELPER FUNCTIONS
+  void WriterThread();
+  bool WriteFrame(const std::vector<glm::vec3> &colors, int index);
+
+  // ==============
+  // REPRESENTATION
+  FRAME_FORMAT format;
+  std::string target;
+  int width;
+  int height;
+  // the stream (for .y4m, .rgb & commands)
+  FILE *file;
+  bool is_pipe;
+  // the frames waiting for the writer thread
+  std::thread thread;
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::deque<std::vector<glm::vec3> > queue;
+  bool closing;
+  bool failed;
+};
+
+// ====================================================================
+// ====================================================================
+
+#endif
@@ -10,6 +10,8 @@
 #include "photon_mapping.h"
 #include "raytracer.h"
 #include "raytree.h"
+#include "material.h"
+#include "render_image.h"
 
 #include "utils.h"
 
@@ -23,6 +25,8 @@ Mesh* GLCanvas::mesh = NULL;
 RayTracer* GLCanvas::raytracer = NULL;
 Radiosity* GLCanvas::radiosity = NULL;
 PhotonMapping* GLCanvas::photon_mapping = NULL;
+ImageRenderer* GLCanvas::renderer = NULL;
+Sampler GLCanvas::sampler;
 
 BoundingBox GLCanvas::bbox;
 GLFWwindow* GLCanvas::window = NULL;
@@ -123,41 +127,43 @@ void GLCanvas::initialize(ArgParser *_args) {
   Load();
   GLCanvas::initializeVBOs();
   GLCanvas::setupVBOs();
-  camera->glPlaceCamera(); 
+  placeCamera();
 
   HandleGLError("finished glcanvas initialize");
 }
 
 
 void GLCanvas::Load(){
-  mesh = new Mesh();
-  mesh->Load(args);
- 
-  raytracer = new RayTracer(mesh,args);
-  radiosity = new Radiosity(mesh,args);
-  photon_mapping = new PhotonMapping(mesh,args);
+  renderer = new ImageRenderer(args);
+  renderer->Load();
 
-  raytracer->setRadiosity(radiosity);
-  raytracer->setPhotonMapping(photon_mapping);
-  radiosity->setRayTracer(raytracer);
-  radiosity->setPhotonMapping(photon_mapping);
-  photon_mapping->setRayTracer(raytracer);
-  photon_mapping->setRadiosity(radiosity);
+  mesh = renderer->getMesh();
+  raytracer = renderer->getRayTracer();
+  radiosity = renderer->getRadiosity();
+  photon_mapping = renderer->getPhotonMapping();
+  // (a stream none of the image tiles use)
+  sampler = Sampler(args->seed, SAMPLER_PIXELS, -1);
 
   // ===========================
   // initial placement of camera 
-  assert (mesh->camera != NULL);
-  camera = mesh->camera;
+  camera = renderer->getCamera();
+}
+
+
+void GLCanvas::placeCamera(){
+  glfwGetWindowSize(window, &camera->width, &camera->height);
+  camera->glPlaceCamera();
 }
 
 
 void GLCanvas::animate(){
 
   if (args->radiosity_animation) {
-    double undistributed = radiosity->Iterate();
-    if (undistributed < 0.001) {
+    radiosity->Iterate();
+    if (radiosity->isConverged()) {
       args->radiosity_animation = false;
-      std::cout << "undistributed < 0.001, animation stopped\n"; fflush(stdout);
+      std::cout << "radiosity converged, animation stopped\n"; fflush(stdout);
+      radiosity->WriteCache();
     }
     radiosity->setupVBOs();
   }
@@ -170,16 +176,18 @@ void GLCanvas::animate(){
         break;
       }
     }
+    // the gathers of these pixels are used by the next ones
+    photon_mapping->CommitIrradianceCache();
     raytracer->setupVBOs();
   }
 
   if (args->render_to_file) {
-    renderImage("test.ppm"); 
+    renderer->renderImage(args->output_file);
     args->render_to_file = false;
   }
 
   if (args->render_sequence) {
-    renderSequence("output");
+    renderer->renderSequence(args->sequence_output);
     args->render_sequence = false;
   }
 
@@ -263,6 +271,9 @@ void GLCanvas::cleanupVBOs(){
   RayTree::cleanupVBOs();  
   bbox.cleanupVBOs();
   mesh->cleanupLightningVBOs();
+  for (unsigned int i = 0; i < mesh->materials.size(); i++) {
+    mesh->materials[i]->cleanupTexture();
+  }
 }
 
 
@@ -427,9 +438,7 @@ void GLCanvas::keyboardCB(GLFWwindow* window, int key, int scancode, int action,
       break;
     case 's': case 'S':
       // subdivide the mesh for radiosity
-      radiosity->Cleanup();
-      radiosity->getMesh()->Subdivision();
-      radiosity->Reset();
+      radiosity->Subdivision();
       radiosity->setupVBOs();
       break;
     case 'c': case 'C':
@@ -502,35 +511,10 @@ void GLCanvas::keyboardCB(GLFWwindow* window, int key, int scancode, int action,
 
 // trace a ray through pixel (i,j) of the image an return the color
 glm::vec3 GLCanvas::TraceRay(double i, double j) {
-
-  // compute and set the pixel color
-  int max_d = std::max(args->width,args->height);
-  glm::vec3 color(0.0f);
-  
-  // generate several random samples
-
-  for (int n=0; n < args->num_antialias_samples; n++) {
-    double new_i = i + (args->rand() - 0.5);
-    double new_j = j + (args->rand() - 0.5);
-
-    // construct & trace a ray through a random point on the pixel
-    double x = (new_i-args->width/2.0)/double(max_d)+0.5;
-    double y = (new_j-args->height/2.0)/double(max_d)+0.5;
-
-    Ray r = camera->generateRay(x,y); 
-    Hit hit;
-    color += raytracer->TraceRay(r,hit,args->num_bounces);
-    // add that ray for visualization
-    RayTree::AddMainSegment(r,0,hit.getT());
-  }
-
-  // return the average color
-  return color / (float) args->num_antialias_samples;
+  return renderer->TraceRay(i,j,sampler);
 }
 
 
-
-
 // for visualization: find the "corners" of a pixel on an image plane
 // 1/2 way between the camera & point of interest
 glm::vec3 GLCanvas::GetPos(double i, double j) {
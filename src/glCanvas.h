@@ -13,6 +13,7 @@
 #include <string>
 
 #include "boundingbox.h"
+#include "sampler.h"
 
 class ArgParser;
 class Mesh;
@@ -20,6 +21,7 @@ class RayTracer;
 class Radiosity;
 class PhotonMapping;
 class Camera;
+class ImageRenderer;
 
 // ====================================================================
 // NOTE:  All the methods and variables of this class are static
@@ -36,6 +38,10 @@ public:
   static RayTracer *raytracer;
   static Radiosity *radiosity;
   static PhotonMapping *photon_mapping;
+  // owns the scene & modules above, and writes images to file
+  static ImageRenderer *renderer;
+  // for the rays traced interactively (only from the main thread)
+  static Sampler sampler;
 
   static BoundingBox bbox;
   static Camera* camera;
@@ -81,10 +87,10 @@ public:
   static void setupVBOs();
   static void drawVBOs(const glm::mat4 &ProjectionMatrix,const glm::mat4 &ViewMatrix,const glm::mat4 &ModelMatrix);
   static void cleanupVBOs();
+  // the camera matrices are computed for the current size of the window
+  static void placeCamera();
 
   static void animate();
-  static void renderImage(const char* filename, bool status=true);
-  static void renderSequence(const char* dirname);
 
   static int DrawPixel();
   static glm::vec3 TraceRay(double i, double j);
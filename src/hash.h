@@ -15,6 +15,8 @@
 #error "unknown system"
 #endif
 
+#include <stdint.h>
+
 class Edge;
 class Triangle;
 #include "vertex.h"
@@ -97,4 +99,26 @@ typedef __gnu_cxx::hash_map<std::pair<Vertex*,Vertex*>,Edge*,orderedvertexpairha
 #endif
 
 
+// ===================================================================================
+// 64 bit FNV-1a, to fingerprint the scene & the settings a file saved
+// by an earlier run (the radiosity cache, the photon map) was made with
+// ===================================================================================
+
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+inline void fnv_hash_bytes(uint64_t &hash, const void *data, size_t n) {
+  const unsigned char *bytes = (const unsigned char*)data;
+  for (size_t i = 0; i < n; i++) {
+    hash ^= bytes[i];
+    hash *= FNV_PRIME;
+  }
+}
+
+template <class T>
+inline void fnv_hash_value(uint64_t &hash, const T &value) {
+  fnv_hash_bytes(hash, &value, sizeof(T));
+}
+
+
 #endif // _HASH_H_
@@ -0,0 +1,94 @@
+#ifndef _INDEXED_MAX_HEAP_H_
+#define _INDEXED_MAX_HEAP_H_
+
+#include <cassert>
+#include <vector>
+
+// ====================================================================
+// ====================================================================
+// A binary max heap of the items 0..n-1 with a float key per item,
+// which also knows where each item is in the heap, so the key of any
+// item can be changed in O(log n).  Equal keys are ordered by item
+// (the smallest first), like a linear scan for the maximum.
+
+class IndexedMaxHeap {
+
+public:
+
+  // ========================
+  // CONSTRUCTOR & RESET
+  IndexedMaxHeap() {}
+  // n items, all with key 0
+  void Reset(int n) {
+    heap.resize(n);
+    position.resize(n);
+    key.assign(n,0);
+    for (int i = 0; i < n; i++) {
+      heap[i] = i;
+      position[i] = i;
+    }
+  }
+
+  // =========
+  // ACCESSORS
+  int size() const { return heap.size(); }
+  // the item with the largest key
+  int top() const { assert (!heap.empty()); return heap[0]; }
+  float getKey(int item) const {
+    assert (item >= 0 && item < size());
+    return key[item]; }
+
+  // =========
+  // MODIFIERS
+  void Update(int item, float value) {
+    assert (item >= 0 && item < size());
+    float old = key[item];
+    key[item] = value;
+    if (value > old) SiftUp(position[item]);
+    else if (value < old) SiftDown(position[item]);
+  }
+
+private:
+
+  // HELPER FUNCTIONS
+  // should item a be above item b?
+  bool Above(int a, int b) const {
+    return key[a] > key[b] || (key[a] == key[b] && a < b); }
+  void Swap(int p, int q) {
+    int a = heap[p];
+    heap[p] = heap[q];
+    heap[q] = a;
+    position[heap[p]] = p;
+    position[heap[q]] = q;
+  }
+  void SiftUp(int p) {
+    while (p > 0 && Above(heap[p],heap[(p-1)/2])) {
+      Swap(p,(p-1)/2);
+      p = (p-1)/2;
+    }
+  }
+  void SiftDown(int p) {
+    int n = heap.size();
+    while (true) {
+      int largest = p;
+      int left = 2*p+1;
+      int right = 2*p+2;
+      if (left < n && Above(heap[left],heap[largest])) largest = left;
+      if (right < n && Above(heap[right],heap[largest])) largest = right;
+      if (largest == p) return;
+      Swap(p,largest);
+      p = largest;
+    }
+  }
+
+  // ==============
+  // REPRESENTATION
+  std::vector<int> heap;      // the items in heap order
+  std::vector<int> position;  // the position of each item in the heap
+  std::vector<float> key;     // the key of each item
+};
+
+// ====================================================================
+// ====================================================================
+
+#endif
@@ -0,0 +1,127 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+#include "irradiancecache.h"
+
+// ==================================================================
+// CONSTRUCTOR & MODIFIERS
+// ==================================================================
+
+IrradianceCache::IrradianceCache(const glm::vec3 &min, const glm::vec3 &max, float a) {
+  assert (a > 0);
+  accuracy = a;
+  // the root is the cube around the box
+  Node root;
+  root.center = 0.5f * (min + max);
+  glm::vec3 extent = max - min;
+  root.half_size = 0.5f * std::max(extent.x,std::max(extent.y,extent.z));
+  root.first_child = -1;
+  nodes.push_back(root);
+}
+
+
+void IrradianceCache::Insert(const IrradianceRecord &record) {
+  assert (record.radius > 0);
+  std::lock_guard<std::mutex> lock(pending_mutex);
+  pending.push_back(record);
+}
+
+
+// the records are added in a fixed order (not the order the threads
+// happened to insert them), so the tree is the same every run
+void IrradianceCache::Commit() {
+  std::sort(pending.begin(),pending.end(),
+            [](const IrradianceRecord &a, const IrradianceRecord &b) {
+              float key_a[10] = { a.position.x, a.position.y, a.position.z,
+                                  a.normal.x, a.normal.y, a.normal.z, a.radius,
+                                  a.irradiance.x, a.irradiance.y, a.irradiance.z };
+              float key_b[10] = { b.position.x, b.position.y, b.position.z,
+                                  b.normal.x, b.normal.y, b.normal.z, b.radius,
+                                  b.irradiance.x, b.irradiance.y, b.irradiance.z };
+              return std::lexicographical_compare(key_a,key_a+10,key_b,key_b+10); });
+  for (unsigned int i = 0; i < pending.size(); i++) {
+    records.push_back(pending[i]);
+    AddToTree(records.size()-1);
+  }
+  pending.clear();
+}
+
+
+// the record is stored in the smallest node that contains its position
+// & is at least as large as the radius it is used within
+void IrradianceCache::AddToTree(int r) {
+  const IrradianceRecord &record = records[r];
+  float valid_radius = accuracy * record.radius;
+  int n = 0;
+  for (int depth = 0; depth < IRRADIANCE_CACHE_MAX_DEPTH; depth++) {
+    // the children are half the size
+    if (nodes[n].half_size < valid_radius) break;
+    glm::vec3 d = record.position - nodes[n].center;
+    if (std::max(fabs(d.x),std::max(fabs(d.y),fabs(d.z))) > nodes[n].half_size) break;
+    if (nodes[n].first_child == -1) {
+      int first = nodes.size();
+      for (int c = 0; c < 8; c++) {
+        Node child;
+        child.half_size = 0.5f * nodes[n].half_size;
+        child.center = nodes[n].center + child.half_size *
+          glm::vec3((c & 1) ? 1 : -1, (c & 2) ? 1 : -1, (c & 4) ? 1 : -1);
+        child.first_child = -1;
+        nodes.push_back(child);
+      }
+      nodes[n].first_child = first;
+    }
+    n = nodes[n].first_child + (d.x > 0 ? 1 : 0) + (d.y > 0 ? 2 : 0) + (d.z > 0 ? 4 : 0);
+  }
+  nodes[n].records.push_back(r);
+}
+
+// ==================================================================
+// LOOKUP
+// ==================================================================
+
+bool IrradianceCache::Lookup(const glm::vec3 &point, const glm::vec3 &normal, glm::vec3 &irradiance) const {
+  glm::vec3 sum(0,0,0);
+  float weight_sum = 0;
+  // explicitly store the nodes that must be checked (rather than
+  // write a recursive function)
+  std::vector<int> todo;
+  todo.push_back(0);
+  while (!todo.empty()) {
+    const Node &node = nodes[todo.back()];
+    todo.pop_back();
+    // the records of the node are used no further than the node size
+    // from the node (the root may have records from outside of it)
+    glm::vec3 d = point - node.center;
+    if (&node != &nodes[0] &&
+        std::max(fabs(d.x),std::max(fabs(d.y),fabs(d.z))) > 3 * node.half_size) continue;
+    for (unsigned int k = 0; k < node.records.size(); k++) {
+      const IrradianceRecord &record = records[node.records[k]];
+      glm::vec3 offset = point - record.position;
+      // the record is in front of the point (e.g., on the far side
+      // of a corner)
+      if (glm::dot(offset,0.5f * (normal + record.normal)) < -0.05f * record.radius) continue;
+      float error = glm::length(offset) / record.radius +
+        sqrt(std::max(0.0f, 1.0f - glm::dot(normal,record.normal)));
+      if (error >= accuracy) continue;
+      float weight = 1.0f / std::max(error, 1e-6f);
+      glm::vec3 turn = normal - record.normal;
+      glm::vec3 estimate;
+      for (int c = 0; c < 3; c++) {
+        estimate[c] = record.irradiance[c] +
+          glm::dot(offset,record.translation_gradient[c]) +
+          glm::dot(turn,record.rotation_gradient[c]);
+      }
+      sum += weight * glm::max(estimate,glm::vec3(0,0,0));
+      weight_sum += weight;
+    }
+    if (node.first_child != -1) {
+      for (int c = 0; c < 8; c++) todo.push_back(node.first_child + c);
+    }
+  }
+  if (weight_sum == 0) return false;
+  irradiance = sum / weight_sum;
+  return true;
+}
+
+// ==================================================================
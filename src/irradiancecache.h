@@ -0,0 +1,101 @@
+#ifndef _IRRADIANCE_CACHE_H_
+#define _IRRADIANCE_CACHE_H_
+
+#include <mutex>
+#include <vector>
+#include <glm/glm.hpp>
+
+// records this many levels below the root of the octree are stored
+// at that level (however small their validity radius)
+#define IRRADIANCE_CACHE_MAX_DEPTH 16
+
+// ====================================================================
+// The indirect irradiance gathered at one point, with its change
+// along the surface (translation) & as the normal turns (rotation),
+// one gradient per color channel.
+
+struct IrradianceRecord {
+  glm::vec3 position;
+  glm::vec3 normal;
+  glm::vec3 irradiance;
+  // the distance over which the irradiance is (roughly) constant, the
+  // radius of the photons gathered
+  float radius;
+  glm::vec3 translation_gradient[3];
+  glm::vec3 rotation_gradient[3];
+};
+
+// ====================================================================
+// ====================================================================
+// An irradiance cache (Ward, Rubinstein & Clear 1988) for the photon
+// map gathers.  The indirect light changes slowly over diffuse
+// surfaces, so the irradiance at a point is interpolated from the
+// nearby records, weighted by
+//
+//   1 / (|x - x_i| / R_i + sqrt(1 - n . n_i))
+//
+// and extrapolated with their gradients (Ward & Heckbert 1992).  A
+// record is used while that error is below the -irradiance_cache
+// accuracy, otherwise a new gather is needed.
+//
+// The records are kept in an octree, each at the level (about) the
+// size of its validity radius.  Several threads can look up & insert
+// at once: lookups only see the records committed before, inserts
+// wait (behind a mutex) until the next Commit, which must be called
+// when no thread is using the cache (e.g., between passes over the
+// image).  The records used for a pixel then don't depend on the order
+// the threads run in.
+
+class IrradianceCache {
+
+public:
+
+  // ========================
+  // CONSTRUCTOR
+  // the records are found within the box (those outside are kept at
+  // the root), accuracy is the largest error of a record used
+  IrradianceCache(const glm::vec3 &min, const glm::vec3 &max, float accuracy);
+
+  // =========
+  // ACCESSORS
+  int numRecords() const { return records.size(); }
+  // the irradiance at the point, interpolated from the committed
+  // records, false if none of them is accurate enough here
+  bool Lookup(const glm::vec3 &point, const glm::vec3 &normal, glm::vec3 &irradiance) const;
+
+  // =========
+  // MODIFIERS
+  // add a record (may be called by several threads at once), it is
+  // used by the lookups after the next commit
+  void Insert(const IrradianceRecord &record);
+  // make the inserted records visible to the lookups (no lookups or
+  // inserts may run at the same time)
+  void Commit();
+
+private:
+
+  // a cube of the octree, the records of a node are within the node
+  // & their validity radius is no more than the size of the node
+  struct Node {
+    glm::vec3 center;
+    float half_size;
+    int first_child;        // the 8 children are consecutive, -1 for none
+    std::vector<int> records;
+  };
+
+  // HELPER FUNCTIONS
+  void AddToTree(int r);
+
+  // REPRESENTATION
+  float accuracy;
+  std::vector<IrradianceRecord> records;
+  std::vector<Node> nodes;
+  // the records inserted since the last commit
+  std::vector<IrradianceRecord> pending;
+  std::mutex pending_mutex;
+};
+
+// ====================================================================
+// ====================================================================
+
+#endif
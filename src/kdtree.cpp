@@ -1,159 +1,333 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+
 #include "kdtree.h"
 #include "utils.h"
 
-#define MAX_PHOTONS_BEFORE_SPLIT 100
-#define MAX_DEPTH 15
+#define MAX_PHOTONS_IN_LEAF 16
 
 // ==================================================================
-// DESTRUCTOR
+// BUILD
 // ==================================================================
-KDTree::~KDTree() {
-  if (!isLeaf()) {
-    delete child1;
-    delete child2;
-  } else {
-    // delete all the photons (this is done automatically since they
-    // are stored directly in an STL vector, not using pointers)
+
+void KDTree::Build(const std::vector<Photon> &photons) {
+  file.Close();
+  node_storage.clear();
+  position_x_storage.clear();
+  position_y_storage.clear();
+  position_z_storage.clear();
+  direction_from_storage.clear();
+  energy_storage.clear();
+  bounce_storage.clear();
+  normal_storage.clear();
+  SetArrays();
+  int num_photons = photons.size();
+  if (num_photons == 0) return;
+
+  // only the (compact) positions are reordered while building (the
+  // tree has about 2 * num_photons / MAX_PHOTONS_IN_LEAF nodes)
+  std::vector<BuildItem> build_items(num_photons);
+  for (int i = 0; i < num_photons; i++) {
+    build_items[i].position = photons[i].getPosition();
+    build_items[i].index = i;
+  }
+  node_storage.reserve(4 * (num_photons / MAX_PHOTONS_IN_LEAF + 1));
+  BuildRecursive(build_items,0,num_photons);
+
+  // copy the photons in leaf order
+  position_x_storage.resize(num_photons);
+  position_y_storage.resize(num_photons);
+  position_z_storage.resize(num_photons);
+  direction_from_storage.resize(num_photons);
+  energy_storage.resize(num_photons);
+  bounce_storage.resize(num_photons);
+  normal_storage.resize(num_photons);
+  for (int i = 0; i < num_photons; i++) {
+    const Photon &p = photons[build_items[i].index];
+    position_x_storage[i] = p.getPosition().x;
+    position_y_storage[i] = p.getPosition().y;
+    position_z_storage[i] = p.getPosition().z;
+    direction_from_storage[i] = p.getDirectionFrom();
+    energy_storage[i] = p.getEnergy();
+    bounce_storage[i] = p.whichBounce();
+    normal_storage[i] = p.getNormal();
   }
+  SetArrays();
 }
 
 
-// ==================================================================
-// HELPER FUNCTIONS
-
-bool KDTree::PhotonInCell(const Photon &p) {
-  const glm::vec3& min = bbox.getMin();
-  const glm::vec3& max = bbox.getMax();
-  const glm::vec3 &position = p.getPosition();
-  if (position.x > min.x - EPSILON &&
-      position.y > min.y - EPSILON &&
-      position.z > min.z - EPSILON &&
-      position.x < max.x + EPSILON &&
-      position.y < max.y + EPSILON &&
-      position.z < max.z + EPSILON)
-    return true;
-  return false;
+void KDTree::SetArrays() {
+  num_nodes = node_storage.size();
+  num_photons = position_x_storage.size();
+  nodes = node_storage.data();
+  position_x = position_x_storage.data();
+  position_y = position_y_storage.data();
+  position_z = position_z_storage.data();
+  direction_from = direction_from_storage.data();
+  energy = energy_storage.data();
+  bounce = bounce_storage.data();
+  normal = normal_storage.data();
 }
 
-bool KDTree::overlaps(const BoundingBox &bb) const {
-  const glm::vec3& bb_min = bb.getMin();
-  const glm::vec3& bb_max = bb.getMax();
-  const glm::vec3& tmp_min = bbox.getMin();
-  const glm::vec3& tmp_max = bbox.getMax();
-  if (bb_min.x > tmp_max.x) return false;
-  if (tmp_min.x > bb_max.x) return false;
-  if (bb_min.y > tmp_max.y) return false;
-  if (tmp_min.y > bb_max.y) return false;
-  if (bb_min.z > tmp_max.z) return false;
-  if (tmp_min.z > bb_max.z) return false;
-  return true;
+
+int KDTree::BuildRecursive(std::vector<BuildItem> &build_items, int begin, int end) {
+  assert (end > begin);
+  KDNode node;
+  node.min = node.max = build_items[begin].position;
+  for (int i = begin+1; i < end; i++) {
+    const glm::vec3 &p = build_items[i].position;
+    node.min = glm::vec3(std::min(node.min.x,p.x),std::min(node.min.y,p.y),std::min(node.min.z,p.z));
+    node.max = glm::vec3(std::max(node.max.x,p.x),std::max(node.max.y,p.y),std::max(node.max.z,p.z));
+  }
+  int index = node_storage.size();
+  glm::vec3 extent = node.max - node.min;
+  if (end - begin <= MAX_PHOTONS_IN_LEAF || (extent.x == 0 && extent.y == 0 && extent.z == 0)) {
+    node.offset = begin;
+    node.num_photons = end - begin;
+    node_storage.push_back(node);
+    return index;
+  }
+
+  // split at the median photon along the longest axis
+  int axis = 0;
+  if (extent.y > extent.x) axis = 1;
+  if (extent.z > extent[axis]) axis = 2;
+  int mid = begin + (end - begin) / 2;
+  std::nth_element(&build_items[0] + begin, &build_items[0] + mid, &build_items[0] + end,
+                   [&](const BuildItem &a, const BuildItem &b) { return a.position[axis] < b.position[axis]; });
+
+  // the first child directly follows its parent
+  node.offset = -1;
+  node.num_photons = 0;
+  node_storage.push_back(node);
+  BuildRecursive(build_items,begin,mid);
+  node_storage[index].offset = BuildRecursive(build_items,mid,end);
+  return index;
 }
 
 
 // ==================================================================
-void KDTree::AddPhoton(const Photon &p) {
-  const glm::vec3 &position = p.getPosition();
-  assert (PhotonInCell(p));
-  if (isLeaf()) {
-    // this cell is a leaf node
-    photons.push_back(p);
-    if (photons.size() > MAX_PHOTONS_BEFORE_SPLIT && depth < MAX_DEPTH) {
-      SplitCell();
-    }
-  } else {
-    // this cell is not a leaf node
-    // decide which subnode to recurse into
-    if (split_axis == 0) {
-      if (position.x < split_value)
-	child1->AddPhoton(p);
-      else
-	child2->AddPhoton(p);
-    } else if (split_axis == 1) {
-      if (position.y < split_value)
-	child1->AddPhoton(p);
-      else
-	child2->AddPhoton(p);
-    } else {
-      assert (split_axis == 2);
-      if (position.z < split_value)
-	child1->AddPhoton(p);
-      else
-	child2->AddPhoton(p);
-    }
+// FILE I/O
+// ==================================================================
+//
+// The file is (in the byte order of the machine that wrote it) the
+// header, then the node array & each photon array, every array
+// starting at a multiple of PHOTON_MAP_ALIGNMENT bytes (the mapping
+// starts on a page boundary, so the arrays are used in place).
+
+#define PHOTON_MAP_MAGIC "PHOTONS"
+#define PHOTON_MAP_VERSION 2
+#define PHOTON_MAP_ALIGNMENT 64
+#define PHOTON_MAP_NUM_ARRAYS 8
+
+struct PhotonMapHeader {
+  char magic[8];
+  int32_t version;
+  int32_t num_nodes;
+  int32_t num_photons;
+  int32_t padding;
+  uint64_t key;
+};
+
+
+// the offset & the size (in bytes) of each array in the file,
+// returns the size of the file
+static size_t PhotonMapLayout(int num_nodes, int num_photons,
+                              size_t offsets[PHOTON_MAP_NUM_ARRAYS],
+                              size_t sizes[PHOTON_MAP_NUM_ARRAYS]) {
+  sizes[0] = num_nodes * sizeof(KDNode);
+  sizes[1] = sizes[2] = sizes[3] = num_photons * sizeof(float);
+  sizes[4] = sizes[5] = num_photons * sizeof(glm::vec3);
+  sizes[6] = num_photons * sizeof(int);
+  sizes[7] = num_photons * sizeof(glm::vec3);
+  size_t offset = sizeof(PhotonMapHeader);
+  for (int a = 0; a < PHOTON_MAP_NUM_ARRAYS; a++) {
+    offset = (offset + PHOTON_MAP_ALIGNMENT - 1) / PHOTON_MAP_ALIGNMENT * PHOTON_MAP_ALIGNMENT;
+    offsets[a] = offset;
+    offset += sizes[a];
   }
+  return offset;
+}
+
+
+// written next to the file & then renamed, so other processes mapping
+// the old file never see half of the new one
+bool KDTree::Write(const std::string &filename, uint64_t key) const {
+  PhotonMapHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, PHOTON_MAP_MAGIC, 8);
+  header.version = PHOTON_MAP_VERSION;
+  header.num_nodes = num_nodes;
+  header.num_photons = num_photons;
+  header.key = key;
+  size_t offsets[PHOTON_MAP_NUM_ARRAYS], sizes[PHOTON_MAP_NUM_ARRAYS];
+  size_t total = PhotonMapLayout(num_nodes, num_photons, offsets, sizes);
+  const void *arrays[PHOTON_MAP_NUM_ARRAYS] = 
+    { nodes, position_x, position_y, position_z, direction_from, energy, bounce, normal };
+
+  std::string temporary = filename + ".tmp";
+  FILE *f = fopen(temporary.c_str(), "wb");
+  if (f == NULL) return false;
+  bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+  size_t written = sizeof(header);
+  char zeros[PHOTON_MAP_ALIGNMENT] = { 0 };
+  for (int a = 0; ok && a < PHOTON_MAP_NUM_ARRAYS; a++) {
+    size_t padding = offsets[a] - written;
+    ok = fwrite(zeros, 1, padding, f) == padding &&
+      (sizes[a] == 0 || fwrite(arrays[a], 1, sizes[a], f) == sizes[a]);
+    written = offsets[a] + sizes[a];
+  }
+  assert (!ok || written == total);
+  ok = (fclose(f) == 0) && ok;
+#if defined(_WIN32)
+  // rename won't replace an existing file
+  if (ok) remove(filename.c_str());
+#endif
+  if (!ok || rename(temporary.c_str(), filename.c_str()) != 0) {
+    remove(temporary.c_str());
+    return false;
+  }
+  return true;
+}
+
+
+bool KDTree::Read(const std::string &filename, uint64_t key) {
+  MappedFile mapped;
+  if (!mapped.Open(filename)) return false;
+  PhotonMapHeader header;
+  if (mapped.getSize() < sizeof(header)) return false;
+  memcpy(&header, mapped.getData(), sizeof(header));
+  if (memcmp(header.magic, PHOTON_MAP_MAGIC, 8) != 0 ||
+      header.version != PHOTON_MAP_VERSION || header.key != key ||
+      header.num_nodes < 0 || header.num_photons < 0) return false;
+  size_t offsets[PHOTON_MAP_NUM_ARRAYS], sizes[PHOTON_MAP_NUM_ARRAYS];
+  if (PhotonMapLayout(header.num_nodes, header.num_photons, offsets, sizes) != mapped.getSize()) return false;
+
+  // the storage of a tree built in memory is no longer needed
+  Build(std::vector<Photon>());
+  file.Swap(mapped);
+  const char *data = file.getData();
+  num_nodes = header.num_nodes;
+  num_photons = header.num_photons;
+  nodes = (const KDNode*)(data + offsets[0]);
+  position_x = (const float*)(data + offsets[1]);
+  position_y = (const float*)(data + offsets[2]);
+  position_z = (const float*)(data + offsets[3]);
+  direction_from = (const glm::vec3*)(data + offsets[4]);
+  energy = (const glm::vec3*)(data + offsets[5]);
+  bounce = (const int*)(data + offsets[6]);
+  normal = (const glm::vec3*)(data + offsets[7]);
+  return true;
 }
 
 
 // ==================================================================
+// QUERIES
+// ==================================================================
+
+inline bool BoxesOverlap(const glm::vec3 &min1, const glm::vec3 &max1,
+                         const glm::vec3 &min2, const glm::vec3 &max2) {
+  return !(min1.x > max2.x || min2.x > max1.x ||
+           min1.y > max2.y || min2.y > max1.y ||
+           min1.z > max2.z || min2.z > max1.z);
+}
+
+
 void KDTree::CollectPhotonsInBox(const BoundingBox &bb, std::vector<Photon> &photons) const {
+  if (num_nodes == 0) return;
+  const glm::vec3 &bb_min = bb.getMin();
+  const glm::vec3 &bb_max = bb.getMax();
   // explicitly store the queue of cells that must be checked (rather
   // than write a recursive function)
-  std::vector<const KDTree*> todo;  
-  todo.push_back(this);
+  std::vector<int> todo;
+  todo.push_back(0);
   while (!todo.empty()) {
-    const KDTree *node = todo.back();
-    todo.pop_back(); 
-    if (!node->overlaps(bb)) continue;
-    if (node->isLeaf()) {
-      // if this cell overlaps & is a leaf, add all of the photons into the master list
-      // NOTE: these photons may not be inside of the query bounding box
-      const std::vector<Photon> &photons2 = node->getPhotons();
-      int num_photons = photons2.size();
-      for (int i = 0; i < num_photons; i++) {
-	photons.push_back(photons2[i]);
+    const KDNode &node = nodes[todo.back()];
+    int current = todo.back();
+    todo.pop_back();
+    if (!BoxesOverlap(node.min,node.max,bb_min,bb_max)) continue;
+    if (node.isLeaf()) {
+      // only the photons actually inside of the query box
+      int end = node.offset + node.num_photons;
+      for (int i = node.offset; i < end; i++) {
+        if (position_x[i] >= bb_min.x && position_x[i] <= bb_max.x &&
+            position_y[i] >= bb_min.y && position_y[i] <= bb_max.y &&
+            position_z[i] >= bb_min.z && position_z[i] <= bb_max.z) {
+          photons.push_back(getPhoton(i));
+        }
       }
     } else {
       // if this cell is not a leaf, explore both children
-      todo.push_back(node->getChild1());
-      todo.push_back(node->getChild2());
-    } 
+      todo.push_back(current+1);
+      todo.push_back(node.offset);
+    }
   }
 }
 
 
-// ==================================================================
-void KDTree::SplitCell() {
-  const glm::vec3& min = bbox.getMin();
-  const glm::vec3& max = bbox.getMax();
-  float dx = max.x-min.x;
-  float dy = max.y-min.y;
-  float dz = max.z-min.z;
-  // split this cell in the middle of the longest axis
-  glm::vec3 min1,min2,max1,max2;
-  if (dx >= dy && dx >= dz) {
-    split_axis = 0;
-    split_value = min.x+dx/2.0;
-    min1 = glm::vec3(min.x    ,min.y,min.z);
-    max1 = glm::vec3(split_value,max.y,max.z);
-    min2 = glm::vec3(split_value,min.y,min.z);
-    max2 = glm::vec3(max.x       ,max.y,max.z);
-  } else if (dy >= dx && dy >= dz) {
-    split_axis = 1;
-    split_value = min.y+dy/2.0;
-    min1 = glm::vec3(min.x,min.y    ,min.z);
-    max1 = glm::vec3(max.x,split_value,max.z);
-    min2 = glm::vec3(min.x,split_value,min.z);
-    max2 = glm::vec3(max.x,max.y    ,max.z);
-  } else {
-    assert (dz >= dx && dz >= dy);
-    split_axis = 2;
-    split_value = min.z+dz/2.0;
-    min1 = glm::vec3(min.x,min.y,min.z    );
-    max1 = glm::vec3(max.x,max.y,split_value);
-    min2 = glm::vec3(min.x,min.y,split_value);
-    max2 = glm::vec3(max.x,max.y,max.z    );
+// the squared distance from the point to the box (0 inside)
+inline float DistanceSquaredToBox(const glm::vec3 &p, const glm::vec3 &min, const glm::vec3 &max) {
+  float answer = 0;
+  for (int i = 0; i < 3; i++) {
+    float d = std::max(std::max(min[i] - p[i], p[i] - max[i]), 0.0f);
+    answer += d*d;
   }
-  // create two new children
-  child1 = new KDTree(BoundingBox(min1,max1),depth+1);
-  child2 = new KDTree(BoundingBox(min2,max2),depth+1);
-  int num_photons = photons.size();
-  std::vector<Photon> tmp = photons;
-  photons.clear();
-  // add all the photons to one of those children
-  for (int i = 0; i < num_photons; i++) {
-    const Photon &p = tmp[i];
-    this->AddPhoton(p);
+  return answer;
+}
+
+
+void KDTree::FindNearestPhotons(const glm::vec3 &point, int k, std::vector<std::pair<float,int> > &nearest) const {
+  nearest.clear();
+  if (num_nodes == 0 || k <= 0) return;
+  // nearest is kept as a max heap (the furthest of the k on top)
+  nearest.reserve(std::min(k,numPhotons()));
+
+  // visit the nodes closest first (a min heap on the distance to the
+  // box), until the closest remaining node is further away than the
+  // k-th closest photon found so far
+  std::vector<std::pair<float,int> > todo;
+  todo.push_back(std::make_pair(0.0f,0));
+  std::greater<std::pair<float,int> > closer;
+  while (!todo.empty()) {
+    std::pop_heap(todo.begin(),todo.end(),closer);
+    float node_distance = todo.back().first;
+    const KDNode &node = nodes[todo.back().second];
+    int current = todo.back().second;
+    todo.pop_back();
+    if ((int)nearest.size() == k && node_distance > nearest.front().first) break;
+
+    if (node.isLeaf()) {
+      int end = node.offset + node.num_photons;
+      for (int i = node.offset; i < end; i++) {
+        float dx = position_x[i] - point.x;
+        float dy = position_y[i] - point.y;
+        float dz = position_z[i] - point.z;
+        std::pair<float,int> candidate(dx*dx + dy*dy + dz*dz, i);
+        if ((int)nearest.size() < k) {
+          nearest.push_back(candidate);
+          std::push_heap(nearest.begin(),nearest.end());
+        } else if (candidate < nearest.front()) {
+          std::pop_heap(nearest.begin(),nearest.end());
+          nearest.back() = candidate;
+          std::push_heap(nearest.begin(),nearest.end());
+        }
+      }
+    } else {
+      int children[2] = { current+1, node.offset };
+      for (int c = 0; c < 2; c++) {
+        const KDNode &child = nodes[children[c]];
+        float d = DistanceSquaredToBox(point,child.min,child.max);
+        if ((int)nearest.size() == k && d > nearest.front().first) continue;
+        todo.push_back(std::make_pair(d,children[c]));
+        std::push_heap(todo.begin(),todo.end(),closer);
+      }
+    }
   }
+
+  // closest first
+  std::sort_heap(nearest.begin(),nearest.end());
 }
 
 // ==================================================================
@@ -2,64 +2,129 @@
 #define _KDTREE_H_
 
 #include <cstdlib>
+#include <string>
 #include <vector>
+#include <stdint.h>
 #include "boundingbox.h"
 #include "photon.h"
+#include "mappedfile.h"
+
+// ==================================================================
+// A single node of the flattened tree (32 bytes).  The nodes are
+// stored depth first: the first child of an interior node immediately
+// follows its parent, so only the index of the second child is kept.
+// The box is the tight bounds of the photons below the node.
+
+struct KDNode {
+  glm::vec3 min;
+  int offset;       // leaf: first photon, interior: second child
+  glm::vec3 max;
+  int num_photons;  // leaf: the number of photons, interior: 0
+  bool isLeaf() const { return num_photons > 0; }
+};
 
 // ==================================================================
 // A hierarchical spatial data structure to store photons.  This data
 // struture allows for fast nearby neighbor queries for use in photon
 // mapping.
+//
+// The tree is built once from all of the traced photons, splitting
+// each node at the median photon along its longest axis, so the tree
+// is balanced no matter how clustered the photons are.  The nodes
+// and the photons are stored in contiguous arrays (no pointers), the
+// photons of each leaf are consecutive and stored as separate arrays
+// per attribute so a query only touches the positions it tests.
+//
+// The same arrays are the layout of the photon map file (see Write),
+// so a tree read from file is queried straight from the mapped pages:
+// nothing is parsed or copied, and only the pages a query touches
+// are ever read (the photon map may be larger than memory).
 
 class KDTree {
  public:
 
   // ========================
-  // CONSTRUCTOR & DESTRUCTOR
-  KDTree(const BoundingBox &_bbox, int _depth=0) {
-    bbox = _bbox;
-    depth = _depth;
-    child1=NULL;
-    child2=NULL;      
-  }
-  ~KDTree();
+  // CONSTRUCTOR & BUILD
+  KDTree() { SetArrays(); }
+  // replaces the current contents of the tree
+  void Build(const std::vector<Photon> &photons);
+
+  // =========
+  // FILE I/O
+  // the tree & the photons, with a key identifying the scene & the
+  // settings the photons were traced with.  False if it can't be written
+  bool Write(const std::string &filename, uint64_t key) const;
+  // replaces the current contents of the tree with the file (mapped,
+  // not read), false if there is no such file or it has another key
+  bool Read(const std::string &filename, uint64_t key);
 
   // =========
   // ACCESSORS
-  // boundingbox
-  const glm::vec3& getMin() const { return bbox.getMin(); }
-  const glm::vec3& getMax() const { return bbox.getMax(); }
-  bool overlaps(const BoundingBox &bb) const;
+  // boundingbox (of all the photons)
+  const glm::vec3& getMin() const { assert (num_nodes > 0); return nodes[0].min; }
+  const glm::vec3& getMax() const { assert (num_nodes > 0); return nodes[0].max; }
   // hierarchy
-  int getDepth() const { return depth; }
-  bool isLeaf() const { 
-    if (child1==NULL&&child2==NULL) return true;
-    assert (child1 != NULL && child2 != NULL);
-    return false; }
-  const KDTree* getChild1() const { assert (!isLeaf()); assert (child1 != NULL); return child1; }
-  const KDTree* getChild2() const { assert (!isLeaf()); assert (child2 != NULL); return child2; }
+  int numNodes() const { return num_nodes; }
+  const KDNode& getNode(int i) const {
+    assert (i >= 0 && i < num_nodes);
+    return nodes[i]; }
   // photons
-  const std::vector<Photon>& getPhotons() const { return photons; }
-  void CollectPhotonsInBox(const BoundingBox &bb, std::vector<Photon> &photons) const;
+  int numPhotons() const { return num_photons; }
+  Photon getPhoton(int i) const {
+    return Photon(getPhotonPosition(i),direction_from[i],energy[i],bounce[i],normal[i]); }
+  glm::vec3 getPhotonPosition(int i) const {
+    return glm::vec3(position_x[i],position_y[i],position_z[i]); }
+  const glm::vec3& getPhotonDirectionFrom(int i) const { return direction_from[i]; }
+  const glm::vec3& getPhotonEnergy(int i) const { return energy[i]; }
+  const glm::vec3& getPhotonNormal(int i) const { return normal[i]; }
 
-  // =========
-  // MODIFIERS
-  void AddPhoton(const Photon &p);
-  bool PhotonInCell(const Photon &p);
+  // =======
+  // QUERIES
+  // the photons inside of the box
+  void CollectPhotonsInBox(const BoundingBox &bb, std::vector<Photon> &photons) const;
+  // the k photons closest to the point as (squared distance, photon
+  // index) pairs, closest first (fewer if the tree has fewer photons).
+  // Ties are broken by index, so the nearest k are always the first
+  // k of the nearest 2k.
+  void FindNearestPhotons(const glm::vec3 &point, int k, std::vector<std::pair<float,int> > &nearest) const;
 
  private:
 
-  // HELPER FUNCTION
-  void SplitCell();
+  // the position & original index of a photon while building
+  struct BuildItem {
+    glm::vec3 position;
+    int index;
+  };
+
+  // HELPER FUNCTIONS
+  int BuildRecursive(std::vector<BuildItem> &build_items, int begin, int end);
+  // point the arrays at the storage of a tree built in memory
+  void SetArrays();
 
   // REPRESENTATION
-  BoundingBox bbox;
-  KDTree* child1;
-  KDTree* child2;
-  int split_axis;
-  float split_value;
-  std::vector<Photon> photons;
-  int depth;
+  int num_nodes;
+  int num_photons;
+  const KDNode *nodes;
+  // the photons, in leaf order
+  const float *position_x;
+  const float *position_y;
+  const float *position_z;
+  const glm::vec3 *direction_from;
+  const glm::vec3 *energy;
+  const int *bounce;
+  const glm::vec3 *normal;
+
+  // the arrays above are either this storage (a tree built in memory)
+  std::vector<KDNode> node_storage;
+  std::vector<float> position_x_storage;
+  std::vector<float> position_y_storage;
+  std::vector<float> position_z_storage;
+  std::vector<glm::vec3> direction_from_storage;
+  std::vector<glm::vec3> energy_storage;
+  std::vector<int> bounce_storage;
+  std::vector<glm::vec3> normal_storage;
+  // or the mapped pages of a photon map file
+  MappedFile file;
 };
 
 #endif
@@ -1,20 +1,10 @@
 #include "mesh.h"
 #include "utils.h"
 #include "primitive.h"
-#include <random>
 #include <glm/gtx/rotate_vector.hpp>
 
 
-float rand_float() {
-  // Return a random float between 0 and 1
-  std::random_device rd;
-  std::mt19937 e2(rd());
-  std::uniform_real_distribution<> dist(0, 1);
-  return dist(e2);
-}
-
-
-void Mesh::addLightning(glm::vec3 start_pos) {
+void Mesh::addLightning(glm::vec3 start_pos, Sampler &sampler) {
  
   // Center branch goes from starting position to closest primitive
   glm::vec3 closest = closestPrimitivePoint(start_pos);
@@ -27,59 +17,74 @@ void Mesh::addLightning(glm::vec3 start_pos) {
   float max_seg_angle = 30.0;
   float start_radius = 0.05;
   addBranch(start_pos, dir, dist, start_radius, branch_probability, 
-            mean_branch_length, max_seg_angle, true);
-  printf("Lightning Created: %lu segments added\n", lightning_segments.size());
+            mean_branch_length, max_seg_angle, sampler);
+  printf("Lightning Created: %d segments added\n", lightning_bolt.numSegments());
 }
 
 
+// The branches are made depth first, each branch interrupted where
+// it forks to make the fork (as a recursive function would), but the
+// branches in progress are kept on an explicit stack so very detailed
+// bolts don't overflow the call stack.
 void Mesh::addBranch(glm::vec3 start_pos, glm::vec3 dir, float dist,
                      float start_radius, float branch_probability, 
                      float mean_branch_length, float max_seg_angle,
-                     bool main_branch) {
+                     Sampler &sampler) {
 
   // More branch properties
-  float max_seg_angle_degrees = max_seg_angle;
   float mean_seg_length = 0.08;
   float max_branch_angle_degrees = 50.0;
   glm::vec3 rotation_normal(0,0,1);
 
-  // Variables to track branch construction
-  float angle, seglength, radius, branch_angle, branch_dist, radius_delta;
-  glm::vec3 last, next, branch;
-
-  // Initialize
-  next = start_pos;
-  last = start_pos;
-  radius = start_radius;
-  radius_delta = start_radius / (dist / mean_seg_length);
-  if (main_branch) max_seg_angle_degrees = 30.0;
+  // A branch being constructed
+  struct Branch {
+    glm::vec3 start_pos, dir, last;
+    float dist, radius, branch_probability, mean_branch_length, max_seg_angle;
+    int depth;
+    int parent;       // the segment the next one continues from
+  };
+  std::vector<Branch> todo;
+  Branch main_branch = { start_pos, dir, start_pos, dist, start_radius, branch_probability,
+                         mean_branch_length, max_seg_angle, 0, -1 };
+  todo.push_back(main_branch);
 
-  // Create segments
-  while (glm::distance(next, start_pos) < dist) {
+  // Variables to track branch construction
+  float angle, seglength, branch_angle, branch_dist;
+  glm::vec3 next, branch;
+
+  while (!todo.empty()) {
+    Branch &b = todo.back();
+    if (!(glm::distance(b.last, b.start_pos) < b.dist)) {
+      todo.pop_back();
+      continue;
+    }
+    float max_seg_angle_degrees = (b.depth == 0) ? 30.0 : b.max_seg_angle;
     // Random segment angle
-    angle = (0.5 - rand_float()) * 2.0 * max_seg_angle_degrees;
+    angle = (0.5 - sampler.rand()) * 2.0 * max_seg_angle_degrees;
     angle = angle * (M_PI / 180.0);
     // Random segment length
-    seglength = rand_float() * 2.0 * mean_seg_length;
+    seglength = sampler.rand() * 2.0 * mean_seg_length;
     // Get new point
-    next = glm::rotate(dir, angle, rotation_normal);
+    next = glm::rotate(b.dir, angle, rotation_normal);
     next = next * seglength;
-    next = next + last;
+    next = next + b.last;
     // Create segment and add to mesh
-    lightning_segments.push_back(LightningSegment(radius, last, next));
-    // Recursively add branches
-    if (rand_float() < branch_probability && branch_probability > 0.01) {
-      branch_angle = (0.5 - rand_float())  * max_branch_angle_degrees;
+    lightning_bolt.addSegment(b.last, next, b.radius, b.parent, b.depth);
+    b.parent = lightning_bolt.numSegments()-1;
+    glm::vec3 last = b.last;
+    b.last = next;
+    // Start a branch (finished before this one continues)
+    if (sampler.rand() < b.branch_probability && b.branch_probability > 0.01) {
+      branch_angle = (0.5 - sampler.rand())  * max_branch_angle_degrees;
       branch_angle = branch_angle * (M_PI / 180.0);
-      branch_dist = rand_float() * 2.0 * mean_branch_length;
+      branch_dist = sampler.rand() * 2.0 * b.mean_branch_length;
       branch = glm::rotate(next-last, branch_angle, rotation_normal);
       branch = glm::normalize(branch);
-      // Add branch recursively using branch multipliers
-      addBranch(next, branch, branch_dist, radius*0.5, branch_probability*0.8, 
-                mean_branch_length*0.5, max_seg_angle*1.3, false);
+      // Using branch multipliers (b is invalid after the push)
+      Branch child = { next, branch, next, branch_dist, float(b.radius*0.5), float(b.branch_probability*0.8),
+                       float(b.mean_branch_length*0.5), float(b.max_seg_angle*1.3), b.depth+1, b.parent };
+      todo.push_back(child);
     }
-    // Update for next iteration
-    last = next;
   }
 
 }
@@ -99,63 +104,3 @@ glm::vec3 Mesh::closestPrimitivePoint(glm::vec3 start) {
   return closestPoint;
 }
 
-
-// ====================================================
-// VBO Functions for rendering into scene for debugging
-
-void Mesh::initializeLightningVBOs() {
-  glGenBuffers(1,&lightning_tri_verts_VBO);
-  glGenBuffers(1,&lightning_tri_indices_VBO);
-}
-
-
-void Mesh::setupLightningVBOs() {
-  glm::vec4 lightning_color(1.0, 0.0, 0.0, 1.0);
-  for (LightningSegment segment : lightning_segments) {
-    for (std::vector<glm::vec3> triangle : segment.getTriangles()) {
-      glm::vec3 a = triangle[0];
-      glm::vec3 b = triangle[2];
-      glm::vec3 c = triangle[1];
-      glm::vec3 n = ComputeTriNormal(a,b,c);
-      int start = lightning_tri_verts.size();
-      lightning_tri_verts.push_back(VBOPosNormalColor(a,n,lightning_color));
-      lightning_tri_verts.push_back(VBOPosNormalColor(b,n,lightning_color));
-      lightning_tri_verts.push_back(VBOPosNormalColor(c,n,lightning_color));
-      lightning_tri_indices.push_back(VBOIndexedTri(start,start+1,start+2));
-    }
-  }
-  glBindBuffer(GL_ARRAY_BUFFER,lightning_tri_verts_VBO);
-  glBufferData(GL_ARRAY_BUFFER,
-               sizeof(VBOPosNormalColor) * lightning_tri_verts.size(),
-               &lightning_tri_verts[0],
-               GL_STATIC_DRAW);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,lightning_tri_indices_VBO);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-               sizeof(VBOIndexedTri) * lightning_tri_indices.size(),
-               &lightning_tri_indices[0],
-               GL_STATIC_DRAW);
-}
-
-
-void Mesh::drawLightningVBOs() {
-  HandleGLError("enter draw lightning");
-  glBindBuffer(GL_ARRAY_BUFFER,lightning_tri_verts_VBO);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,lightning_tri_indices_VBO);
-  glEnableVertexAttribArray(0);
-  glVertexAttribPointer(0,3,GL_FLOAT,GL_FALSE,sizeof(VBOPosNormalColor),(void*)0);
-  glEnableVertexAttribArray(1);
-  glVertexAttribPointer(1,3,GL_FLOAT,GL_FALSE,sizeof(VBOPosNormalColor),(void*)sizeof(glm::vec3) );
-  glEnableVertexAttribArray(2);
-  glVertexAttribPointer(2, 3, GL_FLOAT,GL_FALSE,sizeof(VBOPosNormalColor), (void*)(sizeof(glm::vec3)*2));
-  glDrawElements(GL_TRIANGLES, lightning_tri_indices.size()*3,GL_UNSIGNED_INT, 0);
-  glDisableVertexAttribArray(0);
-  glDisableVertexAttribArray(1);
-  glDisableVertexAttribArray(2);
-  HandleGLError("leaving draw lightning");
-}
-
-
-void Mesh::cleanupLightningVBOs() {
-  glDeleteBuffers(1,&lightning_tri_verts_VBO);
-  glDeleteBuffers(1,&lightning_tri_indices_VBO);
-}
@@ -0,0 +1,71 @@
+#include "glCanvas.h"
+
+#include "mesh.h"
+#include "utils.h"
+
+// ====================================================
+// VBO Functions for rendering into scene for debugging
+
+void Mesh::initializeLightningVBOs() {
+  glGenBuffers(1,&lightning_tri_verts_VBO);
+  glGenBuffers(1,&lightning_tri_indices_VBO);
+}
+
+
+void Mesh::setupLightningVBOs() {
+  glm::vec4 lightning_color(1.0, 0.0, 0.0, 1.0);
+  lightning_tri_verts.clear();
+  lightning_tri_indices.clear();
+  const int num_segments = lightning_bolt.numSegments();
+  lightning_tri_verts.reserve(6*num_segments);
+  lightning_tri_indices.reserve(2*num_segments);
+  glm::vec3 triangles[6];
+  for (int i = 0; i < num_segments; i++) {
+    lightning_bolt.getTriangles(i,triangles);
+    for (int t = 0; t < 2; t++) {
+      glm::vec3 a = triangles[3*t];
+      glm::vec3 b = triangles[3*t+2];
+      glm::vec3 c = triangles[3*t+1];
+      glm::vec3 n = ComputeTriNormal(a,b,c);
+      int start = lightning_tri_verts.size();
+      lightning_tri_verts.push_back(VBOPosNormalColor(a,n,lightning_color));
+      lightning_tri_verts.push_back(VBOPosNormalColor(b,n,lightning_color));
+      lightning_tri_verts.push_back(VBOPosNormalColor(c,n,lightning_color));
+      lightning_tri_indices.push_back(VBOIndexedTri(start,start+1,start+2));
+    }
+  }
+  glBindBuffer(GL_ARRAY_BUFFER,lightning_tri_verts_VBO);
+  glBufferData(GL_ARRAY_BUFFER,
+               sizeof(VBOPosNormalColor) * lightning_tri_verts.size(),
+               &lightning_tri_verts[0],
+               GL_STATIC_DRAW);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,lightning_tri_indices_VBO);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+               sizeof(VBOIndexedTri) * lightning_tri_indices.size(),
+               &lightning_tri_indices[0],
+               GL_STATIC_DRAW);
+}
+
+
+void Mesh::drawLightningVBOs() {
+  HandleGLError("enter draw lightning");
+  glBindBuffer(GL_ARRAY_BUFFER,lightning_tri_verts_VBO);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,lightning_tri_indices_VBO);
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(0,3,GL_FLOAT,GL_FALSE,sizeof(VBOPosNormalColor),(void*)0);
+  glEnableVertexAttribArray(1);
+  glVertexAttribPointer(1,3,GL_FLOAT,GL_FALSE,sizeof(VBOPosNormalColor),(void*)sizeof(glm::vec3) );
+  glEnableVertexAttribArray(2);
+  glVertexAttribPointer(2, 3, GL_FLOAT,GL_FALSE,sizeof(VBOPosNormalColor), (void*)(sizeof(glm::vec3)*2));
+  glDrawElements(GL_TRIANGLES, lightning_tri_indices.size()*3,GL_UNSIGNED_INT, 0);
+  glDisableVertexAttribArray(0);
+  glDisableVertexAttribArray(1);
+  glDisableVertexAttribArray(2);
+  HandleGLError("leaving draw lightning");
+}
+
+
+void Mesh::cleanupLightningVBOs() {
+  glDeleteBuffers(1,&lightning_tri_verts_VBO);
+  glDeleteBuffers(1,&lightning_tri_indices_VBO);
+}
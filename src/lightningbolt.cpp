@@ -0,0 +1,54 @@
+#include "lightningbolt.h"
+
+// ==================================================================
+// GEOMETRY
+// ==================================================================
+
+// To start, represent each segment with a quad
+void LightningBolt::getTriangles(int i, glm::vec3 triangles[6]) const {
+  const glm::vec3 &start = starts[i];
+  const glm::vec3 &end = ends[i];
+  float radius = radii[i];
+
+  glm::vec3 dir = glm::normalize(end-start);
+  glm::vec3 tmp = glm::cross(dir, glm::vec3(1,0,0));
+  if (glm::length(tmp) < 0.1)
+    tmp = glm::cross(dir, glm::vec3(0,0,1));
+  tmp = glm::normalize(tmp);
+  glm::vec3 one = glm::cross(dir, tmp);
+  glm::vec3 two = glm::cross(dir, one);
+
+  // 1st triangle
+  triangles[0] = start-one*radius+two*radius;
+  triangles[1] = end-one*radius+two*radius;
+  triangles[2] = end+one*radius+two*radius;
+
+  // 2nd triangle
+  triangles[3] = start-one*radius+two*radius;
+  triangles[4] = end+one*radius+two*radius;
+  triangles[5] = start+one*radius+two*radius;
+}
+
+// ==================================================================
+// MODIFIERS
+// ==================================================================
+
+void LightningBolt::addSegments(const LightningBolt &bolt, int first, int last) {
+  assert (first >= 0 && first <= last && last <= bolt.numSegments());
+  starts.insert(starts.end(), bolt.starts.begin()+first, bolt.starts.begin()+last);
+  ends.insert(ends.end(), bolt.ends.begin()+first, bolt.ends.begin()+last);
+  radii.insert(radii.end(), bolt.radii.begin()+first, bolt.radii.begin()+last);
+  parents.insert(parents.end(), bolt.parents.begin()+first, bolt.parents.begin()+last);
+  depths.insert(depths.end(), bolt.depths.begin()+first, bolt.depths.begin()+last);
+}
+
+
+void LightningBolt::clear() {
+  starts.clear();
+  ends.clear();
+  radii.clear();
+  parents.clear();
+  depths.clear();
+}
+
+// ==================================================================
@@ -0,0 +1,66 @@
+#ifndef _LIGHTNING_BOLT_H_
+#define _LIGHTNING_BOLT_H_
+
+#include <cassert>
+#include <vector>
+#include <glm/glm.hpp>
+
+// ====================================================================
+// ====================================================================
+// The segments of the lightning, stored as parallel arrays (one entry
+// per segment) rather than an object per segment, so a bolt of
+// millions of segments is a handful of allocations.  The geometry
+// drawn for a segment is made from its endpoints & radius when needed.
+
+class LightningBolt {
+
+public:
+
+  // =========
+  // ACCESSORS
+  int numSegments() const { return starts.size(); }
+  const glm::vec3& getStart(int i) const { return starts[i]; }
+  const glm::vec3& getEnd(int i) const { return ends[i]; }
+  float getRadius(int i) const { return radii[i]; }
+  // the segment this one continues from (the previous segment of the
+  // branch, or where the branch forks), -1 at the start of a bolt
+  int getParent(int i) const { return parents[i]; }
+  // 0 for the main channel, 1 for its branches, etc.
+  int getDepth(int i) const { return depths[i]; }
+  // the width of the glow around the channel
+  float getGlowWidth(int i) const {
+    float glowWidth = radii[i] * 3.0;
+    if (glowWidth < 0.08) glowWidth = 0.08;
+    return glowWidth; }
+  // the 2 triangles (a quad) drawn for the segment
+  void getTriangles(int i, glm::vec3 triangles[6]) const;
+
+  // =========
+  // MODIFIERS
+  void addSegment(const glm::vec3 &start, const glm::vec3 &end, float radius, int parent, int depth) {
+    assert (parent < numSegments());
+    starts.push_back(start);
+    ends.push_back(end);
+    radii.push_back(radius);
+    parents.push_back(parent);
+    depths.push_back(depth); }
+  // copy segments [first,last) of another bolt onto the end of this
+  // one (the parents are kept, so the earlier segments should be too)
+  void addSegments(const LightningBolt &bolt, int first, int last);
+  void clear();
+
+private:
+
+  // ==============
+  // REPRESENTATION
+  std::vector<glm::vec3> starts;
+  std::vector<glm::vec3> ends;
+  std::vector<float> radii;
+  std::vector<int> parents;
+  std::vector<int> depths;
+};
+
+// ====================================================================
+// ====================================================================
+
+#endif
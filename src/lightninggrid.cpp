@@ -0,0 +1,118 @@
+#include <cmath>
+#include <cassert>
+#include <algorithm>
+
+#include "lightninggrid.h"
+#include "ray.h"
+
+// limit the memory used by very sparse bolts
+#define LIGHTNING_GRID_MAX_DIVS 1024
+
+// ====================================================================
+// BUILD
+// ====================================================================
+
+void LightningGrid::Build(const LightningBolt &bolt) {
+  valid = false;
+  cell_start.clear();
+  cell_segments.clear();
+  if (bolt.numSegments() < 2) return;
+
+  // find the plane which the lightning lies in (from the first 2 segments)
+  glm::vec3 p0 = bolt.getStart(0);
+  glm::vec3 p1 = bolt.getEnd(0);
+  glm::vec3 p2 = bolt.getStart(1);
+  glm::vec3 p3 = bolt.getEnd(1);
+  glm::vec3 cross = glm::cross(p1 - p0, p3 - p2);
+  if (!(glm::length(cross) > 0)) return;
+  plane_point = p0;
+  normal = glm::normalize(cross);
+
+  // an orthonormal basis for the plane
+  glm::vec3 tmp = glm::cross(normal,glm::vec3(1,0,0));
+  if (glm::length(tmp) < 0.1) tmp = glm::cross(normal,glm::vec3(0,1,0));
+  u_axis = glm::normalize(tmp);
+  v_axis = glm::cross(normal,u_axis);
+
+  // the 2D bounds of each segment's glow capsule (projecting the
+  // segment onto the plane can only bring it closer to a point in the
+  // plane, so the projected capsule is conservative)
+  int num_segments = bolt.numSegments();
+  std::vector<glm::vec2> seg_min(num_segments), seg_max(num_segments);
+  float total_radius = 0;
+  for (int i = 0; i < num_segments; i++) {
+    glm::vec2 a = project(bolt.getStart(i));
+    glm::vec2 b = project(bolt.getEnd(i));
+    float r = LIGHTNING_GLOW_CUTOFF * bolt.getGlowWidth(i);
+    seg_min[i] = glm::vec2(std::min(a.x,b.x)-r,std::min(a.y,b.y)-r);
+    seg_max[i] = glm::vec2(std::max(a.x,b.x)+r,std::max(a.y,b.y)+r);
+    if (i == 0) {
+      min = seg_min[i];
+    } else {
+      min = glm::vec2(std::min(min.x,seg_min[i].x),std::min(min.y,seg_min[i].y));
+    }
+    total_radius += r;
+  }
+  glm::vec2 max = seg_max[0];
+  for (int i = 1; i < num_segments; i++) {
+    max = glm::vec2(std::max(max.x,seg_max[i].x),std::max(max.y,seg_max[i].y));
+  }
+
+  // cells about the size of a glow capsule
+  cell_size = total_radius / num_segments;
+  glm::vec2 extent = max - min;
+  cell_size = std::max(cell_size, std::max(extent.x,extent.y) / LIGHTNING_GRID_MAX_DIVS);
+  divs_u = std::max(1,int(std::ceil(extent.x / cell_size)));
+  divs_v = std::max(1,int(std::ceil(extent.y / cell_size)));
+
+  // count the segments overlapping each cell, then fill them in
+  // (compressed, so each cell is a contiguous range)
+  cell_start.assign(divs_u*divs_v+1,0);
+  for (int pass = 0; pass < 2; pass++) {
+    if (pass == 1) {
+      for (int c = 0; c < divs_u*divs_v; c++) cell_start[c+1] += cell_start[c];
+      cell_segments.resize(cell_start[divs_u*divs_v]);
+    }
+    std::vector<int> fill(cell_start.begin(),cell_start.end()-1);
+    for (int i = 0; i < num_segments; i++) {
+      int u0 = std::min(divs_u-1,int((seg_min[i].x - min.x) / cell_size));
+      int u1 = std::min(divs_u-1,int((seg_max[i].x - min.x) / cell_size));
+      int v0 = std::min(divs_v-1,int((seg_min[i].y - min.y) / cell_size));
+      int v1 = std::min(divs_v-1,int((seg_max[i].y - min.y) / cell_size));
+      for (int v = v0; v <= v1; v++) {
+        for (int u = u0; u <= u1; u++) {
+          int c = v*divs_u+u;
+          if (pass == 0) cell_start[c+1]++;
+          else cell_segments[fill[c]++] = i;
+        }
+      }
+    }
+  }
+  valid = true;
+}
+
+// ====================================================================
+// QUERIES
+// ====================================================================
+
+glm::vec3 LightningGrid::intersectPlane(const Ray &ray) const {
+  assert (valid);
+  float t = glm::dot(plane_point - ray.getOrigin(), normal) / glm::dot(ray.getDirection(), normal);
+  return ray.getOrigin() + t * ray.getDirection();
+}
+
+
+void LightningGrid::getSegments(const glm::vec3 &point, const int *&indices, int &num) const {
+  num = 0;
+  indices = NULL;
+  if (!valid) return;
+  glm::vec2 uv = (project(point) - min) / cell_size;
+  // (a ray parallel to the plane never reaches it)
+  if (!(uv.x >= 0 && uv.y >= 0 && uv.x < divs_u && uv.y < divs_v)) return;
+  int c = int(uv.y)*divs_u + int(uv.x);
+  indices = &cell_segments[0] + cell_start[c];
+  num = cell_start[c+1] - cell_start[c];
+}
+
+// ====================================================================
+// ====================================================================
@@ -0,0 +1,73 @@
+#ifndef _LIGHTNING_GRID_H_
+#define _LIGHTNING_GRID_H_
+
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "lightningbolt.h"
+
+class Ray;
+
+// the glow of a segment is ignored beyond this many glow widths
+// (exp(-25) is far below the precision of the output image)
+#define LIGHTNING_GLOW_CUTOFF 5.0f
+
+// ====================================================================
+// ====================================================================
+// A uniform 2D grid in the plane of the lightning bolt.  The glow (and
+// channel) of each segment are evaluated where the ray crosses this
+// plane, so each cell stores the segments whose glow capsule overlaps
+// the cell.  This way each ray only evaluates the handful of nearby
+// segments rather than the whole bolt.
+
+class LightningGrid {
+
+public:
+
+  // ========================
+  // CONSTRUCTOR & BUILD
+  LightningGrid() { valid = false; }
+  // the plane is found from the first 2 segments (as before), must be
+  // rebuilt whenever the segments change
+  void Build(const LightningBolt &bolt);
+
+  // =========
+  // ACCESSORS
+  // false if there are too few segments (or they are parallel)
+  bool isValid() const { return valid; }
+  const glm::vec3& getNormal() const { return normal; }
+  const glm::vec3& getPlanePoint() const { return plane_point; }
+  // where the ray (line) crosses the plane of the lightning
+  glm::vec3 intersectPlane(const Ray &ray) const;
+  // the indices of the segments that can contribute at this point of
+  // the plane (num == 0 if none)
+  void getSegments(const glm::vec3 &point, const int *&indices, int &num) const;
+
+private:
+
+  // HELPER FUNCTIONS
+  glm::vec2 project(const glm::vec3 &p) const {
+    glm::vec3 d = p - plane_point;
+    return glm::vec2(glm::dot(d,u_axis),glm::dot(d,v_axis)); }
+
+  // REPRESENTATION
+  bool valid;
+  glm::vec3 plane_point;
+  glm::vec3 normal;
+  glm::vec3 u_axis;
+  glm::vec3 v_axis;
+  // the grid covers [min,min+cell_size*divs] in (u,v)
+  glm::vec2 min;
+  float cell_size;
+  int divs_u;
+  int divs_v;
+  // the segment indices of cell c are cell_segments[cell_start[c]] to
+  // cell_segments[cell_start[c+1]-1]
+  std::vector<int> cell_start;
+  std::vector<int> cell_segments;
+};
+
+// ====================================================================
+// ====================================================================
+
+#endif
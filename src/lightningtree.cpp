@@ -0,0 +1,129 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+#include "lightningtree.h"
+#include "sampler.h"
+
+// ====================================================================
+// BUILD
+// ====================================================================
+
+void LightningTree::Build(const LightningBolt &bolt, int first, int last) {
+  assert (first >= 0 && first <= last && last <= bolt.numSegments());
+  nodes.clear();
+  int num_segments = last - first;
+  if (num_segments == 0) return;
+  std::vector<int> segments(num_segments);
+  for (int i = 0; i < num_segments; i++) segments[i] = first + i;
+  nodes.reserve(2*num_segments-1);
+  BuildRecursive(bolt,segments,0,num_segments);
+}
+
+
+// split the segments in half (by their centers) along the longest axis
+int LightningTree::BuildRecursive(const LightningBolt &bolt, std::vector<int> &segments, int begin, int end) {
+  assert (end - begin > 0);
+  LightningTreeNode node;
+  node.min = glm::min(bolt.getStart(segments[begin]),bolt.getEnd(segments[begin]));
+  node.max = glm::max(bolt.getStart(segments[begin]),bolt.getEnd(segments[begin]));
+  glm::vec3 cmin = 0.5f * (node.min + node.max);
+  glm::vec3 cmax = cmin;
+  for (int i = begin+1; i < end; i++) {
+    const glm::vec3 &a = bolt.getStart(segments[i]);
+    const glm::vec3 &b = bolt.getEnd(segments[i]);
+    node.min = glm::min(node.min,glm::min(a,b));
+    node.max = glm::max(node.max,glm::max(a,b));
+    cmin = glm::min(cmin,0.5f * (a + b));
+    cmax = glm::max(cmax,0.5f * (a + b));
+  }
+  // every segment of the bolt is equally bright (see RayTracer::TraceRay)
+  node.power = float(end - begin);
+  int index = nodes.size();
+  if (end - begin == 1) {
+    node.offset = segments[begin];
+    node.is_leaf = true;
+    nodes.push_back(node);
+    return index;
+  }
+
+  glm::vec3 extent = cmax - cmin;
+  int axis = 0;
+  if (extent.y > extent.x) axis = 1;
+  if (extent.z > extent[axis]) axis = 2;
+  int mid = begin + (end - begin)/2;
+  std::nth_element(segments.begin()+begin, segments.begin()+mid, segments.begin()+end,
+                   [&](int a, int b) {
+                     return bolt.getStart(a)[axis] + bolt.getEnd(a)[axis] <
+                       bolt.getStart(b)[axis] + bolt.getEnd(b)[axis]; });
+
+  // create the interior node, the first child directly follows it
+  node.offset = -1;
+  node.is_leaf = false;
+  nodes.push_back(node);
+  BuildRecursive(bolt,segments,begin,mid);
+  nodes[index].offset = BuildRecursive(bolt,segments,mid,end);
+  return index;
+}
+
+// ====================================================================
+// SAMPLING
+// ====================================================================
+
+float LightningTree::Importance(const LightningTreeNode &node, const glm::vec3 &point, const glm::vec3 &normal) const {
+  // the surface isn't lit from behind, so a box entirely behind it
+  // (all of its corners) contributes nothing
+  bool in_front = false;
+  for (int c = 0; c < 8 && !in_front; c++) {
+    glm::vec3 corner((c & 1) ? node.max.x : node.min.x,
+                     (c & 2) ? node.max.y : node.min.y,
+                     (c & 4) ? node.max.z : node.min.z);
+    if (glm::dot(corner - point,normal) > 0) in_front = true;
+  }
+  if (!in_front) return 0;
+  glm::vec3 center = 0.5f * (node.min + node.max);
+  glm::vec3 to_center = center - point;
+  float distance2 = glm::dot(to_center,to_center);
+  float radius2 = 0.25f * glm::dot(node.max - node.min,node.max - node.min);
+  // the largest cosine to the normal of a direction within the cone
+  // around the box (as seen from the point)
+  float cosine = 1;
+  if (distance2 > radius2) {
+    float distance = std::sqrt(distance2);
+    float angle = std::acos(glm::clamp(glm::dot(to_center,normal) / distance,-1.0f,1.0f));
+    float spread = std::asin(std::sqrt(radius2) / distance);
+    cosine = std::max(0.0f,std::cos(std::max(0.0f,angle - spread)));
+  }
+  return node.power * cosine / std::max(std::max(distance2,radius2),1e-8f);
+}
+
+
+bool LightningTree::Sample(const glm::vec3 &point, const glm::vec3 &normal, Sampler &sampler,
+                           int &segment, float &pdf) const {
+  if (nodes.empty()) return false;
+  if (Importance(nodes[0],point,normal) == 0) return false;
+  pdf = 1;
+  int n = 0;
+  while (!nodes[n].is_leaf) {
+    int left = n+1;
+    int right = nodes[n].offset;
+    float importance_left = Importance(nodes[left],point,normal);
+    float importance_right = Importance(nodes[right],point,normal);
+    float total = importance_left + importance_right;
+    // (both children can be behind, though the parent box isn't)
+    if (total == 0) return false;
+    float p = importance_left / total;
+    if (sampler.rand() < p) {
+      n = left;
+      pdf *= p;
+    } else {
+      n = right;
+      pdf *= 1 - p;
+    }
+  }
+  segment = nodes[n].offset;
+  return true;
+}
+
+// ====================================================================
+// ====================================================================
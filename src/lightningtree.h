@@ -0,0 +1,74 @@
+#ifndef _LIGHTNING_TREE_H_
+#define _LIGHTNING_TREE_H_
+
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "lightningbolt.h"
+
+class Sampler;
+
+// ====================================================================
+// A node of the tree (stored depth first, the first child directly
+// follows its parent).  The power is the total brightness of the
+// segments below the node.
+
+struct LightningTreeNode {
+  glm::vec3 min;
+  int offset;            // leaf: the segment, interior: the second child
+  glm::vec3 max;
+  float power;
+  bool is_leaf;
+};
+
+// ====================================================================
+// ====================================================================
+// A light tree (Conty Estevez & Kulla 2018) over the segments of the
+// lightning, to shade a point with a few segments chosen in proportion
+// to (an estimate of) their contribution rather than with all of them.
+// A segment is found by walking down from the root, at each node
+// picking a child with probability proportional to its importance
+//
+//   power * cos / max(distance to the center of its box^2, (half diagonal)^2)
+//
+// where cos bounds the cosine of the light from the box to the surface
+// normal (zero if the whole box is behind the surface, where the
+// segments can't light it).  Dividing the light of the segment by the
+// product of those probabilities gives an unbiased estimate of the
+// light from the whole bolt.
+
+class LightningTree {
+
+public:
+
+  // ========================
+  // CONSTRUCTOR & BUILD
+  LightningTree() {}
+  // must be rebuilt whenever the segments change
+  void Build(const LightningBolt &bolt) { Build(bolt,0,bolt.numSegments()); }
+  // a tree of just the segments [first,last) of the bolt
+  void Build(const LightningBolt &bolt, int first, int last);
+
+  // =========
+  // ACCESSORS
+  bool isValid() const { return !nodes.empty(); }
+  // choose a segment to light the point (with the given surface
+  // normal), returns false if the walk down the tree finds no segment
+  // that can light it (that sample is zero, not to be retried)
+  bool Sample(const glm::vec3 &point, const glm::vec3 &normal, Sampler &sampler,
+              int &segment, float &pdf) const;
+
+private:
+
+  // HELPER FUNCTIONS
+  int BuildRecursive(const LightningBolt &bolt, std::vector<int> &segments, int begin, int end);
+  float Importance(const LightningTreeNode &node, const glm::vec3 &point, const glm::vec3 &normal) const;
+
+  // REPRESENTATION
+  std::vector<LightningTreeNode> nodes;
+};
+
+// ====================================================================
+// ====================================================================
+
+#endif
@@ -37,7 +37,7 @@ int main(int argc, char *argv[]) {
     
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     glUseProgram(GLCanvas::programID);
-    GLCanvas::camera->glPlaceCamera();
+    GLCanvas::placeCamera();
 
     glm::mat4 ModelMatrix = glm::mat4(); 
   
@@ -0,0 +1,83 @@
+#include <cassert>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "mappedfile.h"
+
+// ==================================================================
+
+#if defined(_WIN32)
+
+bool MappedFile::Open(const std::string &filename) {
+  Close();
+  HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) return false;
+  LARGE_INTEGER file_size;
+  if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+    CloseHandle(file);
+    return false;
+  }
+  HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  // the mapping keeps the file open
+  CloseHandle(file);
+  if (mapping == NULL) return false;
+  void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  if (view == NULL) {
+    CloseHandle(mapping);
+    return false;
+  }
+  data = (const char*)view;
+  size = (size_t)file_size.QuadPart;
+  handle = mapping;
+  return true;
+}
+
+
+void MappedFile::Close() {
+  if (data == NULL) return;
+  UnmapViewOfFile(data);
+  CloseHandle((HANDLE)handle);
+  data = NULL;
+  size = 0;
+  handle = NULL;
+}
+
+#else
+
+bool MappedFile::Open(const std::string &filename) {
+  Close();
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd == -1) return false;
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size == 0) {
+    close(fd);
+    return false;
+  }
+  void *view = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // the mapping keeps the file open
+  close(fd);
+  if (view == MAP_FAILED) return false;
+  data = (const char*)view;
+  size = info.st_size;
+  return true;
+}
+
+
+void MappedFile::Close() {
+  if (data == NULL) return;
+  munmap((void*)data, size);
+  data = NULL;
+  size = 0;
+}
+
+#endif
+
+// ==================================================================
@@ -0,0 +1,54 @@
+#ifndef _MAPPED_FILE_H_
+#define _MAPPED_FILE_H_
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <string>
+
+// ====================================================================
+// ====================================================================
+// A file mapped (read only) into memory, the pages are read by the
+// operating system as they are first touched rather than all at once.
+
+class MappedFile {
+
+public:
+
+  // ========================
+  // CONSTRUCTOR & DESTRUCTOR
+  MappedFile() { data = NULL; size = 0; handle = NULL; }
+  ~MappedFile() { Close(); }
+  // false if the file doesn't exist (or can't be mapped)
+  bool Open(const std::string &filename);
+  void Close();
+  // exchange the mappings of the two objects
+  void Swap(MappedFile &other) {
+    std::swap(data,other.data);
+    std::swap(size,other.size);
+    std::swap(handle,other.handle); }
+
+  // =========
+  // ACCESSORS
+  bool isOpen() const { return data != NULL; }
+  const char* getData() const { return data; }
+  size_t getSize() const { return size; }
+
+private:
+
+  // don't copy, the mapping belongs to one object
+  MappedFile(const MappedFile&) { assert(0); }
+  MappedFile& operator=(const MappedFile&) { assert(0); return *this; }
+
+  // ==============
+  // REPRESENTATION
+  const char *data;
+  size_t size;
+  // the platform specific handle of the mapping (Windows only)
+  void *handle;
+};
+
+// ====================================================================
+// ====================================================================
+
+#endif
@@ -1,12 +1,14 @@
 #ifndef _MATERIAL_H_
 #define _MATERIAL_H_
 
-#include "glCanvas.h"
+#include <glm/glm.hpp>
 
 #include <cassert>
+#include <cstdlib>
 #include <string>
 
 #include "image.h"
+#include "vbo_structs.h"
 
 class ArgParser;
 class Ray;
@@ -46,7 +48,9 @@ public:
   const glm::vec3& getEmittedColor() const { return emittedColor; }  
   float getRoughness() const { return roughness; } 
   bool hasTextureMap() const { return (textureFile != ""); } 
+  // (the texture functions are only available in the OpenGL viewer)
   GLuint getTextureID();
+  void cleanupTexture();
 
   // SHADE
   // compute the contribution to local illumination at this point for
@@ -1,12 +1,12 @@
-#include "glCanvas.h"
-
 #include <iostream>
 #include <fstream>
 #include <assert.h>
 #include <string>
 #include <utility>
+#include <algorithm>
 
 #include "argparser.h"
+#include "sampler.h"
 #include "vertex.h"
 #include "boundingbox.h"
 #include "mesh.h"
@@ -18,6 +18,7 @@
 #include "ray.h"
 #include "hit.h"
 #include "camera.h"
+#include "bvh.h"
 
 
 // =======================================================================
@@ -31,12 +32,11 @@ Mesh::~Mesh() {
     removeFaceEdges(f);
     delete f;
   }
-  if (subdivided_quads.size() != original_quads.size()) {
-    for (i = 0; i < subdivided_quads.size(); i++) {
-      Face *f = subdivided_quads[i];
-      removeFaceEdges(f);
-      delete f;
-    }
+  for (i = 0; i < subdivided_quads.size(); i++) {
+    Face *f = subdivided_quads[i];
+    if (isOriginalQuad(f)) continue;
+    removeFaceEdges(f);
+    delete f;
   }
   for (i = 0; i < original_quads.size(); i++) {
     Face *f = original_quads[i];
@@ -47,6 +47,8 @@ Mesh::~Mesh() {
   for (i = 0; i < materials.size(); i++) { delete materials[i]; }
   for (i = 0; i < vertices.size(); i++) { delete vertices[i]; }
   delete bbox;
+  delete primitive_bvh;
+  delete rasterized_bvh;
 }
 
 // =======================================================================
@@ -271,7 +273,8 @@ void Mesh::Load(ArgParser *_args) {
       float x,y,z;
       objfile >> x >> y >> z;
       lightning_start = glm::vec3(x,y,z);
-      addLightning(glm::vec3(x,y,z));
+      Sampler sampler(args->seed,SAMPLER_LIGHTNING,lightning_bolt.numSegments());
+      addLightning(glm::vec3(x,y,z),sampler);
     } else {
       std::cout << "UNKNOWN TOKEN " << token << std::endl;
       exit(0);
@@ -288,6 +291,17 @@ void Mesh::Load(ArgParser *_args) {
     glm::vec3 up = glm::vec3(0,1,0);
     camera = new PerspectiveCamera(camera_position, point_of_interest, up, 20 * M_PI/180.0);    
   }
+  // the original quads & primitives don't change after loading (only
+  // the subdivided quads do), so the hierarchies are built once
+  std::vector<Face*> rasterized_faces = original_quads;
+  rasterized_faces.insert(rasterized_faces.end(),
+                          rasterized_primitive_faces.begin(),rasterized_primitive_faces.end());
+  primitive_bvh = new BVH();
+  primitive_bvh->Build(original_quads,primitives);
+  rasterized_bvh = new BVH();
+  rasterized_bvh->Build(rasterized_faces,std::vector<Primitive*>());
+  std::cout << " bvh built: " << primitive_bvh->numNodes() << " and "
+            << rasterized_bvh->numNodes() << " nodes." << std::endl;
 }
 
 // =================================================================
@@ -315,57 +329,75 @@ Vertex* Mesh::AddMidVertex(Vertex *a, Vertex *b, Vertex *c, Vertex *d) {
   return v;
 }
 
-void Mesh::Subdivision() {
+bool Mesh::isOriginalQuad(Face *f) const {
+  return std::find(original_quads.begin(),original_quads.end(),f) != original_quads.end();
+}
 
-  bool first_subdivision = false;
-  if (original_quads.size() == subdivided_quads.size()) {
-    first_subdivision = true;
+void Mesh::SplitQuad(Face *f) {
+    
+  Vertex *a = (*f)[0];
+  Vertex *b = (*f)[1];
+  Vertex *c = (*f)[2];
+  Vertex *d = (*f)[3];
+  // add new vertices on the edges
+  Vertex *ab = AddEdgeVertex(a,b);
+  Vertex *bc = AddEdgeVertex(b,c);
+  Vertex *cd = AddEdgeVertex(c,d);
+  Vertex *da = AddEdgeVertex(d,a);
+  // add new point in the middle of the patch
+  Vertex *mid = AddMidVertex(a,b,c,d);
+
+  assert (getEdge(a,b) != NULL);
+  assert (getEdge(b,c) != NULL);
+  assert (getEdge(c,d) != NULL);
+  assert (getEdge(d,a) != NULL);
+
+  // copy the color and emission from the old patch to the new (the
+  // original quads are kept for ray tracing)
+  Material *material = f->getMaterial();
+  if (!isOriginalQuad(f)) {
+    removeFaceEdges(f);
+    delete f;
   }
 
+  // create the new faces
+  addSubdividedQuad(a,ab,mid,da,material);
+  addSubdividedQuad(b,bc,mid,ab,material);
+  addSubdividedQuad(c,cd,mid,bc,material);
+  addSubdividedQuad(d,da,mid,cd,material);
+
+  assert (getEdge(a,ab) != NULL);
+  assert (getEdge(ab,b) != NULL);
+  assert (getEdge(b,bc) != NULL);
+  assert (getEdge(bc,c) != NULL);
+  assert (getEdge(c,cd) != NULL);
+  assert (getEdge(cd,d) != NULL);
+  assert (getEdge(d,da) != NULL);
+  assert (getEdge(da,a) != NULL);
+}
+
+void Mesh::Subdivision() {
+
   std::vector<Face*> tmp = subdivided_quads;
   subdivided_quads.clear();
   
   for (unsigned int i = 0; i < tmp.size(); i++) {
-    Face *f = tmp[i];
-    
-    Vertex *a = (*f)[0];
-    Vertex *b = (*f)[1];
-    Vertex *c = (*f)[2];
-    Vertex *d = (*f)[3];
-    // add new vertices on the edges
-    Vertex *ab = AddEdgeVertex(a,b);
-    Vertex *bc = AddEdgeVertex(b,c);
-    Vertex *cd = AddEdgeVertex(c,d);
-    Vertex *da = AddEdgeVertex(d,a);
-    // add new point in the middle of the patch
-    Vertex *mid = AddMidVertex(a,b,c,d);
-
-    assert (getEdge(a,b) != NULL);
-    assert (getEdge(b,c) != NULL);
-    assert (getEdge(c,d) != NULL);
-    assert (getEdge(d,a) != NULL);
-
-    // copy the color and emission from the old patch to the new
-    Material *material = f->getMaterial();
-    if (!first_subdivision) {
-      removeFaceEdges(f);
-      delete f;
-    }
+    SplitQuad(tmp[i]);
+  }
+}
 
-    // create the new faces
-    addSubdividedQuad(a,ab,mid,da,material);
-    addSubdividedQuad(b,bc,mid,ab,material);
-    addSubdividedQuad(c,cd,mid,bc,material);
-    addSubdividedQuad(d,da,mid,cd,material);
-
-    assert (getEdge(a,ab) != NULL);
-    assert (getEdge(ab,b) != NULL);
-    assert (getEdge(b,bc) != NULL);
-    assert (getEdge(bc,c) != NULL);
-    assert (getEdge(c,cd) != NULL);
-    assert (getEdge(cd,d) != NULL);
-    assert (getEdge(d,da) != NULL);
-    assert (getEdge(da,a) != NULL);
+void Mesh::SubdivideQuad(int i, Face *children[4]) {
+  assert (i >= 0 && i < numSubdividedQuads());
+  SplitQuad(subdivided_quads[i]);
+  // the first child takes the place of the quad
+  int n = subdivided_quads.size();
+  for (int c = 0; c < 4; c++) {
+    children[c] = subdivided_quads[n-4+c];
+  }
+  subdivided_quads[i] = children[0];
+  for (int c = 1; c < 4; c++) {
+    subdivided_quads[n-5+c] = children[c];
   }
+  subdivided_quads.pop_back();
 }
 
@@ -1,12 +1,14 @@
 #ifndef MESH_H
 #define MESH_H
 
-#include "glCanvas.h"
+#include <glm/glm.hpp>
 
+#include <cassert>
 #include <vector>
 #include "hash.h"
 #include "material.h"
-#include "lightningsegment.h"
+#include "lightningbolt.h"
+#include "vbo_structs.h"
 
 class Vertex;
 class Edge;
@@ -17,6 +19,8 @@ class ArgParser;
 class Ray;
 class Hit;
 class Camera;
+class BVH;
+class Sampler;
 
 enum FACE_TYPE { FACE_TYPE_ORIGINAL, FACE_TYPE_RASTERIZED, FACE_TYPE_SUBDIVIDED };
 
@@ -33,7 +37,7 @@ public:
 
   // ===============================
   // CONSTRUCTOR & DESTRUCTOR & LOAD
-  Mesh() { bbox = NULL; }
+  Mesh() { bbox = NULL; primitive_bvh = NULL; rasterized_bvh = NULL; }
   virtual ~Mesh();
   void Load(ArgParser *_args);
     
@@ -84,6 +88,7 @@ public:
   // ==============================================================
   // ACCESS THE SUBDIVIDED QUADS + RASTERIZED FACES (for radiosity)
   int numFaces() const { return subdivided_quads.size() + rasterized_primitive_faces.size(); }
+  int numSubdividedQuads() const { return subdivided_quads.size(); }
   Face* getFace(int i) const {
     int num_faces = numFaces();
     assert (i >= 0 && i < num_faces);
@@ -102,10 +107,19 @@ public:
   // ===============
   // OTHER ACCESSORS
   BoundingBox* getBoundingBox() const { return bbox; }
+  // the acceleration structure over the original quads and either the
+  // primitives or their rasterized patches
+  const BVH* getBVH(bool use_rasterized_patches) const {
+    return use_rasterized_patches ? rasterized_bvh : primitive_bvh; }
 
   // ===============
   // OTHER FUNCTIONS
+  // split every subdivided quad 4 ways
   void Subdivision();
+  // split only the i-th subdivided quad (the i-th face) 4 ways, the
+  // first child replaces it and the other 3 are added at the end of
+  // the subdivided quads (so the rasterized faces move by 3)
+  void SubdivideQuad(int i, Face *children[4]);
 
 private:
 
@@ -115,6 +129,8 @@ private:
   Vertex* AddMidVertex(Vertex *a, Vertex *b, Vertex *c, Vertex *d);
   void addFace(Vertex *a, Vertex *b, Vertex *c, Vertex *d, Material *material, enum FACE_TYPE face_type);
   void removeFaceEdges(Face *f);
+  bool isOriginalQuad(Face *f) const;
+  void SplitQuad(Face *f);
   void addPrimitive(Primitive *p); 
 
   // ==============
@@ -145,16 +161,20 @@ private:
   // the quads from the .obj file after subdivision
   std::vector<Face*> subdivided_quads;
 
+  // acceleration structures for ray casting (built after load)
+  BVH *primitive_bvh;
+  BVH *rasterized_bvh;
+
   // ========  
   // LIGHTNING
  public:
-  void addLightning(glm::vec3 start_pos);
+  void addLightning(glm::vec3 start_pos, Sampler &sampler);
   void addBranch(glm::vec3 start_pos, glm::vec3 dir, float dist,
                  float start_radius, float branch_probability, 
                  float mean_branch_length, float max_seg_angle,
-                 bool main_branch);
+                 Sampler &sampler);
   glm::vec3 closestPrimitivePoint(glm::vec3 start);
-  std::vector<LightningSegment> lightning_segments;
+  LightningBolt lightning_bolt;
   glm::vec3 lightning_start;
   void initializeLightningVBOs();
   void setupLightningVBOs();
@@ -0,0 +1,88 @@
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "parallel.h"
+
+// ====================================================================
+// the queue of remaining tasks of one thread, the owner works from
+// the front and thieves take from the back
+
+class TaskQueue {
+public:
+  bool popFront(int &task) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (tasks.empty()) return false;
+    task = tasks.front();
+    tasks.pop_front();
+    return true;
+  }
+  bool popBack(int &task) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (tasks.empty()) return false;
+    task = tasks.back();
+    tasks.pop_back();
+    return true;
+  }
+  std::deque<int> tasks;
+private:
+  std::mutex mutex;
+};
+
+
+static void WorkerThread(int id, std::vector<TaskQueue> &queues,
+                         const std::function<void(int)> &task) {
+  int num_threads = queues.size();
+  int t;
+  while (true) {
+    if (queues[id].popFront(t)) {
+      task(t);
+      continue;
+    }
+    // out of work, try to steal from the other threads (starting with
+    // the neighbor so the thieves spread out)
+    bool stolen = false;
+    for (int i = 1; i < num_threads && !stolen; i++) {
+      stolen = queues[(id+i)%num_threads].popBack(t);
+    }
+    if (!stolen) break;
+    task(t);
+  }
+}
+
+
+void ParallelFor(int num_tasks, int num_threads, const std::function<void(int)> &task) {
+  if (num_threads > num_tasks) num_threads = num_tasks;
+  if (num_threads <= 1) {
+    for (int t = 0; t < num_tasks; t++) task(t);
+    return;
+  }
+
+  // deal out contiguous blocks of tasks
+  std::vector<TaskQueue> queues(num_threads);
+  for (int i = 0; i < num_threads; i++) {
+    int begin = (long)num_tasks * i / num_threads;
+    int end = (long)num_tasks * (i+1) / num_threads;
+    for (int t = begin; t < end; t++) queues[i].tasks.push_back(t);
+  }
+
+  std::vector<std::thread> threads;
+  for (int i = 1; i < num_threads; i++) {
+    threads.push_back(std::thread(WorkerThread,i,std::ref(queues),std::cref(task)));
+  }
+  WorkerThread(0,queues,task);
+  for (unsigned int i = 0; i < threads.size(); i++) {
+    threads[i].join();
+  }
+}
+
+
+int DefaultNumThreads() {
+  int n = std::thread::hardware_concurrency();
+  if (n < 1) n = 1;
+  return n;
+}
+
+// ====================================================================
+// ====================================================================
@@ -0,0 +1,24 @@
+#ifndef _PARALLEL_H_
+#define _PARALLEL_H_
+
+#include <functional>
+
+// ====================================================================
+// ====================================================================
+// Runs task(0) ... task(num_tasks-1) on num_threads threads (the
+// calling thread is one of them) and returns once all are finished.
+//
+// The tasks are initially divided into contiguous blocks, one block
+// per thread.  A thread that runs out of work steals from the far end
+// of another thread's block, so a few expensive tasks (e.g., image
+// tiles full of reflections) don't leave the other cores idle.
+
+void ParallelFor(int num_tasks, int num_threads, const std::function<void(int)> &task);
+
+// the number of threads to use when none is specified (all cores)
+int DefaultNumThreads();
+
+// ====================================================================
+// ====================================================================
+
+#endif
@@ -11,14 +11,16 @@ class Photon {
  public:
 
   // CONSTRUCTOR
-  Photon(const glm::vec3 &p, const glm::vec3 &d, const glm::vec3 &e, int b) :
-    position(p),direction_from(d),energy(e),bounce(b) {}
+  Photon(const glm::vec3 &p, const glm::vec3 &d, const glm::vec3 &e, int b, const glm::vec3 &n) :
+    position(p),direction_from(d),energy(e),bounce(b),normal(n) {}
 
   // ACCESSORS
   const glm::vec3& getPosition() const { return position; }
   const glm::vec3& getDirectionFrom() const { return direction_from; }
   const glm::vec3& getEnergy() const { return energy; }
   int whichBounce() const { return bounce; }
+  // the normal of the surface the photon hit
+  const glm::vec3& getNormal() const { return normal; }
 
  private:
   // REPRESENTATION
@@ -26,6 +28,7 @@ class Photon {
   glm::vec3 direction_from;
   glm::vec3 energy;
   int bounce;
+  glm::vec3 normal;
 };
 
 #endif
@@ -1,5 +1,3 @@
-#include "glCanvas.h"
-
 #include <iostream>
 #include <algorithm>
 #include <set>
@@ -12,6 +10,24 @@
 #include "kdtree.h"
 #include "utils.h"
 #include "raytracer.h"
+#include "parallel.h"
+#include "irradiancecache.h"
+#include "boundingbox.h"
+
+// the number of photons shot by one task
+#define PHOTON_CHUNK_SIZE 1024
+
+// with -precompute_irradiance, every this many photons stores the
+// irradiance estimated at its position
+#define PHOTON_IRRADIANCE_STRIDE 4
+// the photons of an irradiance estimate (& the irradiance photon used
+// at a point) must have a normal at most this far from the normal there
+#define PHOTON_NORMAL_COSINE 0.9f
+// the nearest irradiance photons checked for one with a similar normal
+#define PHOTON_IRRADIANCE_CANDIDATES 8
+// an irradiance estimate looks this many times further than the
+// photons to collect for photons with a similar normal
+#define PHOTON_IRRADIANCE_SEARCH 8
 
 
 // ==========
@@ -19,6 +35,8 @@
 PhotonMapping::~PhotonMapping() {
   // cleanup all the photons
   delete kdtree;
+  delete irradiance_kdtree;
+  delete irradiance_cache;
 }
 
 
@@ -26,7 +44,7 @@ PhotonMapping::~PhotonMapping() {
 // Recursively trace a single photon
 
 void PhotonMapping::TracePhoton(const glm::vec3 &position, const glm::vec3 &direction, 
-				const glm::vec3 &energy, int iter) {
+				const glm::vec3 &energy, int iter, Sampler &sampler, std::vector<Photon> &photons) {
 
   // find the first hit location
   Ray r(position, direction);
@@ -45,7 +63,7 @@ void PhotonMapping::TracePhoton(const glm::vec3 &position, const glm::vec3 &dire
   glm::vec3 new_energy, new_dir;
 
   // store the photon here
-  kdtree->AddPhoton(Photon(hitLoc, direction, energy, iter));
+  photons.push_back(Photon(hitLoc, direction, energy, iter, h.getNormal()));
 
   /*
   // ====================
@@ -59,11 +77,11 @@ void PhotonMapping::TracePhoton(const glm::vec3 &position, const glm::vec3 &dire
   else {
     // diffuse reflection
     new_energy = energy * dif;
-    new_dir = RandomDiffuseDirection(h.getNormal());
+    new_dir = RandomDiffuseDirection(h.getNormal(), sampler);
   }
 
   if (iter < args->num_bounces) {
-    TracePhoton(hitLoc, new_dir, new_energy, iter+1);
+    TracePhoton(hitLoc, new_dir, new_energy, iter+1, sampler, photons);
   }
   */
 
@@ -78,14 +96,14 @@ void PhotonMapping::TracePhoton(const glm::vec3 &position, const glm::vec3 &dire
                     (dif.x + dif.y + dif.z + spec.x + spec.y + spec.z);
 
   // russian roulette based on diffuse/reflective
-  float choice = args->rand();
+  float choice = sampler.rand();
 
   // if some kind of reflection happens
   if (choice <= prob_reflection) {
 
     if (choice <= prob_dif) {
       // diffusely reflect random direction
-      new_dir = RandomDiffuseDirection(h.getNormal());
+      new_dir = RandomDiffuseDirection(h.getNormal(), sampler);
       new_energy = energy * mat->getDiffuseColor() / prob_dif;
     }
     else {
@@ -96,7 +114,7 @@ void PhotonMapping::TracePhoton(const glm::vec3 &position, const glm::vec3 &dire
 
     if (iter < args->num_bounces) {
       // actually trace the reflected photon
-      TracePhoton(hitLoc, new_dir, new_energy, iter+1);
+      TracePhoton(hitLoc, new_dir, new_energy, iter+1, sampler, photons);
     }
   }
   // otherwise absorb, do nothing
@@ -109,17 +127,37 @@ void PhotonMapping::TracePhoton(const glm::vec3 &position, const glm::vec3 &dire
 void PhotonMapping::TracePhotons() {
   std::cout << "trace photons" << std::endl;
 
-  // first, throw away any existing photons
+  // first, throw away any existing photons (& the gathers made from them)
   delete kdtree;
+  kdtree = NULL;
+  delete irradiance_kdtree;
+  irradiance_kdtree = NULL;
+  delete irradiance_cache;
+  irradiance_cache = NULL;
+  if (args->irradiance_cache > 0) {
+    irradiance_cache = new IrradianceCache(mesh->getBoundingBox()->getMin(),
+                                           mesh->getBoundingBox()->getMax(),
+                                           args->irradiance_cache);
+  }
 
-  // consruct a kdtree to store the photons
-  BoundingBox *bb = mesh->getBoundingBox();
-  glm::vec3 min = bb->getMin();
-  glm::vec3 max = bb->getMax();
-  glm::vec3 diff = max-min;
-  min -= 0.001f*diff;
-  max += 0.001f*diff;
-  kdtree = new KDTree(BoundingBox(min,max));
+  // the photons saved by an earlier run (of the same scene & settings)
+  if (args->photon_map != "") {
+    kdtree = new KDTree();
+    if (kdtree->Read(args->photon_map, getPhotonMapKey())) {
+      std::cout << " " << kdtree->numPhotons() << " photons mapped from " 
+                << args->photon_map << std::endl;
+      PrecomputeIrradiance();
+      return;
+    }
+    delete kdtree;
+    kdtree = NULL;
+    FILE *existing = fopen(args->photon_map.c_str(), "rb");
+    if (existing != NULL) {
+      fclose(existing);
+      std::cout << " photon map " << args->photon_map
+                << " is for a different scene or settings" << std::endl;
+    }
+  }
 
   // photons emanate from the light sources
   const std::vector<Face*>& lights = mesh->getLights();
@@ -132,19 +170,141 @@ void PhotonMapping::TracePhotons() {
 
   // shoot a constant number of photons per unit area of light source
   // (alternatively, this could be based on the total energy of each light)
+  // the photons of light i are numbered light_start[i] to light_start[i+1]-1
+  std::vector<int> light_start(lights.size()+1,0);
+  std::vector<glm::vec3> light_energy(lights.size());
+  std::vector<glm::vec3> light_normal(lights.size());
   for (unsigned int i = 0; i < lights.size(); i++) {  
     float my_area = lights[i]->getArea();
     int num = args->num_photons_to_shoot * my_area / total_lights_area;
+    light_start[i+1] = light_start[i] + num;
     // the initial energy for this photon
-    glm::vec3 energy = my_area/float(num) * lights[i]->getMaterial()->getEmittedColor();
-    glm::vec3 normal = lights[i]->computeNormal();
-    for (int j = 0; j < num; j++) {
-      glm::vec3 start = lights[i]->RandomPoint();
-      // the initial direction for this photon (for diffuse light sources)
-      glm::vec3 direction = RandomDiffuseDirection(normal);
-      TracePhoton(start,direction,energy,0);
+    light_energy[i] = my_area/float(num) * lights[i]->getMaterial()->getEmittedColor();
+    light_normal[i] = lights[i]->computeNormal();
+  }
+
+  // the photons are shot in chunks, each chunk is traced by one
+  // thread into its own buffer and with its own random stream (so
+  // the photons only depend on the seed)
+  int num_photons = light_start.back();
+  int num_chunks = (num_photons + PHOTON_CHUNK_SIZE - 1) / PHOTON_CHUNK_SIZE;
+  std::vector<std::vector<Photon> > chunk_photons(num_chunks);
+  ParallelFor(num_chunks, args->num_threads, [&](int chunk) {
+      Sampler sampler(args->seed, SAMPLER_PHOTONS, chunk);
+      int begin = chunk * PHOTON_CHUNK_SIZE;
+      int end = std::min(begin + PHOTON_CHUNK_SIZE, num_photons);
+      int i = std::upper_bound(light_start.begin(), light_start.end(), begin) - light_start.begin() - 1;
+      for (int j = begin; j < end; j++) {
+        while (j >= light_start[i+1]) i++;
+        glm::vec3 start = lights[i]->RandomPoint(sampler);
+        // the initial direction for this photon (for diffuse light sources)
+        glm::vec3 direction = RandomDiffuseDirection(light_normal[i], sampler);
+        TracePhoton(start,direction,light_energy[i],0,sampler,chunk_photons[chunk]);
+      }
+    });
+
+  // merge the buffers (in chunk order)
+  std::vector<Photon> photons;
+  unsigned int total = 0;
+  for (int c = 0; c < num_chunks; c++) total += chunk_photons[c].size();
+  photons.reserve(total);
+  for (int c = 0; c < num_chunks; c++) {
+    photons.insert(photons.end(), chunk_photons[c].begin(), chunk_photons[c].end());
+    std::vector<Photon>().swap(chunk_photons[c]);
+  }
+
+  // consruct a kdtree to store all of the photons
+  kdtree = new KDTree();
+  kdtree->Build(photons);
+
+  if (args->photon_map != "") {
+    if (kdtree->Write(args->photon_map, getPhotonMapKey())) {
+      std::cout << " " << kdtree->numPhotons() << " photons saved to " 
+                << args->photon_map << std::endl;
+    } else {
+      std::cerr << "ERROR: can't write the photon map " << args->photon_map << std::endl;
+    }
+  }
+  PrecomputeIrradiance();
+}
+
+
+// the irradiance at every few photons (Christensen 1999) from the
+// nearby photons on similar surfaces, so a gather is a single lookup
+// of the closest of these (without any occlusion rays)
+void PhotonMapping::PrecomputeIrradiance() {
+  if (!args->precompute_irradiance || kdtree->numPhotons() == 0) return;
+  int num = (kdtree->numPhotons() + PHOTON_IRRADIANCE_STRIDE - 1) / PHOTON_IRRADIANCE_STRIDE;
+  std::vector<Photon> photons(num, kdtree->getPhoton(0));
+  int num_chunks = (num + PHOTON_CHUNK_SIZE - 1) / PHOTON_CHUNK_SIZE;
+  ParallelFor(num_chunks, args->num_threads, [&](int chunk) {
+      int end = std::min((chunk+1) * PHOTON_CHUNK_SIZE, num);
+      for (int i = chunk * PHOTON_CHUNK_SIZE; i < end; i++) {
+        int p = i * PHOTON_IRRADIANCE_STRIDE;
+        photons[i] = Photon(kdtree->getPhotonPosition(p), kdtree->getPhotonDirectionFrom(p),
+                            EstimateIrradiance(p), 0, kdtree->getPhotonNormal(p));
+      }
+    });
+  irradiance_kdtree = new KDTree();
+  irradiance_kdtree->Build(photons);
+  std::cout << " irradiance precomputed at " << num << " photons" << std::endl;
+}
+
+
+// like GatherIndirect, but only from the photons on surfaces facing
+// (about) the same way & without checking their visibility
+glm::vec3 PhotonMapping::EstimateIrradiance(int photon) const {
+  glm::vec3 point = kdtree->getPhotonPosition(photon);
+  const glm::vec3 &normal = kdtree->getPhotonNormal(photon);
+  int num_to_collect = std::min(args->num_photons_to_collect, kdtree->numPhotons());
+  std::vector<std::pair<float,int> > nearest;
+  std::vector<int> collected;
+  float radius2 = 0;
+  kdtree->FindNearestPhotons(point, num_to_collect * PHOTON_IRRADIANCE_SEARCH, nearest);
+  for (unsigned int i = 0; i < nearest.size(); i++) {
+    if (glm::dot(kdtree->getPhotonNormal(nearest[i].second), normal) < PHOTON_NORMAL_COSINE) continue;
+    collected.push_back(nearest[i].second);
+    radius2 = nearest[i].first;
+    if ((int)collected.size() >= num_to_collect) break;
+  }
+  if (radius2 == 0) return glm::vec3(0,0,0);
+  glm::vec3 result(0,0,0);
+  for (unsigned int i = 0; i < collected.size(); i++) {
+    float weight = glm::dot(-kdtree->getPhotonDirectionFrom(collected[i]), normal);
+    result += kdtree->getPhotonEnergy(collected[i]) * weight;
+  }
+  return result / float(M_PI * radius2);
+}
+
+
+// everything the traced photons depend on: the surfaces (the original
+// quads & the primitives as rasterized), their materials & the settings
+uint64_t PhotonMapping::getPhotonMapKey() const {
+  uint64_t hash = FNV_OFFSET_BASIS;
+  std::vector<Face*> faces;
+  for (int i = 0; i < mesh->numOriginalQuads(); i++) {
+    faces.push_back(mesh->getOriginalQuad(i));
+  }
+  for (int i = 0; i < mesh->numRasterizedPrimitiveFaces(); i++) {
+    faces.push_back(mesh->getRasterizedPrimitiveFace(i));
+  }
+  fnv_hash_value(hash, faces.size());
+  for (unsigned int i = 0; i < faces.size(); i++) {
+    for (int c = 0; c < 4; c++) {
+      fnv_hash_value(hash, (*faces[i])[c]->get());
     }
+    Material *m = faces[i]->getMaterial();
+    fnv_hash_value(hash, m->getDiffuseColor());
+    fnv_hash_value(hash, m->getReflectiveColor());
+    fnv_hash_value(hash, m->getEmittedColor());
   }
+  // (not the seed, the photons traced from any seed are a map of the
+  // scene, and by default each run has a different seed)
+  fnv_hash_value(hash, args->num_photons_to_shoot);
+  fnv_hash_value(hash, args->num_bounces);
+  // the photons are traced with CastRay
+  fnv_hash_value(hash, args->intersect_backfacing);
+  return hash;
 }
 
 
@@ -164,228 +324,99 @@ glm::vec3 PhotonMapping::GatherIndirect(const glm::vec3 &point, const glm::vec3
     return glm::vec3(0,0,0); 
   }
 
-  // first get initial selection
-  std::vector<Photon> collected;
-  // start with smallest possible radius, increasing as needed
-  float radius = EPSILON;
-  while (collected.size() < args->num_photons_to_collect) {
-    glm::vec3 min(point.x - radius, point.y - radius, point.z - radius);
-    glm::vec3 max(point.x + radius, point.y + radius, point.z + radius);
-
-    BoundingBox bbox(min, max);
-  
-    collected.clear();
-    // first get all photons in box
-    kdtree->CollectPhotonsInBox(bbox, collected);
-
-    // increase the radius in case we don't get enough
-    radius *= 2.0f;
-    // and skip the extra computation if we have too few photons
-    if (collected.size() < args->num_photons_to_collect) {
-      continue;
+  // the closest precomputed irradiance on a similar surface
+  if (irradiance_kdtree != NULL) {
+    std::vector<std::pair<float,int> > nearest;
+    irradiance_kdtree->FindNearestPhotons(point, PHOTON_IRRADIANCE_CANDIDATES, nearest);
+    for (unsigned int i = 0; i < nearest.size(); i++) {
+      int photon = nearest[i].second;
+      if (glm::dot(irradiance_kdtree->getPhotonNormal(photon), normal) >= PHOTON_NORMAL_COSINE) {
+        return irradiance_kdtree->getPhotonEnergy(photon);
+      }
     }
+    // (otherwise, gather the photons)
+  }
 
-    // comparator to sort by distance from point
-    struct photonCmp {
-      glm::vec3 pt;
-      photonCmp(glm::vec3 _pt) { pt = _pt; }
-      bool operator() (const Photon& a, const Photon& b) const {
-        return glm::distance(a.getPosition(), pt) < glm::distance(b.getPosition(), pt);
-      }
-    };
-
-    photonCmp cmp(point);
-
-    // sort the photons collected thus far
-    std::vector<Photon> sortedPhotons(collected);
-    std::sort(sortedPhotons.begin(), sortedPhotons.end(), cmp);
-    collected.clear();
-    
-    Hit h;
-    for (int i=0; i<sortedPhotons.size(); i++) {
-      // first remove if outside the radius
-      if (glm::distance(sortedPhotons[i].getPosition(), point) < radius) { 
-        // and check that it's not occluded from the ray being cast
-        Ray r(sortedPhotons[i].getPosition(), -direction_from);
-        if (!raytracer->CastRay(r, h, false)) {
-          collected.push_back(sortedPhotons[i]);
-          // once we have enough, finish up
-          if (collected.size() >= args->num_photons_to_collect) {
-            break;
-          }
-        }
+  glm::vec3 cached;
+  if (irradiance_cache != NULL && irradiance_cache->Lookup(point, normal, cached)) {
+    return cached;
+  }
+
+  // find the nearest photons which are not occluded from the ray
+  // being cast, if some of the nearest are occluded look further out
+  // (the nearest k are the first k of the nearest 2k, so those
+  // photons are not checked again)
+  int num_to_collect = std::min(args->num_photons_to_collect, kdtree->numPhotons());
+  int num_nearest = num_to_collect;
+  int num_checked = 0;
+  std::vector<std::pair<float,int> > nearest;
+  std::vector<std::pair<float,int> > collected;
+  while ((int)collected.size() < num_to_collect && num_checked < kdtree->numPhotons()) {
+    kdtree->FindNearestPhotons(point, num_nearest, nearest);
+    for (int i = num_checked; i < (int)nearest.size(); i++) {
+      Ray r(kdtree->getPhotonPosition(nearest[i].second), -direction_from);
+      if (!raytracer->Occluded(r, FLT_MAX, false)) {
+        collected.push_back(nearest[i]);
+        // once we have enough, finish up
+        if ((int)collected.size() >= num_to_collect) break;
       }
     }
+    num_checked = nearest.size();
+    num_nearest *= 2;
   }
+  if (collected.empty()) return glm::vec3(0,0,0);
 
   // shrink radius to furthest out photon
-  radius = glm::distance(collected.back().getPosition(), point);
+  float radius = std::sqrt(collected.back().first);
 
   // now divide the photon colors out and return the result
   glm::vec3 result(0, 0, 0);
-  for (int i=0; i<collected.size(); i++) {
-    float weight = glm::dot(-collected[i].getDirectionFrom(), normal);
-    result += collected[i].getEnergy() * weight;
+  // for the irradiance cache, how the result changes (per channel) as
+  // the point moves along the surface & as the normal turns
+  glm::vec3 translation_gradient[3], rotation_gradient[3];
+  for (int c = 0; c < 3; c++) {
+    translation_gradient[c] = rotation_gradient[c] = glm::vec3(0,0,0);
   }
-
-  // divide by area of sphere projected onto surface
-  result /= M_PI * radius * radius; 
-
-  // return the color
-  return result;
-}
-
-
-// ======================================================================
-// PHOTON VISUALIZATION FOR DEBUGGING
-// ======================================================================
-
-void PhotonMapping::initializeVBOs() {
-  HandleGLError("enter photonmapping initializevbos()");
-  glGenBuffers(1, &photon_direction_verts_VBO);
-  glGenBuffers(1, &photon_direction_indices_VBO);
-  glGenBuffers(1, &kdtree_verts_VBO);
-  glGenBuffers(1, &kdtree_edge_indices_VBO);
-  HandleGLError("leave photonmapping initializevbos()");
-}
-
-void PhotonMapping::setupVBOs() {
-  HandleGLError("enter photonmapping setupvbos()");
-
-  photon_direction_verts.clear();
-  photon_direction_indices.clear();
-  kdtree_verts.clear();
-  kdtree_edge_indices.clear();
-
-  // initialize the data
-  BoundingBox *bb = mesh->getBoundingBox();
-  float max_dim = bb->maxDim();
-
-  if (kdtree == NULL) return;
-  std::vector<const KDTree*> todo;  
-  todo.push_back(kdtree);
-  while (!todo.empty()) {
-    const KDTree *node = todo.back();
-    todo.pop_back(); 
-    if (node->isLeaf()) {
-
-      // initialize photon direction vbo
-      const std::vector<Photon> &photons = node->getPhotons();
-      int num_photons = photons.size();
-      for (int i = 0; i < num_photons; i++) {
-	const Photon &p = photons[i];
-	glm::vec3 energy = p.getEnergy()*float(args->num_photons_to_shoot);
-        glm::vec4 color(energy.x,energy.y,energy.z,1);
-	const glm::vec3 &position = p.getPosition();
-	glm::vec3 other = position - p.getDirectionFrom()*0.02f*max_dim;
-        addEdgeGeometry(photon_direction_verts,photon_direction_indices,
-                        position,other,color,color,max_dim*0.0005f,0);
+  for (unsigned int i=0; i<collected.size(); i++) {
+    int photon = collected[i].second;
+    float weight = glm::dot(-kdtree->getPhotonDirectionFrom(photon), normal);
+    result += kdtree->getPhotonEnergy(photon) * weight;
+    if (irradiance_cache != NULL) {
+      // the gradient of the same photons with the (smooth)
+      // Epanechnikov kernel rather than the disc, in the surface plane
+      glm::vec3 toward = kdtree->getPhotonPosition(photon) - point;
+      toward -= normal * glm::dot(toward, normal);
+      for (int c = 0; c < 3; c++) {
+        translation_gradient[c] += kdtree->getPhotonEnergy(photon)[c] * weight * toward;
+        rotation_gradient[c] -= kdtree->getPhotonEnergy(photon)[c] * kdtree->getPhotonDirectionFrom(photon);
       }
-
-      // initialize kdtree vbo
-      float thickness = 0.001*max_dim;
-      glm::vec3 A = node->getMin();
-      glm::vec3 B = node->getMax();
-      glm::vec4 black(1,0,0,1);
-      addEdgeGeometry(kdtree_verts,kdtree_edge_indices,glm::vec3(A.x,A.y,A.z),glm::vec3(A.x,A.y,B.z),black,black,thickness,thickness);
-      addEdgeGeometry(kdtree_verts,kdtree_edge_indices,glm::vec3(A.x,A.y,B.z),glm::vec3(A.x,B.y,B.z),black,black,thickness,thickness);
-      addEdgeGeometry(kdtree_verts,kdtree_edge_indices,glm::vec3(A.x,B.y,B.z),glm::vec3(A.x,B.y,A.z),black,black,thickness,thickness);
-      addEdgeGeometry(kdtree_verts,kdtree_edge_indices,glm::vec3(A.x,B.y,A.z),glm::vec3(A.x,A.y,A.z),black,black,thickness,thickness);
-      addEdgeGeometry(kdtree_verts,kdtree_edge_indices,glm::vec3(B.x,A.y,A.z),glm::vec3(B.x,A.y,B.z),black,black,thickness,thickness);
-      addEdgeGeometry(kdtree_verts,kdtree_edge_indices,glm::vec3(B.x,A.y,B.z),glm::vec3(B.x,B.y,B.z),black,black,thickness,thickness);
-      addEdgeGeometry(kdtree_verts,kdtree_edge_indices,glm::vec3(B.x,B.y,B.z),glm::vec3(B.x,B.y,A.z),black,black,thickness,thickness);
-      addEdgeGeometry(kdtree_verts,kdtree_edge_indices,glm::vec3(B.x,B.y,A.z),glm::vec3(B.x,A.y,A.z),black,black,thickness,thickness);
-      addEdgeGeometry(kdtree_verts,kdtree_edge_indices,glm::vec3(A.x,A.y,A.z),glm::vec3(B.x,A.y,A.z),black,black,thickness,thickness);
-      addEdgeGeometry(kdtree_verts,kdtree_edge_indices,glm::vec3(A.x,A.y,B.z),glm::vec3(B.x,A.y,B.z),black,black,thickness,thickness);
-      addEdgeGeometry(kdtree_verts,kdtree_edge_indices,glm::vec3(A.x,B.y,B.z),glm::vec3(B.x,B.y,B.z),black,black,thickness,thickness);
-      addEdgeGeometry(kdtree_verts,kdtree_edge_indices,glm::vec3(A.x,B.y,A.z),glm::vec3(B.x,B.y,A.z),black,black,thickness,thickness);
-
-    } else {
-      todo.push_back(node->getChild1());
-      todo.push_back(node->getChild2());
-    } 
+    }
   }
 
+  // divide by area of sphere projected onto surface
+  result /= M_PI * radius * radius; 
 
-
-  // copy the data to each VBO
-  if (photon_direction_verts.size() > 0) {
-    glBindBuffer(GL_ARRAY_BUFFER,photon_direction_verts_VBO); 
-    glBufferData(GL_ARRAY_BUFFER,
-                 sizeof(VBOPosNormalColor) * photon_direction_verts.size(),
-                 &photon_direction_verts[0],
-                 GL_STATIC_DRAW); 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,photon_direction_indices_VBO); 
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-                 sizeof(VBOIndexedTri) * photon_direction_indices.size(),
-                 &photon_direction_indices[0], GL_STATIC_DRAW);
-  }
-  if (kdtree_verts.size() > 0) {
-    glBindBuffer(GL_ARRAY_BUFFER,kdtree_verts_VBO); 
-    glBufferData(GL_ARRAY_BUFFER,
-                 sizeof(VBOPosNormalColor) * kdtree_verts.size(),
-                 &kdtree_verts[0],
-                 GL_STATIC_DRAW); 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,kdtree_edge_indices_VBO); 
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-                 sizeof(VBOIndexedTri) * kdtree_edge_indices.size(),
-                 &kdtree_edge_indices[0], GL_STATIC_DRAW);
+  if (irradiance_cache != NULL && radius > 0) {
+    IrradianceRecord record;
+    record.position = point;
+    record.normal = normal;
+    record.irradiance = result;
+    record.radius = radius;
+    for (int c = 0; c < 3; c++) {
+      record.translation_gradient[c] = translation_gradient[c] * float(4 / (M_PI * radius * radius * radius * radius));
+      // only turning the normal (not lengthening it) matters
+      glm::vec3 g = rotation_gradient[c] / float(M_PI * radius * radius);
+      record.rotation_gradient[c] = g - normal * glm::dot(g, normal);
+    }
+    irradiance_cache->Insert(record);
   }
 
-  HandleGLError("leave photonmapping setupvbos()");
+  // return the color
+  return result;
 }
 
-void PhotonMapping::drawVBOs() {
-  HandleGLError("enter photonmapping drawvbos()");
-
-  glUniform1i(GLCanvas::colormodeID, 1);
-  if (args->render_photons && photon_direction_verts.size() > 0) {
-    glBindBuffer(GL_ARRAY_BUFFER,photon_direction_verts_VBO); 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,photon_direction_indices_VBO); 
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0,3,GL_FLOAT,GL_FALSE,sizeof(VBOPosNormalColor),(void*)0);
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1,3,GL_FLOAT,GL_FALSE,sizeof(VBOPosNormalColor),(void*)sizeof(glm::vec3) );
-    glEnableVertexAttribArray(2);
-    glVertexAttribPointer(2, 3, GL_FLOAT,GL_FALSE,sizeof(VBOPosNormalColor), (void*)(sizeof(glm::vec3)*2));
-    glEnableVertexAttribArray(3);
-    glVertexAttribPointer(3, 3, GL_FLOAT,GL_FALSE,sizeof(VBOPosNormalColor), (void*)(sizeof(glm::vec3)*2 + sizeof(glm::vec4)));
-    glDrawElements(GL_TRIANGLES,
-                   photon_direction_indices.size()*3,
-                   GL_UNSIGNED_INT, 0);
-    glDisableVertexAttribArray(0);
-    glDisableVertexAttribArray(1);
-    glDisableVertexAttribArray(2);
-    glDisableVertexAttribArray(3);
-  }
-
-  if (args->render_kdtree && kdtree_edge_indices.size() > 0) {
-    glBindBuffer(GL_ARRAY_BUFFER,kdtree_verts_VBO); 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,kdtree_edge_indices_VBO); 
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0,3,GL_FLOAT,GL_FALSE,sizeof(VBOPosNormalColor),(void*)0);
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1,3,GL_FLOAT,GL_FALSE,sizeof(VBOPosNormalColor),(void*)sizeof(glm::vec3) );
-    glEnableVertexAttribArray(2);
-    glVertexAttribPointer(2, 3, GL_FLOAT,GL_FALSE,sizeof(VBOPosNormalColor), (void*)(sizeof(glm::vec3)*2));
-    glEnableVertexAttribArray(3);
-    glVertexAttribPointer(3, 3, GL_FLOAT,GL_FALSE,sizeof(VBOPosNormalColor), (void*)(sizeof(glm::vec3)*2 + sizeof(glm::vec4)));
-    glDrawElements(GL_TRIANGLES,
-                   kdtree_edge_indices.size()*3,
-                   GL_UNSIGNED_INT, 0);
-    glDisableVertexAttribArray(0);
-    glDisableVertexAttribArray(1);
-    glDisableVertexAttribArray(2);
-    glDisableVertexAttribArray(3);
-  }
-
-  HandleGLError("leave photonmapping drawvbos()");
-}
 
-void PhotonMapping::cleanupVBOs() {
-  glDeleteBuffers(1, &photon_direction_verts_VBO);
-  glDeleteBuffers(1, &photon_direction_indices_VBO);
-  glDeleteBuffers(1, &kdtree_verts_VBO);
-  glDeleteBuffers(1, &kdtree_edge_indices_VBO);
+void PhotonMapping::CommitIrradianceCache() {
+  if (irradiance_cache != NULL) irradiance_cache->Commit();
 }
 
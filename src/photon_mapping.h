@@ -2,6 +2,7 @@
 #define _PHOTON_MAPPING_H_
 
 #include <vector>
+#include <stdint.h>
 
 #include "photon.h"
 #include "vbo_structs.h"
@@ -13,6 +14,8 @@ class Ray;
 class Hit;
 class RayTracer;
 class Radiosity;
+class Sampler;
+class IrradianceCache;
 
 // =========================================================================
 // The basic class to shoot photons within the scene and collect and
@@ -28,6 +31,8 @@ class PhotonMapping {
     args = _args;
     raytracer = NULL;
     kdtree = NULL;
+    irradiance_kdtree = NULL;
+    irradiance_cache = NULL;
   }
   ~PhotonMapping();
   void setRayTracer(RayTracer *r) { raytracer = r; }
@@ -41,15 +46,30 @@ class PhotonMapping {
   // step 1: send the photons throughout the scene
   void TracePhotons();
   // step 2: collect the photons and return the contribution from indirect illumination
+  // (with -irradiance_cache, interpolated from earlier gathers where possible)
   glm::vec3 GatherIndirect(const glm::vec3 &point, const glm::vec3 &normal, const glm::vec3 &direction_from) const;
+  // the gathers since the last commit are used by the following
+  // GatherIndirect calls (none may run at the same time)
+  void CommitIrradianceCache();
 
  private:
 
-  // trace a single photon
-  void TracePhoton(const glm::vec3 &position, const glm::vec3 &direction, const glm::vec3 &energy, int iter);
+  // with -precompute_irradiance, the irradiance at some of the photons
+  void PrecomputeIrradiance();
+  glm::vec3 EstimateIrradiance(int photon) const;
+  // identifies the scene & the settings the photons are traced with
+  uint64_t getPhotonMapKey() const;
+  // trace a single photon, adding where it (and its bounces) hit
+  void TracePhoton(const glm::vec3 &position, const glm::vec3 &direction, const glm::vec3 &energy, int iter,
+                   Sampler &sampler, std::vector<Photon> &photons);
 
   // REPRESENTATION
   KDTree *kdtree;
+  // NULL unless -precompute_irradiance, every few photons of the tree
+  // above with the energy replaced by the irradiance estimated there
+  KDTree *irradiance_kdtree;
+  // NULL unless -irradiance_cache
+  IrradianceCache *irradiance_cache;
   Mesh *mesh;
   ArgParser *args;
   RayTracer *raytracer;
@@ -0,0 +1,154 @@
+#include "glCanvas.h"
+
+#include "argparser.h"
+#include "photon_mapping.h"
+#include "mesh.h"
+#include "face.h"
+#include "kdtree.h"
+#include "utils.h"
+
+// ======================================================================
+// PHOTON VISUALIZATION FOR DEBUGGING
+// ======================================================================
+
+void PhotonMapping::initializeVBOs() {
+  HandleGLError("enter photonmapping initializevbos()");
+  glGenBuffers(1, &photon_direction_verts_VBO);
+  glGenBuffers(1, &photon_direction_indices_VBO);
+  glGenBuffers(1, &kdtree_verts_VBO);
+  glGenBuffers(1, &kdtree_edge_indices_VBO);
+  HandleGLError("leave photonmapping initializevbos()");
+}
+
+void PhotonMapping::setupVBOs() {
+  HandleGLError("enter photonmapping setupvbos()");
+
+  photon_direction_verts.clear();
+  photon_direction_indices.clear();
+  kdtree_verts.clear();
+  kdtree_edge_indices.clear();
+
+  // initialize the data
+  BoundingBox *bb = mesh->getBoundingBox();
+  float max_dim = bb->maxDim();
+
+  if (kdtree == NULL) return;
+  for (int n = 0; n < kdtree->numNodes(); n++) {
+    const KDNode &node = kdtree->getNode(n);
+    if (node.isLeaf()) {
+
+      // initialize photon direction vbo
+      for (int i = node.offset; i < node.offset + node.num_photons; i++) {
+	Photon p = kdtree->getPhoton(i);
+	glm::vec3 energy = p.getEnergy()*float(args->num_photons_to_shoot);
+        glm::vec4 color(energy.x,energy.y,energy.z,1);
+	const glm::vec3 &position = p.getPosition();
+	glm::vec3 other = position - p.getDirectionFrom()*0.02f*max_dim;
+        addEdgeGeometry(photon_direction_verts,photon_direction_indices,
+                        position,other,color,color,max_dim*0.0005f,0);
+      }
+
+      // initialize kdtree vbo
+      float thickness = 0.001*max_dim;
+      glm::vec3 A = node.min;
+      glm::vec3 B = node.max;
+      glm::vec4 black(1,0,0,1);
+      addEdgeGeometry(kdtree_verts,kdtree_edge_indices,glm::vec3(A.x,A.y,A.z),glm::vec3(A.x,A.y,B.z),black,black,thickness,thickness);
+      addEdgeGeometry(kdtree_verts,kdtree_edge_indices,glm::vec3(A.x,A.y,B.z),glm::vec3(A.x,B.y,B.z),black,black,thickness,thickness);
+      addEdgeGeometry(kdtree_verts,kdtree_edge_indices,glm::vec3(A.x,B.y,B.z),glm::vec3(A.x,B.y,A.z),black,black,thickness,thickness);
+      addEdgeGeometry(kdtree_verts,kdtree_edge_indices,glm::vec3(A.x,B.y,A.z),glm::vec3(A.x,A.y,A.z),black,black,thickness,thickness);
+      addEdgeGeometry(kdtree_verts,kdtree_edge_indices,glm::vec3(B.x,A.y,A.z),glm::vec3(B.x,A.y,B.z),black,black,thickness,thickness);
+      addEdgeGeometry(kdtree_verts,kdtree_edge_indices,glm::vec3(B.x,A.y,B.z),glm::vec3(B.x,B.y,B.z),black,black,thickness,thickness);
+      addEdgeGeometry(kdtree_verts,kdtree_edge_indices,glm::vec3(B.x,B.y,B.z),glm::vec3(B.x,B.y,A.z),black,black,thickness,thickness);
+      addEdgeGeometry(kdtree_verts,kdtree_edge_indices,glm::vec3(B.x,B.y,A.z),glm::vec3(B.x,A.y,A.z),black,black,thickness,thickness);
+      addEdgeGeometry(kdtree_verts,kdtree_edge_indices,glm::vec3(A.x,A.y,A.z),glm::vec3(B.x,A.y,A.z),black,black,thickness,thickness);
+      addEdgeGeometry(kdtree_verts,kdtree_edge_indices,glm::vec3(A.x,A.y,B.z),glm::vec3(B.x,A.y,B.z),black,black,thickness,thickness);
+      addEdgeGeometry(kdtree_verts,kdtree_edge_indices,glm::vec3(A.x,B.y,B.z),glm::vec3(B.x,B.y,B.z),black,black,thickness,thickness);
+      addEdgeGeometry(kdtree_verts,kdtree_edge_indices,glm::vec3(A.x,B.y,A.z),glm::vec3(B.x,B.y,A.z),black,black,thickness,thickness);
+
+    }
+  }
+
+
+
+  // copy the data to each VBO
+  if (photon_direction_verts.size() > 0) {
+    glBindBuffer(GL_ARRAY_BUFFER,photon_direction_verts_VBO); 
+    glBufferData(GL_ARRAY_BUFFER,
+                 sizeof(VBOPosNormalColor) * photon_direction_verts.size(),
+                 &photon_direction_verts[0],
+                 GL_STATIC_DRAW); 
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,photon_direction_indices_VBO); 
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+                 sizeof(VBOIndexedTri) * photon_direction_indices.size(),
+                 &photon_direction_indices[0], GL_STATIC_DRAW);
+  }
+  if (kdtree_verts.size() > 0) {
+    glBindBuffer(GL_ARRAY_BUFFER,kdtree_verts_VBO); 
+    glBufferData(GL_ARRAY_BUFFER,
+                 sizeof(VBOPosNormalColor) * kdtree_verts.size(),
+                 &kdtree_verts[0],
+                 GL_STATIC_DRAW); 
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,kdtree_edge_indices_VBO); 
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+                 sizeof(VBOIndexedTri) * kdtree_edge_indices.size(),
+                 &kdtree_edge_indices[0], GL_STATIC_DRAW);
+  }
+
+  HandleGLError("leave photonmapping setupvbos()");
+}
+
+void PhotonMapping::drawVBOs() {
+  HandleGLError("enter photonmapping drawvbos()");
+
+  glUniform1i(GLCanvas::colormodeID, 1);
+  if (args->render_photons && photon_direction_verts.size() > 0) {
+    glBindBuffer(GL_ARRAY_BUFFER,photon_direction_verts_VBO); 
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,photon_direction_indices_VBO); 
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0,3,GL_FLOAT,GL_FALSE,sizeof(VBOPosNormalColor),(void*)0);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1,3,GL_FLOAT,GL_FALSE,sizeof(VBOPosNormalColor),(void*)sizeof(glm::vec3) );
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 3, GL_FLOAT,GL_FALSE,sizeof(VBOPosNormalColor), (void*)(sizeof(glm::vec3)*2));
+    glEnableVertexAttribArray(3);
+    glVertexAttribPointer(3, 3, GL_FLOAT,GL_FALSE,sizeof(VBOPosNormalColor), (void*)(sizeof(glm::vec3)*2 + sizeof(glm::vec4)));
+    glDrawElements(GL_TRIANGLES,
+                   photon_direction_indices.size()*3,
+                   GL_UNSIGNED_INT, 0);
+    glDisableVertexAttribArray(0);
+    glDisableVertexAttribArray(1);
+    glDisableVertexAttribArray(2);
+    glDisableVertexAttribArray(3);
+  }
+
+  if (args->render_kdtree && kdtree_edge_indices.size() > 0) {
+    glBindBuffer(GL_ARRAY_BUFFER,kdtree_verts_VBO); 
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,kdtree_edge_indices_VBO); 
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0,3,GL_FLOAT,GL_FALSE,sizeof(VBOPosNormalColor),(void*)0);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1,3,GL_FLOAT,GL_FALSE,sizeof(VBOPosNormalColor),(void*)sizeof(glm::vec3) );
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 3, GL_FLOAT,GL_FALSE,sizeof(VBOPosNormalColor), (void*)(sizeof(glm::vec3)*2));
+    glEnableVertexAttribArray(3);
+    glVertexAttribPointer(3, 3, GL_FLOAT,GL_FALSE,sizeof(VBOPosNormalColor), (void*)(sizeof(glm::vec3)*2 + sizeof(glm::vec4)));
+    glDrawElements(GL_TRIANGLES,
+                   kdtree_edge_indices.size()*3,
+                   GL_UNSIGNED_INT, 0);
+    glDisableVertexAttribArray(0);
+    glDisableVertexAttribArray(1);
+    glDisableVertexAttribArray(2);
+    glDisableVertexAttribArray(3);
+  }
+
+  HandleGLError("leave photonmapping drawvbos()");
+}
+
+void PhotonMapping::cleanupVBOs() {
+  glDeleteBuffers(1, &photon_direction_verts_VBO);
+  glDeleteBuffers(1, &photon_direction_indices_VBO);
+  glDeleteBuffers(1, &kdtree_verts_VBO);
+  glDeleteBuffers(1, &kdtree_edge_indices_VBO);
+}
+
@@ -2,10 +2,10 @@
 #define _PRIMITIVE_H_
 
 #include <glm/glm.hpp>
+#include "boundingbox.h"
+#include "hit.h"
 
 class Mesh;
-class Ray;
-class Hit;
 class Material;
 class ArgParser;
 
@@ -23,6 +23,14 @@ class Primitive {
 
   // for ray tracing
   virtual bool intersect(const Ray &r, Hit &h) const = 0;
+  // for shadow rays, true if the object is hit closer than tmax
+  virtual bool occluded(const Ray &r, float tmax) const {
+    Hit h;
+    h.set(tmax,NULL,glm::vec3(0,0,0));
+    return intersect(r,h);
+  }
+  // for the acceleration structure
+  virtual BoundingBox getBoundingBox() const = 0;
 
   // for lightning
   virtual glm::vec3 closestPoint(glm::vec3 point) = 0;
@@ -1,13 +1,39 @@
-#include "glCanvas.h"
+#include <cstring>
 
 #include "radiosity.h"
 #include "mesh.h"
 #include "face.h"
-#include "glCanvas.h"
 #include "sphere.h"
 #include "raytree.h"
 #include "raytracer.h"
 #include "utils.h"
+#include "parallel.h"
+#include "radiosityhierarchy.h"
+#include "mappedfile.h"
+#include "hash.h"
+
+// the pairs of patches are computed in blocks of this many rows and
+// columns, each block is one task for the threads
+#define RADIOSITY_BLOCK_SIZE 32
+// the patches of a lazily computed column are split into chunks of
+// this many for the threads
+#define RADIOSITY_COLUMN_CHUNK_SIZE 256
+
+// pairs of parent patches closer than this many times their size
+// are computed again after a subdivision (rather than estimated)
+#define RADIOSITY_REUSE_DISTANCE 2.0
+
+// the first bytes of a -radiosity_cache file, the version changes
+// whenever the layout does
+#define RADIOSITY_CACHE_MAGIC "RADCACHE"
+#define RADIOSITY_CACHE_VERSION 2
+
+// use SSE where available (every x86-64 compiler) for the gathering
+// solvers, otherwise the plain loop
+#if defined(__SSE2__) || defined(_M_X64)
+#define RADIOSITY_SSE
+#include <emmintrin.h>
+#endif
 
 // ================================================================
 // CONSTRUCTOR & DESTRUCTOR
@@ -16,29 +42,33 @@ Radiosity::Radiosity(Mesh *m, ArgParser *a) {
   mesh = m;
   args = a;
   num_faces = -1;  
-  formfactors = NULL;
   area = NULL;
   undistributed = NULL;
   absorbed = NULL;
   radiance = NULL;
   max_undistributed_patch = -1;
   total_area = -1;
+  hierarchy = NULL;
   Reset();
 }
 
 Radiosity::~Radiosity() {
   Cleanup();
-  cleanupVBOs();
 }
 
 void Radiosity::Cleanup() {
-  delete [] formfactors;
+  formfactors.Clear();
+  parent_formfactors.Clear();
+  parent.clear();
+  formfactor_cache.Reset(0,0);
+  undistributed_heap.Reset(0);
+  delete hierarchy;
+  hierarchy = NULL;
   delete [] area;
   delete [] undistributed;
   delete [] absorbed;
   delete [] radiance;
   num_faces = -1;
-  formfactors = NULL;
   area = NULL;
   undistributed = NULL;
   absorbed = NULL;
@@ -48,6 +78,23 @@ void Radiosity::Cleanup() {
 }
 
 void Radiosity::Reset() {
+  delete hierarchy;
+  hierarchy = NULL;
+  Allocate();
+  for (int i = 0; i < num_faces; i++) {
+    glm::vec3 emit = mesh->getFace(i)->getMaterial()->getEmittedColor();
+    setUndistributed(i,emit);
+    setAbsorbed(i,glm::vec3(0,0,0));
+    setRadiance(i,emit);
+  }
+
+  // find the patch with the most undistributed energy
+  findMaxUndistributed();
+  residual = total_undistributed;
+}
+
+// (re)create the per patch arrays for the current faces of the mesh
+void Radiosity::Allocate() {
   delete [] area;
   delete [] undistributed;
   delete [] absorbed;
@@ -59,18 +106,15 @@ void Radiosity::Reset() {
   undistributed = new glm::vec3[num_faces];
   absorbed = new glm::vec3[num_faces];
   radiance = new glm::vec3[num_faces];
+  undistributed_heap.Reset(num_faces);
+  total_undistributed = 0;
+  total_area = 0;
   for (int i = 0; i < num_faces; i++) {
     Face *f = mesh->getFace(i);
     f->setRadiosityPatchIndex(i);
     setArea(i,f->getArea());
-    glm::vec3 emit = f->getMaterial()->getEmittedColor();
-    setUndistributed(i,emit);
-    setAbsorbed(i,glm::vec3(0,0,0));
-    setRadiance(i,emit);
+    total_area += getArea(i);
   }
-
-  // find the patch with the most undistributed energy
-  findMaxUndistributed();
 }
 
 
@@ -80,160 +124,526 @@ void Radiosity::Reset() {
 void Radiosity::findMaxUndistributed() {
   // find the patch with the most undistributed energy 
   // don't forget that the patches may have different sizes!
-  max_undistributed_patch = -1;
-  total_undistributed = 0;
-  total_area = 0;
-  float max = -1;
-  for (int i = 0; i < num_faces; i++) {
-    float m = glm::length(getUndistributed(i)) * getArea(i);
-    total_undistributed += m;
-    total_area += getArea(i);
-    if (max < m) {
-      max = m;
-      max_undistributed_patch = i;
+  // (the heap is updated whenever the undistributed energy changes)
+  max_undistributed_patch = undistributed_heap.top();
+  assert (max_undistributed_patch >= 0 && max_undistributed_patch < num_faces);
+}
+
+
+// the form factor between patches i & j (times the area of i, before
+// normalization), the sampler gives the random sample points.
+// occluded is set if any of the shadow rays were blocked
+float Radiosity::ComputeFormFactor(int i, int j, Sampler &sampler, bool &occluded) const {
+  occluded = false;
+  float factor = 0.0f;
+  // calculate normals for i and j
+  glm::vec3 i_normal = mesh->getFace(i)->computeNormal();
+  glm::vec3 j_normal = mesh->getFace(j)->computeNormal();
+
+  // calculate simple area for 1 samples
+  for(int n=0; n < args->num_form_factor_samples; n++) {
+    // find points for face i and j
+    glm::vec3 i_pt, j_pt; 
+
+    if (args->num_form_factor_samples <= 1) {
+      i_pt = mesh->getFace(i)->computeCentroid();
+      j_pt = mesh->getFace(j)->computeCentroid();
+    }
+    else {
+      i_pt = mesh->getFace(i)->RandomPoint(sampler);
+      j_pt = mesh->getFace(j)->RandomPoint(sampler);
     }
+
+    glm::vec3 r = j_pt - i_pt;
+
+    // now calculate the form factor
+    factor += getArea(i) * getArea(j) * 
+             glm::dot(i_normal, glm::normalize(r)) *
+             glm::dot(j_normal, -glm::normalize(r)) / 
+             (M_PI * glm::length(r) * glm::length(r));
+
   }
-  assert (max_undistributed_patch >= 0 && max_undistributed_patch < num_faces);
+
+  // average over all the samples
+  factor /= args->num_form_factor_samples;
+
+  // add a factor for visibility (shadows)
+  float visibility = 0.0f; 
+
+  for (int n=0; n < args->num_shadow_samples; n++) {
+    glm::vec3 i_pt, j_pt;
+
+    if (args->num_shadow_samples <= 1) {
+      // centroid to centroid
+      i_pt = mesh->getFace(i)->computeCentroid();
+      j_pt = mesh->getFace(j)->computeCentroid();
+    }
+    else {
+      // random samples
+      i_pt = mesh->getFace(i)->RandomPoint(sampler);
+      j_pt = mesh->getFace(j)->RandomPoint(sampler);
+    }
+
+    // cast a ray from j to i, visible if nothing is hit before
+    // reaching i (hits within EPSILON of i_pt are on i itself)
+    Ray r(j_pt, glm::normalize(i_pt - j_pt));
+    float dist = glm::length(i_pt - j_pt);
+
+    if (!raytracer->Occluded(r, dist - EPSILON, true)) {
+      visibility += 1.0f;
+    } else {
+      occluded = true;
+    }
+  }
+
+  // ignore visibility for 0 shadow samples
+  if (args->num_shadow_samples == 0)
+    visibility = 1.0f;
+  else
+    visibility /= args->num_shadow_samples;
+
+  // account for visibility
+  factor *= visibility;
+
+  // clamp at 0, can't have negative form factor
+  factor = std::max(0.0f, factor);
+
+  return factor;
 }
 
 
 void Radiosity::ComputeFormFactors() {
-  assert (formfactors == NULL);
+  assert (formfactors.numPatches() == 0);
   assert (num_faces > 0);
-  formfactors = new float[num_faces*num_faces];
-
-  // only need to compute one form factor for each pair
-  for (int i=0; i<num_faces; i++) {
-    for (int j=i; j<num_faces; j++) {
-      if (i == j) {
-        setFormFactor(i, j, 0.0f);
-        setFormFactor(j, i, 0.0f);
-        continue;
+  if (ReadCacheFile(false)) return;
+
+  // only need to compute one form factor for each pair, the upper
+  // triangle of pairs (j >= i) is split into square blocks which are
+  // computed in parallel.  Each block collects its own entries and
+  // has its own random stream (so the result only depends on the seed)
+  int num_blocks = (num_faces + RADIOSITY_BLOCK_SIZE - 1) / RADIOSITY_BLOCK_SIZE;
+  std::vector<std::pair<int,int> > blocks;
+  for (int bi = 0; bi < num_blocks; bi++) {
+    for (int bj = bi; bj < num_blocks; bj++) {
+      blocks.push_back(std::make_pair(bi,bj));
+    }
+  }
+  std::vector<std::vector<FormFactorEntry> > block_entries(blocks.size());
+  ParallelFor(blocks.size(), args->num_threads, [&](int b) {
+      Sampler sampler(args->seed, SAMPLER_FORM_FACTORS, b);
+      int i_start = blocks[b].first * RADIOSITY_BLOCK_SIZE;
+      int j_start = blocks[b].second * RADIOSITY_BLOCK_SIZE;
+      int i_end = std::min(i_start + RADIOSITY_BLOCK_SIZE, num_faces);
+      int j_end = std::min(j_start + RADIOSITY_BLOCK_SIZE, num_faces);
+      for (int i = i_start; i < i_end; i++) {
+        for (int j = std::max(i+1, j_start); j < j_end; j++) {
+          float factor;
+          bool occluded;
+          if (parent.empty())
+            factor = ComputeFormFactor(i, j, sampler, occluded);
+          else
+            factor = ReuseFormFactor(i, j, sampler, occluded);
+          if (factor <= 0) continue;
+          FormFactorEntry ij = { i, j, factor / getArea(i), occluded };
+          FormFactorEntry ji = { j, i, factor / getArea(j), occluded };
+          block_entries[b].push_back(ij);
+          block_entries[b].push_back(ji);
+        }
       }
+    });
 
-      float factor = 0.0f;
-      // calculate normals for i and j
-      glm::vec3 i_normal = mesh->getFace(i)->computeNormal();
-      glm::vec3 j_normal = mesh->getFace(j)->computeNormal();
+  // the small form factors are dropped & the rest normalized to sum to 1
+  std::vector<FormFactorEntry> entries;
+  size_t num_entries = 0;
+  for (unsigned int b = 0; b < blocks.size(); b++) {
+    num_entries += block_entries[b].size();
+  }
+  entries.reserve(num_entries);
+  for (unsigned int b = 0; b < blocks.size(); b++) {
+    entries.insert(entries.end(),block_entries[b].begin(),block_entries[b].end());
+    std::vector<FormFactorEntry>().swap(block_entries[b]);
+  }
+  formfactors.Build(num_faces, entries, args->form_factor_threshold,
+                    args->quantize_form_factors, args->num_threads);
+  parent_formfactors.Clear();
+  parent.clear();
+  std::cout << " form factors: " << formfactors.numEntries() << " of "
+            << (long long)num_faces*num_faces << " stored ("
+            << formfactors.getMemory() / 1024 << " KB)" << std::endl;
+  WriteCacheFile(false);
+}
 
-      // calculate simple area for 1 samples
-      for(int n=0; n < args->num_form_factor_samples; n++) {
-        // find points for face i and j
-        glm::vec3 i_pt, j_pt; 
 
-        if (args->num_form_factor_samples <= 1) {
-          i_pt = mesh->getFace(i)->computeCentroid();
-          j_pt = mesh->getFace(j)->computeCentroid();
-        }
-        else {
-          i_pt = mesh->getFace(i)->RandomPoint();
-          j_pt = mesh->getFace(j)->RandomPoint();
-        }
+// ================================================================
+// -radiosity_cache
+// ================================================================
+//
+// The file is (in the byte order of the machine that wrote it):
+//   RadiosityCacheHeader
+//   the area of each patch (float)
+//   the radiance, undistributed & absorbed light of each patch (3 floats each)
+//   the form factor matrix (see FormFactorMatrix::Write), starting at
+//     the next multiple of FORM_FACTOR_ALIGNMENT bytes
+// The solution is only meaningful if the header says it converged.
+// The matrix is used straight from the mapped file.
+
+struct RadiosityCacheHeader {
+  char magic[8];
+  int32_t version;
+  int32_t num_patches;
+  uint64_t key;
+  int32_t has_solution;
+  float residual;
+};
+
+
+// where the matrix starts in the file
+static size_t CacheMatrixOffset(int num_patches) {
+  size_t offset = sizeof(RadiosityCacheHeader) + 
+    num_patches * (sizeof(float) + 3 * sizeof(glm::vec3));
+  return (offset + FORM_FACTOR_ALIGNMENT - 1) / FORM_FACTOR_ALIGNMENT * FORM_FACTOR_ALIGNMENT;
+}
 
-        glm::vec3 r = j_pt - i_pt;
 
-        // now calculate the form factor
-        factor += getArea(i) * getArea(j) * 
-                 glm::dot(i_normal, glm::normalize(r)) *
-                 glm::dot(j_normal, -glm::normalize(r)) / 
-                 (M_PI * glm::length(r) * glm::length(r));
+// the caches only hold the whole matrix (not the lazy columns or the
+// hierarchical links)
+bool Radiosity::useCache() const {
+  return args->radiosity_cache != "" && 
+    args->lazy_form_factors == 0 && args->hierarchical_radiosity == 0;
+}
+
+
+// everything the form factors & the solution depend on: the corners &
+// the materials of the patches, and the radiosity settings
+uint64_t Radiosity::getCacheKey() const {
+  uint64_t hash = FNV_OFFSET_BASIS;
+  fnv_hash_value(hash, num_faces);
+  for (int i = 0; i < num_faces; i++) {
+    Face *f = mesh->getFace(i);
+    for (int c = 0; c < 4; c++) {
+      fnv_hash_value(hash, (*f)[c]->get());
+    }
+    fnv_hash_value(hash, f->getMaterial()->getDiffuseColor());
+    fnv_hash_value(hash, f->getMaterial()->getEmittedColor());
+  }
+  // (with one sample the points are the centroids, nothing is random,
+  // and by default each run has a different seed)
+  if (args->num_form_factor_samples > 1 || args->num_shadow_samples > 1) {
+    fnv_hash_value(hash, args->seed);
+  }
+  fnv_hash_value(hash, args->num_form_factor_samples);
+  fnv_hash_value(hash, args->num_shadow_samples);
+  fnv_hash_value(hash, args->intersect_backfacing);
+  fnv_hash_value(hash, args->form_factor_threshold);
+  fnv_hash_value(hash, args->quantize_form_factors);
+  fnv_hash_value(hash, args->radiosity_solver);
+  // the factors estimated after a subdivision differ from a fresh start
+  fnv_hash_value(hash, !parent.empty());
+  return hash;
+}
 
-      }
 
-      // average over all the samples
-      factor /= args->num_form_factor_samples;
+// the form factors (& if solution, the converged solution) from the
+// cache, false if there is no cache for this scene & these settings
+bool Radiosity::ReadCacheFile(bool solution) {
+  if (!useCache()) return false;
+  MappedFile file;
+  if (!file.Open(args->radiosity_cache)) return false;
+  RadiosityCacheHeader header;
+  if (file.getSize() < sizeof(header)) return false;
+  memcpy(&header, file.getData(), sizeof(header));
+  if (memcmp(header.magic, RADIOSITY_CACHE_MAGIC, 8) != 0 ||
+      header.version != RADIOSITY_CACHE_VERSION ||
+      header.num_patches != num_faces ||
+      header.key != getCacheKey()) {
+    // (the form factors are read whether or not the solution was)
+    if (!solution) std::cout << " radiosity cache " << args->radiosity_cache 
+              << " is for a different scene or settings" << std::endl;
+    return false;
+  }
+  if (solution && !header.has_solution) return false;
+  const float *cached_area = (const float*)(file.getData() + sizeof(header));
+  const glm::vec3 *cached_solution = (const glm::vec3*)(cached_area + num_faces);
+  // (the matrix keeps the mapping open, so the patch values remain valid)
+  FormFactorMatrix matrix;
+  if (!matrix.Read(file, CacheMatrixOffset(num_faces)) || matrix.numPatches() != num_faces) return false;
+
+  formfactors.Swap(matrix);
+  parent_formfactors.Clear();
+  parent.clear();
+  if (solution) {
+    total_area = 0;
+    for (int i = 0; i < num_faces; i++) {
+      setArea(i, cached_area[i]);
+      total_area += getArea(i);
+    }
+    for (int i = 0; i < num_faces; i++) {
+      setRadiance(i, cached_solution[3*i]);
+      setUndistributed(i, cached_solution[3*i+1]);
+      setAbsorbed(i, cached_solution[3*i+2]);
+    }
+    findMaxUndistributed();
+    residual = header.residual;
+  }
+  std::cout << " form factors" << (solution ? " & solution" : "") << " read from "
+            << args->radiosity_cache << ": " << formfactors.numEntries() << " stored ("
+            << formfactors.getMemory() / 1024 << " KB)" << std::endl;
+  return true;
+}
 
-      // add a factor for visibility (shadows)
-      float visibility = 0.0f; 
 
-      for (int n=0; n < args->num_shadow_samples; n++) {
-        glm::vec3 i_pt, j_pt;
+// save the form factors (& if solution, the current solution, which
+// should have converged).  The file is written next to the cache &
+// then renamed, so a run reading the old cache never sees half of it
+void Radiosity::WriteCacheFile(bool solution) {
+  if (!useCache()) return;
+  if (formfactors.numPatches() != num_faces) return;
+  RadiosityCacheHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, RADIOSITY_CACHE_MAGIC, 8);
+  header.version = RADIOSITY_CACHE_VERSION;
+  header.num_patches = num_faces;
+  header.key = getCacheKey();
+  header.has_solution = solution;
+  header.residual = residual;
+  std::vector<glm::vec3> solution_values(3 * num_faces);
+  for (int i = 0; i < num_faces; i++) {
+    solution_values[3*i] = getRadiance(i);
+    solution_values[3*i+1] = getUndistributed(i);
+    solution_values[3*i+2] = getAbsorbed(i);
+  }
 
-        if (args->num_shadow_samples <= 1) {
-          // centroid to centroid
-          i_pt = mesh->getFace(i)->computeCentroid();
-          j_pt = mesh->getFace(j)->computeCentroid();
-        }
-        else {
-          // random samples
-          i_pt = mesh->getFace(i)->RandomPoint();
-          j_pt = mesh->getFace(j)->RandomPoint();
-        }
+  std::string temporary = args->radiosity_cache + ".tmp";
+  FILE *file = fopen(temporary.c_str(), "wb");
+  if (file == NULL) {
+    std::cerr << "ERROR: can't write the radiosity cache " << temporary << std::endl;
+    return;
+  }
+  size_t padding = CacheMatrixOffset(num_faces) - sizeof(header) -
+    num_faces * (sizeof(float) + 3 * sizeof(glm::vec3));
+  char zeros[FORM_FACTOR_ALIGNMENT] = { 0 };
+  bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+    fwrite(area, sizeof(float), num_faces, file) == (size_t)num_faces &&
+    fwrite(solution_values.data(), sizeof(glm::vec3), 3 * num_faces, file) == (size_t)3 * num_faces &&
+    fwrite(zeros, 1, padding, file) == padding &&
+    formfactors.Write(file);
+  ok = (fclose(file) == 0) && ok;
+#if defined(_WIN32)
+  // rename won't replace an existing file
+  if (ok) remove(args->radiosity_cache.c_str());
+#endif
+  if (!ok || rename(temporary.c_str(), args->radiosity_cache.c_str()) != 0) {
+    std::cerr << "ERROR: can't write the radiosity cache " << args->radiosity_cache << std::endl;
+    remove(temporary.c_str());
+    return;
+  }
+  std::cout << " form factors" << (solution ? " & solution" : "") << " saved to "
+            << args->radiosity_cache << std::endl;
+}
 
-        // cast a ray from i to j, changing visibility appropriately
-        Hit h;
-        Ray r(j_pt, glm::normalize(i_pt - j_pt));
-
-        if (raytracer->CastRay(r, h, true)) {
-          float dist = glm::length(r.pointAtParameter(h.getT()) - i_pt);
-          if (dist < EPSILON) {
-            // this is the hit we expected, it is visible
-            visibility += 1.0f;
-          }
-          // otherwise not visible, don't add to visibility
-        }
-        else {
-          // somehow we got no hit, visibility is good?
-          visibility += 1.0f;
-        }
-      }
 
-      // ignore visibility for 0 shadow samples
-      if (args->num_shadow_samples == 0)
-        visibility = 1.0f;
-      else
-        visibility /= args->num_shadow_samples;
 
-      // account for visibility
-      factor *= visibility;
 
-      // clamp at 0, can't have negative form factor
-      factor = std::max(0.0f, factor);
 
-      setFormFactor(i, j, factor / getArea(i));
-      setFormFactor(j, i, factor / getArea(j));
-    }
+// is any corner of b in front of a (and the other way around)?
+static bool CanSee(Face *a, Face *b) {
+  glm::vec3 a_normal = a->computeNormal();
+  glm::vec3 b_normal = b->computeNormal();
+  glm::vec3 a_centroid = a->computeCentroid();
+  glm::vec3 b_centroid = b->computeCentroid();
+  bool a_sees = false, b_sees = false;
+  for (int c = 0; c < 4; c++) {
+    if (glm::dot(a_normal,(*b)[c]->get()-a_centroid) > EPSILON) a_sees = true;
+    if (glm::dot(b_normal,(*a)[c]->get()-b_centroid) > EPSILON) b_sees = true;
   }
+  return a_sees && b_sees;
+}
+
 
-  // now we need to normalize the form factors to sum to 1
-  for (int i=0; i<num_faces; i++) {
-    normalizeFormFactors(i);
+// after a subdivision, the form factor of patches i & j (like
+// ComputeFormFactor) estimated from the form factor of their parents
+// (as F_i,j = F_parent(i),parent(j) * A_j / A_parent(j)).  It is only
+// computed again if the estimate may be poor: the parents are close
+// (for their size) or their visibility changes (some, but not all, of
+// their shadow rays were blocked).  Fully visible or fully occluded
+// parents are assumed to stay that way.
+float Radiosity::ReuseFormFactor(int i, int j, Sampler &sampler, bool &occluded) const {
+  occluded = false;
+  int p = parent[i];
+  int q = parent[j];
+  // the children of a quad are in the same plane
+  if (p == q) return 0;
+  float f_pq = parent_formfactors.getFormFactor(p,q);
+  float f_qp = parent_formfactors.getFormFactor(q,p);
+  bool zero = (f_pq == 0 && f_qp == 0);
+  if (zero && !CanSee(mesh->getFace(i),mesh->getFace(j))) return 0;
+  float distance = glm::length(parent_centroid[p] - parent_centroid[q]);
+  float size = sqrt(parent_area[p]) + sqrt(parent_area[q]);
+  if (size * RADIOSITY_REUSE_DISTANCE > distance ||
+      parent_formfactors.isOccluded(p,q)) {
+    return ComputeFormFactor(i, j, sampler, occluded);
   }
+  if (zero) return 0;
+  // the factor is F_i,j * A_i (the average of both directions)
+  return 0.5f * getArea(i) * getArea(j) * (f_pq / parent_area[q] + f_qp / parent_area[p]);
 }
 
 
+void Radiosity::Subdivision() {
+  if (args->hierarchical_radiosity > 0) {
+    // the hierarchy starts again from the subdivided mesh
+    Cleanup();
+    mesh->Subdivision();
+    Reset();
+    return;
+  }
 
+  // the patches before the subdivision (their faces are deleted)
+  int old_num_quads = mesh->numSubdividedQuads();
+  int old_num_faces = num_faces;
+  parent_area.assign(area,area+old_num_faces);
+  parent_centroid.resize(old_num_faces);
+  for (int i = 0; i < old_num_faces; i++) {
+    parent_centroid[i] = mesh->getFace(i)->computeCentroid();
+  }
+  std::vector<glm::vec3> old_undistributed(undistributed,undistributed+old_num_faces);
+  std::vector<glm::vec3> old_absorbed(absorbed,absorbed+old_num_faces);
+  std::vector<glm::vec3> old_radiance(radiance,radiance+old_num_faces);
+  bool reuse = formfactors.numPatches() == old_num_faces;
+  parent_formfactors.Clear();
+  if (reuse) parent_formfactors.Swap(formfactors);
+  formfactors.Clear();
+  formfactor_cache.Reset(0,0);
+
+  // each quad is split into 4 consecutive quads, the rasterized
+  // primitive faces aren't split (they follow the quads)
+  mesh->Subdivision();
+  Allocate();
+  parent.resize(num_faces);
+  for (int i = 0; i < num_faces; i++) {
+    if (i < 4 * old_num_quads) 
+      parent[i] = i / 4;
+    else
+      parent[i] = old_num_quads + (i - 4 * old_num_quads);
+    assert (parent[i] < old_num_faces);
+    // the values are per unit area, the current solution is kept
+    setUndistributed(i, old_undistributed[parent[i]]);
+    setAbsorbed(i, old_absorbed[parent[i]]);
+    setRadiance(i, old_radiance[parent[i]]);
+  }
+  findMaxUndistributed();
+  residual = total_undistributed;
+  if (!reuse) {
+    parent.clear();
+  }
+}
+
+
+// the form factors of column j (F_i,j for every i) computed on
+// demand, for -lazy_form_factors
+const FormFactorColumn& Radiosity::getFormFactorColumn(int j) {
+  assert (args->lazy_form_factors > 0);
+  if (formfactor_cache.numPatches() != num_faces) {
+    formfactor_cache.Reset(num_faces,args->lazy_form_factors);
+  }
+  const FormFactorColumn *cached = formfactor_cache.Find(j);
+  if (cached != NULL) return *cached;
+
+  // each chunk of rows has its own random stream, so a column is the
+  // same whenever it is recomputed
+  int num_chunks = (num_faces + RADIOSITY_COLUMN_CHUNK_SIZE - 1) / RADIOSITY_COLUMN_CHUNK_SIZE;
+  std::vector<std::vector<std::pair<int,float> > > chunk_factors(num_chunks);
+  ParallelFor(num_chunks, args->num_threads, [&](int c) {
+      Sampler sampler(args->seed, SAMPLER_FORM_FACTORS, j*num_chunks+c);
+      int end = std::min((c+1) * RADIOSITY_COLUMN_CHUNK_SIZE, num_faces);
+      for (int i = c * RADIOSITY_COLUMN_CHUNK_SIZE; i < end; i++) {
+        if (i == j) continue;
+        bool occluded;
+        float factor = ComputeFormFactor(i, j, sampler, occluded);
+        if (factor <= 0 || factor / getArea(i) < args->form_factor_threshold) continue;
+        chunk_factors[c].push_back(std::make_pair(i,factor));
+      }
+    });
+
+  // without the rest of the matrix the rows can't be normalized,
+  // instead normalize so that all of the energy shot from j arrives
+  // somewhere (sum_i F_i,j * A_i = A_j, i.e., row j of the
+  // reciprocal form factors sums to 1)
+  double sum = 0;
+  for (int c = 0; c < num_chunks; c++) {
+    for (unsigned int k = 0; k < chunk_factors[c].size(); k++) {
+      sum += chunk_factors[c][k].second;
+    }
+  }
+  FormFactorColumn &column = formfactor_cache.Insert(j);
+  for (int c = 0; c < num_chunks; c++) {
+    for (unsigned int k = 0; k < chunk_factors[c].size(); k++) {
+      int i = chunk_factors[c][k].first;
+      column.rows.push_back(i);
+      column.values.push_back(chunk_factors[c][k].second / getArea(i) * getArea(j) / sum);
+    }
+  }
+  return column;
+}
 
 
 // ================================================================
 // ================================================================
 
-float Radiosity::Iterate() {
-  if (formfactors == NULL) 
-    ComputeFormFactors();
-  assert (formfactors != NULL);
+// patch i receives light (radiance) from the shooting patch
+void Radiosity::Receive(int i, glm::vec3 new_radiance) {
+  glm::vec3 diffuseColor = mesh->getFace(i)->getMaterial()->getDiffuseColor();
 
-  glm::vec3 toDistribute = getUndistributed(max_undistributed_patch);
+  // calculate the absorption for face i
+  setAbsorbed(i, getAbsorbed(i) + new_radiance - (new_radiance * diffuseColor));
 
-  for (int i=0; i<num_faces; i++) {
+  // now calculate and set radiance and undistributed light
+  new_radiance *= diffuseColor;
 
-    if (i == max_undistributed_patch) {
-      continue;
-    }
+  setRadiance(i, getRadiance(i) + new_radiance);
+  setUndistributed(i, getUndistributed(i) + new_radiance);
+}
 
-    glm::vec3 new_radiance = toDistribute * 
-                             getFormFactor(i, max_undistributed_patch);
 
-    glm::vec3 diffuseColor = mesh->getFace(i)->getMaterial()->getDiffuseColor();
+float Radiosity::Iterate() {
+  if (args->hierarchical_radiosity > 0)
+    return IterateHierarchy();
+  if (args->radiosity_solver == RADIOSITY_SHOOTING)
+    return Shoot();
+  return Sweep();
+}
 
-    // calculate the absorption for face i
-    setAbsorbed(i, getAbsorbed(i) + new_radiance - (new_radiance * diffuseColor));
 
-    // now calculate and set radiance and undistributed light
-    new_radiance *= diffuseColor;
+bool Radiosity::isConverged() const {
+  if (args->hierarchical_radiosity > 0)
+    return hierarchy != NULL && hierarchy->numSplit() == 0 && residual < RADIOSITY_CONVERGED;
+  if (args->radiosity_solver == RADIOSITY_SHOOTING)
+    return total_undistributed < RADIOSITY_CONVERGED;
+  return residual < RADIOSITY_CONVERGED;
+}
+
 
-    setRadiance(i, getRadiance(i) + new_radiance);
-    setUndistributed(i, getUndistributed(i) + new_radiance);
+// progressive refinement: the patch with the most undistributed light
+// shoots it to all of the other patches
+float Radiosity::Shoot() {
+  glm::vec3 toDistribute = getUndistributed(max_undistributed_patch);
+
+  // only the patches that see the shooting patch receive anything
+  if (args->lazy_form_factors > 0) {
+    const FormFactorColumn &column = getFormFactorColumn(max_undistributed_patch);
+    for (unsigned int k = 0; k < column.rows.size(); k++) {
+      Receive(column.rows[k], toDistribute * column.values[k]);
+    }
+  } else {
+    if (formfactors.numPatches() == 0) 
+      ComputeFormFactors();
+    assert (formfactors.numPatches() == num_faces);
+    int end = formfactors.columnEnd(max_undistributed_patch);
+    for (int k = formfactors.columnBegin(max_undistributed_patch); k < end; k++) {
+      int i = formfactors.getRow(k);
+      if (i == max_undistributed_patch) continue;
+      Receive(i, toDistribute * formfactors.getValue(max_undistributed_patch, k));
+    }
   }
 
   // we distributed all light, set to 0
@@ -247,6 +657,139 @@ float Radiosity::Iterate() {
 }
 
 
+// the light arriving at a patch (per channel) from the radiance b of
+// the n patches columns with form factors values
+static void GatherRow(const int *columns, const float *values, int n,
+                      const float *b_r, const float *b_g, const float *b_b,
+                      float gathered[3]) {
+  int k = 0;
+  float r = 0, g = 0, b = 0;
+#ifdef RADIOSITY_SSE
+  // 4 form factors at once
+  __m128 sum_r = _mm_setzero_ps();
+  __m128 sum_g = _mm_setzero_ps();
+  __m128 sum_b = _mm_setzero_ps();
+  for (; k + 4 <= n; k += 4) {
+    const int *c = columns + k;
+    __m128 f = _mm_loadu_ps(values + k);
+    sum_r = _mm_add_ps(sum_r, _mm_mul_ps(f, _mm_setr_ps(b_r[c[0]],b_r[c[1]],b_r[c[2]],b_r[c[3]])));
+    sum_g = _mm_add_ps(sum_g, _mm_mul_ps(f, _mm_setr_ps(b_g[c[0]],b_g[c[1]],b_g[c[2]],b_g[c[3]])));
+    sum_b = _mm_add_ps(sum_b, _mm_mul_ps(f, _mm_setr_ps(b_b[c[0]],b_b[c[1]],b_b[c[2]],b_b[c[3]])));
+  }
+  float lanes[4];
+  _mm_storeu_ps(lanes, sum_r); r = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+  _mm_storeu_ps(lanes, sum_g); g = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+  _mm_storeu_ps(lanes, sum_b); b = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#endif
+  for (; k < n; k++) {
+    r += values[k] * b_r[columns[k]];
+    g += values[k] * b_g[columns[k]];
+    b += values[k] * b_b[columns[k]];
+  }
+  gathered[0] = r;
+  gathered[1] = g;
+  gathered[2] = b;
+}
+
+
+// gathering: solve B_i = E_i + rho_i * sum_j F_i,j B_j by updating
+// every patch from the current radiance of all patches.  Jacobi uses
+// only the radiance of the previous sweep (so the patches can be
+// updated in parallel), Gauss-Seidel uses each new value right away
+float Radiosity::Sweep() {
+  if (formfactors.numPatches() == 0) 
+    ComputeFormFactors();
+  assert (formfactors.numPatches() == num_faces);
+  formfactors.BuildRows();
+
+  // the radiance, emitted light & reflectance as separate arrays per channel
+  std::vector<float> b[3], e[3], rho[3], next[3], incoming[3];
+  for (int c = 0; c < 3; c++) {
+    b[c].resize(num_faces);
+    e[c].resize(num_faces);
+    rho[c].resize(num_faces);
+    incoming[c].resize(num_faces);
+  }
+  for (int i = 0; i < num_faces; i++) {
+    Material *m = mesh->getFace(i)->getMaterial();
+    for (int c = 0; c < 3; c++) {
+      b[c][i] = getRadiance(i)[c];
+      e[c][i] = m->getEmittedColor()[c];
+      rho[c][i] = m->getDiffuseColor()[c];
+    }
+  }
+  const int *columns = formfactors.getRowColumns();
+  const float *values = formfactors.getRowValues();
+
+  if (args->radiosity_solver == RADIOSITY_JACOBI) {
+    for (int c = 0; c < 3; c++) next[c].resize(num_faces);
+    ParallelFor(num_faces, args->num_threads, [&](int i) {
+        int begin = formfactors.rowBegin(i);
+        float gathered[3];
+        GatherRow(columns+begin, values+begin, formfactors.rowEnd(i)-begin,
+                  b[0].data(), b[1].data(), b[2].data(), gathered);
+        for (int c = 0; c < 3; c++) {
+          incoming[c][i] = gathered[c];
+          next[c][i] = e[c][i] + rho[c][i] * gathered[c];
+        }
+      });
+  } else {
+    assert (args->radiosity_solver == RADIOSITY_GAUSS_SEIDEL);
+    for (int c = 0; c < 3; c++) next[c] = b[c];
+    for (int i = 0; i < num_faces; i++) {
+      int begin = formfactors.rowBegin(i);
+      float gathered[3];
+      GatherRow(columns+begin, values+begin, formfactors.rowEnd(i)-begin,
+                next[0].data(), next[1].data(), next[2].data(), gathered);
+      for (int c = 0; c < 3; c++) {
+        incoming[c][i] = gathered[c];
+        next[c][i] = e[c][i] + rho[c][i] * gathered[c];
+      }
+    }
+  }
+
+  // the residual is the (area weighted) change of the radiance, which
+  // is also shown as the undistributed light
+  residual = 0;
+  for (int i = 0; i < num_faces; i++) {
+    glm::vec3 radiance(next[0][i],next[1][i],next[2][i]);
+    glm::vec3 gathered(incoming[0][i],incoming[1][i],incoming[2][i]);
+    glm::vec3 change = radiance - getRadiance(i);
+    glm::vec3 diffuseColor(rho[0][i],rho[1][i],rho[2][i]);
+    residual += glm::length(change) * getArea(i);
+    setRadiance(i, radiance);
+    setAbsorbed(i, gathered - gathered * diffuseColor);
+    setUndistributed(i, glm::abs(change));
+  }
+  findMaxUndistributed();
+  return residual;
+}
+
+
+// hierarchical radiosity: one iteration of the hierarchy (which may
+// split faces of the mesh), then copy the radiance of its leaves (the
+// faces) to the patches
+float Radiosity::IterateHierarchy() {
+  if (hierarchy == NULL)
+    hierarchy = new RadiosityHierarchy(mesh,args,raytracer);
+  residual = hierarchy->Iterate();
+
+  // the faces (& their patch indices) may have changed
+  Allocate();
+  for (int e = 0; e < hierarchy->numElements(); e++) {
+    const HierarchyElement &element = hierarchy->getElement(e);
+    if (!element.isLeaf()) continue;
+    int i = element.face->getRadiosityPatchIndex();
+    assert (mesh->getFace(i) == element.face);
+    setRadiance(i, element.radiance);
+    setAbsorbed(i, element.incoming - element.incoming * element.diffuse);
+    setUndistributed(i, glm::abs(element.change));
+  }
+  findMaxUndistributed();
+  return residual;
+}
+
+
 // =======================================================================================
 // VBO & DISPLAY FUNCTIONS
 // =======================================================================================
@@ -302,9 +845,16 @@ glm::vec3 Radiosity::setupHelperForColor(Face *f, int i, int j) {
   } else if (args->render_mode == RENDER_RADIANCE) {
     return getRadiance(i);
   } else if (args->render_mode == RENDER_FORM_FACTORS) {
-    if (formfactors == NULL) ComputeFormFactors();
     float scale = 0.2 * total_area/getArea(i);
-    float factor = scale * getFormFactor(max_undistributed_patch,i);
+    float factor;
+    if (args->lazy_form_factors > 0) {
+      // by reciprocity, F_max,i = F_i,max * A_i / A_max
+      const FormFactorColumn &column = getFormFactorColumn(max_undistributed_patch);
+      factor = scale * column.getValue(i) * getArea(i) / getArea(max_undistributed_patch);
+    } else {
+      if (formfactors.numPatches() == 0) ComputeFormFactors();
+      factor = scale * getFormFactor(max_undistributed_patch,i);
+    }
     return glm::vec3(factor,factor,factor);
   } else {
     assert(0);
@@ -312,199 +862,3 @@ glm::vec3 Radiosity::setupHelperForColor(Face *f, int i, int j) {
   exit(0);
 }
 
-
-
-void Radiosity::initializeVBOs() {
-  // create a pointer for the vertex & index VBOs
-  glGenBuffers(1, &mesh_tri_verts_VBO);
-  glGenBuffers(1, &mesh_tri_indices_VBO);
-  glGenBuffers(1, &mesh_textured_tri_indices_VBO);
-}
-
-
-void Radiosity::setupVBOs() {
-  HandleGLError("enter radiosity setupVBOs()");
-  mesh_tri_verts.clear();
-  mesh_tri_indices.clear();
-  mesh_textured_tri_indices.clear();
-
-  // initialize the data in each vector
-  int num_faces = mesh->numFaces();
-  assert (num_faces > 0);
-  for (int i = 0; i < num_faces; i++) {
-    Face *f = mesh->getFace(i);
-    Edge *e = f->getEdge();
-    glm::vec3 normal = f->computeNormal();
-
-    double avg_s = 0;
-    double avg_t = 0;
-    glm::vec3 avg_color(0,0,0);
-
-    int start = mesh_tri_verts.size();
-
-    // wireframe is normally black, except when it's the special
-    // patch, then the wireframe is red
-    glm::vec4 wireframe_color(0,0,0,0.5);
-    if (args->render_mode == RENDER_FORM_FACTORS && i == max_undistributed_patch) {
-      wireframe_color = glm::vec4(1,0,0,1);
-    }
-
-    // add the 4 corner vertices
-    for (int j = 0; j < 4; j++) {
-      glm::vec3 pos = ((*f)[j])->get();
-      double s = (*f)[j]->get_s();
-      double t = (*f)[j]->get_t();
-      glm::vec3 color = setupHelperForColor(f,i,j);
-      color = glm::vec3(linear_to_srgb(color.r),
-                        linear_to_srgb(color.g),
-                        linear_to_srgb(color.b));
-      avg_color += 0.25f * color;
-      mesh_tri_verts.push_back(VBOPosNormalColor(pos,normal,
-                                                 glm::vec4(color.r,color.g,color.b,1.0),
-                                                 wireframe_color,
-                                                 s,t));
-      avg_s += 0.25 * s;
-      avg_t += 0.25 * t;
-      e = e->getNext();
-    }
-
-    // the centroid (for wireframe rendering)
-    glm::vec3 centroid = f->computeCentroid();
-    mesh_tri_verts.push_back(VBOPosNormalColor(centroid,normal,
-                                               glm::vec4(avg_color.r,avg_color.g,avg_color.b,1),
-                                               glm::vec4(1,1,1,1),
-                                               avg_s,avg_t));
-
-    if (f->getMaterial()->hasTextureMap()) {
-      mesh_textured_tri_indices.push_back(VBOIndexedTri(start+0,start+1,start+4));
-      mesh_textured_tri_indices.push_back(VBOIndexedTri(start+1,start+2,start+4));
-      mesh_textured_tri_indices.push_back(VBOIndexedTri(start+2,start+3,start+4));
-      mesh_textured_tri_indices.push_back(VBOIndexedTri(start+3,start+0,start+4));
-    } else {
-      mesh_tri_indices.push_back(VBOIndexedTri(start+0,start+1,start+4));
-      mesh_tri_indices.push_back(VBOIndexedTri(start+1,start+2,start+4));
-      mesh_tri_indices.push_back(VBOIndexedTri(start+2,start+3,start+4));
-      mesh_tri_indices.push_back(VBOIndexedTri(start+3,start+0,start+4));
-    }
-  }
-  assert ((int)mesh_tri_verts.size() == num_faces*5);
-  assert ((int)mesh_tri_indices.size() + (int)mesh_textured_tri_indices.size() == num_faces*4);
-  
-  // copy the data to each VBO
-  glBindBuffer(GL_ARRAY_BUFFER,mesh_tri_verts_VBO); 
-  glBufferData(GL_ARRAY_BUFFER,
-	       sizeof(VBOPosNormalColor) * num_faces * 5,
-	       &mesh_tri_verts[0],
-	       GL_STATIC_DRAW); 
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,mesh_tri_indices_VBO); 
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-	       sizeof(VBOIndexedTri) * mesh_tri_indices.size(),
-	       &mesh_tri_indices[0], GL_STATIC_DRAW);
-  if (mesh_textured_tri_indices.size() > 0) {
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,mesh_textured_tri_indices_VBO); 
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-                 sizeof(VBOIndexedTri) * mesh_textured_tri_indices.size(),
-                 &mesh_textured_tri_indices[0], GL_STATIC_DRAW);
-    
-  }
-
-  HandleGLError("radiosity setupVBOs() just before texture");
-
-  // WARNING: this naive VBO implementation only allows a single texture
-  // FIXME: something still buggy about textures
-  int num_textured_materials = 0;
-  for (unsigned int mat = 0; mat < mesh->materials.size(); mat++) {
-    Material *m = mesh->materials[mat];
-    if (m->hasTextureMap()) {
-      // FIXME: old gl...
-      //glBindTexture(GL_TEXTURE_2D,m->getTextureID());
-      num_textured_materials++;
-    }
-  }
-  //assert (num_textured_materials <= 1);
-
-  HandleGLError("leave radiosity setupVBOs()");
-}
-
-
-void Radiosity::drawVBOs() {
-
-  // =====================
-  // DRAW ALL THE POLYGONS
-
-  assert ((int)mesh_tri_indices.size() + (int)mesh_textured_tri_indices.size() == num_faces*4);
-
-  // render with Phong lighting?
-  if (args->render_mode == RENDER_MATERIALS) {
-    // yes
-    glUniform1i(GLCanvas::colormodeID, 1);
-  } else {
-    // no
-    glUniform1i(GLCanvas::colormodeID, 0);
-  }
-
-  // render untextured faces
-  glBindBuffer(GL_ARRAY_BUFFER,mesh_tri_verts_VBO); 
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,mesh_tri_indices_VBO); 
-  glEnableVertexAttribArray(0);
-  glVertexAttribPointer(0,3,GL_FLOAT,GL_FALSE,sizeof(VBOPosNormalColor),(void*)0);
-  glEnableVertexAttribArray(1);
-  glVertexAttribPointer(1,3,GL_FLOAT,GL_FALSE,sizeof(VBOPosNormalColor),(void*)sizeof(glm::vec3) );
-  glEnableVertexAttribArray(2);
-  glVertexAttribPointer(2, 3, GL_FLOAT,GL_FALSE,sizeof(VBOPosNormalColor), (void*)(sizeof(glm::vec3)*2));
-  glEnableVertexAttribArray(3);
-  glVertexAttribPointer(3, 3, GL_FLOAT,GL_FALSE,sizeof(VBOPosNormalColor), (void*)(sizeof(glm::vec3)*2 + sizeof(glm::vec4)));
-  glEnableVertexAttribArray(4);
-  glVertexAttribPointer(4, 3, GL_FLOAT,GL_FALSE,sizeof(VBOPosNormalColor), (void*)(sizeof(glm::vec3)*2 + sizeof(glm::vec4)*2));
-  glDrawElements(GL_TRIANGLES, mesh_tri_indices.size()*3,GL_UNSIGNED_INT, 0);
-  glDisableVertexAttribArray(0);
-  glDisableVertexAttribArray(1);
-  glDisableVertexAttribArray(2);
-  glDisableVertexAttribArray(3);
-  glDisableVertexAttribArray(4);
-
-
-  // render faces with textures
-  if (mesh_textured_tri_indices.size() > 0) {
-
-    // FIXME: there is something buggy with textures still
-    //glUniform1i(GLCanvas::colormodeID, 2);
-
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, GLCanvas::textureID);
-    GLCanvas::mytexture = glGetUniformLocation(GLCanvas::programID, "mytexture");
-    glUniform1i(GLCanvas::mytexture, /*GL_TEXTURE*/0);
-
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,mesh_textured_tri_indices_VBO); 
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0,3,GL_FLOAT,GL_FALSE,sizeof(VBOPosNormalColor),(void*)0);
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1,3,GL_FLOAT,GL_FALSE,sizeof(VBOPosNormalColor),(void*)sizeof(glm::vec3) );
-    glEnableVertexAttribArray(2);
-    glVertexAttribPointer(2, 3, GL_FLOAT,GL_FALSE,sizeof(VBOPosNormalColor), (void*)(sizeof(glm::vec3)*2));
-    glEnableVertexAttribArray(3);
-    glVertexAttribPointer(3, 3, GL_FLOAT,GL_FALSE,sizeof(VBOPosNormalColor), (void*)(sizeof(glm::vec3)*2 + sizeof(glm::vec4)));
-    glEnableVertexAttribArray(4);
-    glVertexAttribPointer(4, 3, GL_FLOAT,GL_FALSE,sizeof(VBOPosNormalColor), (void*)(sizeof(glm::vec3)*2 + sizeof(glm::vec4)*2));
-    glDrawElements(GL_TRIANGLES, mesh_textured_tri_indices.size()*3, GL_UNSIGNED_INT, 0);
-    glDisableVertexAttribArray(0);
-    glDisableVertexAttribArray(1);
-    glDisableVertexAttribArray(2);
-    glDisableVertexAttribArray(3);
-    glDisableVertexAttribArray(4);
-
-    //glUniform1i(GLCanvas::colormodeID, 1);
-  }
-
-  HandleGLError(); 
-}
-
-
-void Radiosity::cleanupVBOs() {
-  glDeleteBuffers(1, &mesh_tri_verts_VBO);
-  glDeleteBuffers(1, &mesh_tri_indices_VBO);
-  glDeleteBuffers(1, &mesh_textured_tri_indices_VBO);
-
-  glDeleteTextures(1, &GLCanvas::textureID);
-}
-
@@ -4,6 +4,9 @@
 #include <glm/glm.hpp>
 
 #include "argparser.h"
+#include "formfactormatrix.h"
+#include "formfactorcache.h"
+#include "indexedmaxheap.h"
 #include "vbo_structs.h"
 
 class Mesh;
@@ -11,6 +14,13 @@ class Face;
 class Vertex;
 class RayTracer;
 class PhotonMapping;
+class Sampler;
+class RadiosityHierarchy;
+
+// the radiosity solution has converged once the light left to shoot
+// (or for the gathering solvers, the change of the last sweep) is
+// less than this
+#define RADIOSITY_CONVERGED 0.001
 
 // ====================================================================
 // ====================================================================
@@ -28,6 +38,14 @@ public:
   void Reset();
   void Cleanup();
   void ComputeFormFactors();
+  // subdivide the mesh, the new patches start with the solution of
+  // their parent & the form factors are estimated from the parents
+  void Subdivision();
+  // with -radiosity_cache: read the form factors & the converged
+  // solution saved by an earlier run with the same scene & settings
+  // (false if there are none), or save them
+  bool ReadCache() { return ReadCacheFile(true); }
+  void WriteCache() { WriteCacheFile(true); }
   void setRayTracer(RayTracer *r) { raytracer = r; }
   void setPhotonMapping(PhotonMapping *pm) { photon_mapping = pm; }
 
@@ -43,8 +61,8 @@ public:
     // F_i,j radiant energy leaving i arriving at j
     assert (i >= 0 && i < num_faces);
     assert (j >= 0 && j < num_faces);
-    assert (formfactors != NULL);
-    return formfactors[i*num_faces+j]; }
+    assert (formfactors.numPatches() == num_faces);
+    return formfactors.getFormFactor(i,j); }
   float getArea(int i) const {
     assert (i >= 0 && i < num_faces);
     return area[i]; }
@@ -60,26 +78,21 @@ public:
   
   // =========
   // MODIFIERS
+  // one step of the -radiosity_solver (or of hierarchical radiosity),
+  // returns the light left to distribute (shooting) or the residual
+  // of the sweep (gathering & hierarchical)
   float Iterate();
-  void setFormFactor(int i, int j, float value) { 
-    assert (i >= 0 && i < num_faces);
-    assert (j >= 0 && j < num_faces);
-    assert (formfactors != NULL);
-    formfactors[i*num_faces+j] = value; }
-  void normalizeFormFactors(int i) {
-    float sum = 0;
-    int j;
-    for (j = 0; j < num_faces; j++) {
-      sum += getFormFactor(i,j); }
-    if (sum == 0) return;
-    for (j = 0; j < num_faces; j++) {
-      setFormFactor(i,j,getFormFactor(i,j)/sum); } }
+  bool isConverged() const;
   void setArea(int i, float value) {
     assert (i >= 0 && i < num_faces);
     area[i] = value; }
   void setUndistributed(int i, glm::vec3 value) { 
     assert (i >= 0 && i < num_faces);
-    undistributed[i] = value; }
+    undistributed[i] = value;
+    // keep the running total & the heap of undistributed power current
+    float power = glm::length(value) * getArea(i);
+    total_undistributed += power - undistributed_heap.getKey(i);
+    undistributed_heap.Update(i,power); }
   void findMaxUndistributed();
   void setAbsorbed(int i, glm::vec3 value) { 
     assert (i >= 0 && i < num_faces);
@@ -91,6 +104,18 @@ public:
 private:
 
   glm::vec3 setupHelperForColor(Face *f, int i, int j);
+  float ComputeFormFactor(int i, int j, Sampler &sampler, bool &occluded) const;
+  float ReuseFormFactor(int i, int j, Sampler &sampler, bool &occluded) const;
+  const FormFactorColumn& getFormFactorColumn(int j);
+  void Receive(int i, glm::vec3 new_radiance);
+  void Allocate();
+  bool useCache() const;
+  uint64_t getCacheKey() const;
+  bool ReadCacheFile(bool solution);
+  void WriteCacheFile(bool solution);
+  float Shoot();
+  float Sweep();
+  float IterateHierarchy();
 
   // ==============
   // REPRESENTATION
@@ -100,9 +125,20 @@ private:
   RayTracer *raytracer;
   PhotonMapping *photon_mapping;
 
-  // a nxn matrix
+  // a sparse nxn matrix (empty until computed)
   // F_i,j radiant energy leaving i arriving at j
-  float *formfactors;
+  FormFactorMatrix formfactors;
+  // after a subdivision (until the form factors are computed), the
+  // form factors of the patches before & the parent of each patch
+  FormFactorMatrix parent_formfactors;
+  std::vector<int> parent;
+  std::vector<float> parent_area;
+  std::vector<glm::vec3> parent_centroid;
+  // or, with -lazy_form_factors, the recently used columns
+  FormFactorCache formfactor_cache;
+  // or, with -hierarchical_radiosity, the links between the elements
+  // of the hierarchy (NULL until the first iteration)
+  RadiosityHierarchy *hierarchy;
 
   // length n vectors
   float *area;
@@ -111,8 +147,11 @@ private:
   glm::vec3 *radiance;      // energy per unit area
 
   int max_undistributed_patch;  // the patch with the most undistributed energy
-  float total_undistributed;    // the total amount of undistributed light
+  double total_undistributed;   // the total amount of undistributed light
   float total_area;             // the total area of the scene
+  float residual;               // the change of the last gathering sweep
+  // the patches by undistributed energy (times area)
+  IndexedMaxHeap undistributed_heap;
 
   // VBOs
   GLuint mesh_tri_verts_VBO;
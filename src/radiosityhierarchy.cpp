@@ -0,0 +1,302 @@
+#include <cassert>
+#include <iostream>
+
+#include "radiosityhierarchy.h"
+#include "argparser.h"
+#include "mesh.h"
+#include "face.h"
+#include "raytracer.h"
+#include "utils.h"
+#include "parallel.h"
+
+// ==================================================================
+// CONSTRUCTOR
+// ==================================================================
+
+RadiosityHierarchy::RadiosityHierarchy(Mesh *m, ArgParser *a, RayTracer *r) {
+  mesh = m;
+  args = a;
+  raytracer = r;
+  num_split = 0;
+  sampler = Sampler(args->seed, SAMPLER_FORM_FACTORS, -1);
+
+  // one root element per face, only the quads can be split
+  num_roots = mesh->numFaces();
+  float emitted_power = 0;
+  for (int i = 0; i < num_roots; i++) {
+    mesh->getFace(i)->setRadiosityPatchIndex(i);
+    AddElement(mesh->getFace(i), 0, i < mesh->numSubdividedQuads());
+    emitted_power += glm::length(elements[i].emitted) * elements[i].area;
+  }
+  min_link_power = args->hierarchical_radiosity * emitted_power;
+
+  // link every pair of roots (at the level the emitted light needs)
+  for (int i = 0; i < num_roots; i++) {
+    for (int j = 0; j < num_roots; j++) {
+      if (i != j) Refine(i,j);
+    }
+  }
+  std::cout << " radiosity hierarchy: " << numElements() << " elements, "
+            << numLinks() << " links" << std::endl;
+}
+
+
+void RadiosityHierarchy::AddElement(Face *f, int level, bool can_split) {
+  HierarchyElement e;
+  e.face = f;
+  e.first_child = -1;
+  e.level = level;
+  e.can_split = can_split;
+  for (int c = 0; c < 4; c++) {
+    e.corners[c] = (*f)[c]->get();
+  }
+  e.normal = f->computeNormal();
+  e.centroid = f->computeCentroid();
+  e.area = f->getArea();
+  e.emitted = f->getMaterial()->getEmittedColor();
+  e.diffuse = f->getMaterial()->getDiffuseColor();
+  e.radiance = e.emitted;
+  e.gathered = e.incoming = e.change = glm::vec3(0,0,0);
+  e.link_sum = 0;
+  elements.push_back(e);
+}
+
+
+int RadiosityHierarchy::numLinks() const {
+  int answer = 0;
+  for (unsigned int e = 0; e < elements.size(); e++) {
+    answer += elements[e].links.size();
+  }
+  return answer;
+}
+
+
+// ==================================================================
+// REFINEMENT
+// ==================================================================
+
+// split the face of a leaf element in the mesh, the children start
+// with the radiance of the parent
+void RadiosityHierarchy::Split(int e) {
+  assert (elements[e].isLeaf() && elements[e].can_split);
+  Face *f = elements[e].face;
+  int i = f->getRadiosityPatchIndex();
+  assert (mesh->getFace(i) == f);
+  Face *children[4];
+  mesh->SubdivideQuad(i,children);
+  int n = mesh->numSubdividedQuads();
+  children[0]->setRadiosityPatchIndex(i);
+  for (int c = 1; c < 4; c++) {
+    children[c]->setRadiosityPatchIndex(n-4+c);
+  }
+
+  int level = elements[e].level + 1;
+  glm::vec3 radiance = elements[e].radiance;
+  elements[e].face = NULL;
+  elements[e].first_child = elements.size();
+  for (int c = 0; c < 4; c++) {
+    AddElement(children[c],level,true);
+    elements.back().radiance = radiance;
+  }
+  num_split++;
+}
+
+
+// a quick (unoccluded) estimate of F_r,s from the centroids, treating
+// s as a disk (so it stays bounded for nearby elements)
+float RadiosityHierarchy::EstimateFormFactor(int r, int s) const {
+  const HierarchyElement &er = elements[r];
+  const HierarchyElement &es = elements[s];
+  glm::vec3 v = es.centroid - er.centroid;
+  float distance2 = glm::dot(v,v);
+  if (distance2 == 0) return 0;
+  v /= sqrt(distance2);
+  float cos_r = glm::dot(er.normal,v);
+  float cos_s = -glm::dot(es.normal,v);
+  if (cos_r <= 0 || cos_s <= 0) return 0;
+  return es.area * cos_r * cos_s / (M_PI * distance2 + es.area);
+}
+
+
+bool RadiosityHierarchy::ShouldRefine(int r, int s, float estimate) const {
+  const HierarchyElement &er = elements[r];
+  const HierarchyElement &es = elements[s];
+  bool r_splits = !er.isLeaf() || (er.can_split && er.level < HIERARCHY_MAX_LEVEL);
+  bool s_splits = !es.isLeaf() || (es.can_split && es.level < HIERARCHY_MAX_LEVEL);
+  if (!r_splits && !s_splits) return false;
+  return estimate * er.area * glm::length(es.radiance) > min_link_power;
+}
+
+
+// link r to s, or if the link would carry too much energy, link the
+// children of the larger one instead
+void RadiosityHierarchy::Refine(int r, int s) {
+  // can the elements see each other at all?
+  bool facing_r = false, facing_s = false;
+  for (int c = 0; c < 4; c++) {
+    if (glm::dot(elements[r].normal,elements[s].corners[c]-elements[r].centroid) > EPSILON) facing_r = true;
+    if (glm::dot(elements[s].normal,elements[r].corners[c]-elements[s].centroid) > EPSILON) facing_s = true;
+  }
+  if (!facing_r || !facing_s) return;
+
+  float estimate = EstimateFormFactor(r,s);
+  if (ShouldRefine(r,s,estimate)) {
+    const HierarchyElement &er = elements[r];
+    const HierarchyElement &es = elements[s];
+    bool r_splits = !er.isLeaf() || (er.can_split && er.level < HIERARCHY_MAX_LEVEL);
+    bool s_splits = !es.isLeaf() || (es.can_split && es.level < HIERARCHY_MAX_LEVEL);
+    if (r_splits && (!s_splits || er.area >= es.area)) {
+      if (elements[r].isLeaf()) Split(r);
+      int first = elements[r].first_child;
+      for (int c = 0; c < 4; c++) Refine(first+c,s);
+    } else {
+      if (elements[s].isLeaf()) Split(s);
+      int first = elements[s].first_child;
+      for (int c = 0; c < 4; c++) Refine(r,first+c);
+    }
+    return;
+  }
+  HierarchyLink link;
+  link.source = s;
+  link.form_factor = ComputeFormFactor(r,s);
+  if (link.form_factor > 0) elements[r].links.push_back(link);
+}
+
+
+// ==================================================================
+// FORM FACTORS
+// ==================================================================
+
+glm::vec3 RadiosityHierarchy::RandomPoint(int e) {
+  // bilinear interpolation of the corners
+  const glm::vec3 *c = elements[e].corners;
+  float u = sampler.rand();
+  float v = sampler.rand();
+  return (1-u)*(1-v)*c[0] + u*(1-v)*c[1] + u*v*c[2] + (1-u)*v*c[3];
+}
+
+
+// F_r,s like Radiosity::ComputeFormFactor, each of the point pairs
+// stands for 1/n of the area of s
+float RadiosityHierarchy::ComputeFormFactor(int r, int s) {
+  const HierarchyElement &er = elements[r];
+  const HierarchyElement &es = elements[s];
+  int n = std::max(1,args->num_form_factor_samples);
+  float sample_area = es.area / n;
+  float factor = 0;
+  for (int i = 0; i < n; i++) {
+    glm::vec3 r_pt = er.centroid;
+    glm::vec3 s_pt = es.centroid;
+    if (n > 1) {
+      r_pt = RandomPoint(r);
+      s_pt = RandomPoint(s);
+    }
+    glm::vec3 v = s_pt - r_pt;
+    float distance2 = glm::dot(v,v);
+    if (distance2 == 0) continue;
+    v /= sqrt(distance2);
+    float cos_r = glm::dot(er.normal,v);
+    float cos_s = -glm::dot(es.normal,v);
+    if (cos_r <= 0 || cos_s <= 0) continue;
+    factor += sample_area * cos_r * cos_s / (M_PI * distance2 + sample_area);
+  }
+  if (factor == 0) return 0;
+
+  // the fraction of the shadow rays from s to r that aren't blocked
+  if (args->num_shadow_samples > 0) {
+    int visible = 0;
+    for (int i = 0; i < args->num_shadow_samples; i++) {
+      glm::vec3 r_pt = er.centroid;
+      glm::vec3 s_pt = es.centroid;
+      if (args->num_shadow_samples > 1) {
+        r_pt = RandomPoint(r);
+        s_pt = RandomPoint(s);
+      }
+      Ray ray(s_pt, glm::normalize(r_pt - s_pt));
+      float distance = glm::length(r_pt - s_pt);
+      if (!raytracer->Occluded(ray, distance - EPSILON, true)) visible++;
+    }
+    factor *= visible / float(args->num_shadow_samples);
+  }
+  return factor;
+}
+
+
+// ==================================================================
+// SOLVING
+// ==================================================================
+
+// push the light gathered above down to the leaves & pull the area
+// averaged radiance back up
+glm::vec3 RadiosityHierarchy::PushPull(int e, const glm::vec3 &down, float down_sum) {
+  HierarchyElement &element = elements[e];
+  glm::vec3 incoming = element.gathered + down;
+  float sum = element.link_sum + down_sum;
+  if (element.isLeaf()) {
+    // normalize the form factors of the leaf to sum to 1
+    if (sum > 0) incoming /= sum;
+    glm::vec3 radiance = element.emitted + element.diffuse * incoming;
+    element.incoming = incoming;
+    element.change = radiance - element.radiance;
+    element.radiance = radiance;
+    return radiance;
+  }
+  glm::vec3 total(0,0,0);
+  float area = 0;
+  for (int c = 0; c < 4; c++) {
+    int child = element.first_child + c;
+    total += elements[child].area * PushPull(child,incoming,sum);
+    area += elements[child].area;
+  }
+  elements[e].radiance = total / area;
+  return elements[e].radiance;
+}
+
+
+float RadiosityHierarchy::Iterate() {
+  // gather over the links of every element (from the radiance of the
+  // last iteration)
+  ParallelFor(elements.size(), args->num_threads, [&](int e) {
+      glm::vec3 gathered(0,0,0);
+      float sum = 0;
+      const std::vector<HierarchyLink> &links = elements[e].links;
+      for (unsigned int k = 0; k < links.size(); k++) {
+        gathered += links[k].form_factor * elements[links[k].source].radiance;
+        sum += links[k].form_factor;
+      }
+      elements[e].gathered = gathered;
+      elements[e].link_sum = sum;
+    });
+
+  float change = 0;
+  for (int r = 0; r < num_roots; r++) {
+    PushPull(r,glm::vec3(0,0,0),0);
+  }
+  for (unsigned int e = 0; e < elements.size(); e++) {
+    if (elements[e].isLeaf()) change += glm::length(elements[e].change) * elements[e].area;
+  }
+
+  // check the links again with the new radiance (the elements added
+  // while refining have no links yet)
+  num_split = 0;
+  int num_elements = elements.size();
+  for (int r = 0; r < num_elements; r++) {
+    std::vector<HierarchyLink> links;
+    links.swap(elements[r].links);
+    for (unsigned int k = 0; k < links.size(); k++) {
+      int s = links[k].source;
+      if (ShouldRefine(r,s,EstimateFormFactor(r,s))) {
+        Refine(r,s);
+      } else {
+        elements[r].links.push_back(links[k]);
+      }
+    }
+  }
+  if (num_split > 0) {
+    std::cout << " radiosity hierarchy: split " << num_split << ", "
+              << numElements() << " elements, " << numLinks() << " links" << std::endl;
+  }
+  return change;
+}
+
+// ==================================================================
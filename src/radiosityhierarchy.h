@@ -0,0 +1,121 @@
+#ifndef _RADIOSITY_HIERARCHY_H_
+#define _RADIOSITY_HIERARCHY_H_
+
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "sampler.h"
+
+class Mesh;
+class Face;
+class ArgParser;
+class RayTracer;
+
+// an element is split at most this many times (4^6 = 4096 leaves
+// per patch of the mesh it started as)
+#define HIERARCHY_MAX_LEVEL 6
+
+// ====================================================================
+// A light transport link: the receiving element gathers the
+// radiance of the source element times the form factor F_r,s.
+
+struct HierarchyLink {
+  int source;
+  float form_factor;
+};
+
+// ====================================================================
+// A node of the quadtree over one patch of the mesh.  The leaves are
+// the faces of the mesh (the radiosity patches), the interior
+// elements were faces before they were split.
+
+struct HierarchyElement {
+  Face *face;           // leaf: the face of the mesh, interior: NULL
+  int first_child;      // the 4 children are consecutive, -1 for a leaf
+  int level;            // 0 for the patches the hierarchy started with
+  bool can_split;       // only quads (not rasterized primitives) are split
+  glm::vec3 corners[4];
+  glm::vec3 normal;
+  glm::vec3 centroid;
+  float area;
+  glm::vec3 emitted;
+  glm::vec3 diffuse;
+  glm::vec3 radiance;   // average over the element (B)
+  glm::vec3 gathered;   // the light gathered over the links at this level
+  float link_sum;       // the sum of the form factors of the links
+  glm::vec3 incoming;   // leaf: the light gathered at all levels above & here
+  glm::vec3 change;     // leaf: the change of the radiance in the last iteration
+  std::vector<HierarchyLink> links;
+  bool isLeaf() const { return first_child == -1; }
+};
+
+// ====================================================================
+// ====================================================================
+// Hierarchical radiosity (Hanrahan, Salzman & Aupperle 1991).  Rather
+// than a form factor for every pair of patches, each pair of patches
+// of the mesh is linked at the coarsest level where the link carries
+// little enough energy (the form factor estimate times the receiver
+// area times the source radiance is at most the -hierarchical_radiosity
+// fraction of the emitted power).  Otherwise the larger of the two is
+// split, both the element and its face in the mesh.  The light is
+// gathered over the links at every level and then pushed down to the
+// leaves and pulled (area averaged) back up.  Like the normalized rows
+// of the full matrix, the light gathered by a leaf is divided by the
+// sum of the form factors of all of its links (at every level).
+// After each iteration the
+// links are checked again against the new radiance, so the mesh is
+// refined only where the solution needs it.
+
+class RadiosityHierarchy {
+
+public:
+
+  // ========================
+  // CONSTRUCTOR
+  // the hierarchy starts with the current faces of the mesh
+  RadiosityHierarchy(Mesh *m, ArgParser *a, RayTracer *r);
+
+  // =========
+  // ACCESSORS
+  int numElements() const { return elements.size(); }
+  const HierarchyElement& getElement(int e) const { return elements[e]; }
+  int numLinks() const;
+  // the number of elements split by the last iteration
+  int numSplit() const { return num_split; }
+
+  // =========
+  // SOLVING
+  // gather, push/pull & refine, returns the (area weighted) change of
+  // the leaf radiance.  The faces of the mesh may change (the radiosity
+  // patch indices of the faces are out of date afterwards)
+  float Iterate();
+
+private:
+
+  // HELPER FUNCTIONS
+  void AddElement(Face *f, int level, bool can_split);
+  void Split(int e);
+  float EstimateFormFactor(int r, int s) const;
+  float ComputeFormFactor(int r, int s);
+  bool ShouldRefine(int r, int s, float estimate) const;
+  void Refine(int r, int s);
+  glm::vec3 PushPull(int e, const glm::vec3 &down, float down_sum);
+  glm::vec3 RandomPoint(int e);
+
+  // ==============
+  // REPRESENTATION
+  Mesh *mesh;
+  ArgParser *args;
+  RayTracer *raytracer;
+  std::vector<HierarchyElement> elements;
+  int num_roots;
+  // the refinement threshold, in units of energy
+  float min_link_power;
+  int num_split;
+  Sampler sampler;
+};
+
+// ====================================================================
+// ====================================================================
+
+#endif
@@ -1,5 +1,3 @@
-#include "glCanvas.h"
-
 #include "raytracer.h"
 #include "material.h"
 #include "argparser.h"
@@ -9,57 +7,118 @@
 #include "face.h"
 #include "primitive.h"
 #include "photon_mapping.h"
+#include "bvh.h"
 
 
+// ===========================================================================
+// CONSTRUCTOR & DESTRUCTOR
+
+RayTracer::RayTracer(Mesh *m, ArgParser *a) {
+  mesh = m;
+  args = a;
+  background_material = new Material("", glm::vec3(0.0f), glm::vec3(0.0f), glm::vec3(0.0f), 0.0f);
+  UpdateLightning();
+}
+
+RayTracer::~RayTracer() {
+  delete background_material;
+}
+
+// ===========================================================================
+// must be called whenever the lightning segments of the mesh change
+
+void RayTracer::UpdateLightning() {
+  lightning_grid.Build(mesh->lightning_bolt);
+  lightning_tree.Build(mesh->lightning_bolt);
+  UpdateLightningRange(0,0);
+}
+
+void RayTracer::UpdateLightningRange(int first, int last) {
+  range_first = first;
+  range_last = last;
+  lightning_range_tree.Build(mesh->lightning_bolt,first,last);
+}
+
 // ===========================================================================
 // casts a single ray through the scene geometry and finds the closest hit
 bool RayTracer::CastRay(const Ray &ray, Hit &h, bool use_rasterized_patches) const {
-  bool answer = false;
+  // intersect the original quads and the primitives (either the
+  // patches, or the original primitives) through the hierarchy
+  const BVH *bvh = mesh->getBVH(use_rasterized_patches);
+  assert (bvh != NULL);
+  return bvh->intersect(ray,h,args->intersect_backfacing);
+}
 
-  // intersect each of the quads
-  for (int i = 0; i < mesh->numOriginalQuads(); i++) {
-    Face *f = mesh->getOriginalQuad(i);
-    if (f->intersect(ray,h,args->intersect_backfacing)) answer = true;
-  }
+// ===========================================================================
+// any hit closer than tmax blocks the ray
+bool RayTracer::Occluded(const Ray &ray, float tmax, bool use_rasterized_patches) const {
+  const BVH *bvh = mesh->getBVH(use_rasterized_patches);
+  assert (bvh != NULL);
+  return bvh->occluded(ray,tmax,args->intersect_backfacing);
+}
 
-  // intersect each of the primitives (either the patches, or the original primitives)
-  if (use_rasterized_patches) {
-    for (int i = 0; i < mesh->numRasterizedPrimitiveFaces(); i++) {
-      Face *f = mesh->getRasterizedPrimitiveFace(i);
-      if (f->intersect(ray,h,args->intersect_backfacing)) answer = true;
-    }
-  } else {
-    int num_primitives = mesh->numPrimitives();
-    for (int i = 0; i < num_primitives; i++) {
-      if (mesh->getPrimitive(i)->intersect(ray,h)) answer = true;
+// ===========================================================================
+// the light from a point of the lightning at the hit (if shadows are
+// on, nothing may be in the way)
+glm::vec3 RayTracer::ShadeLightningPoint(const Ray &ray, const Hit &hit, const glm::vec3 &point,
+                                         const glm::vec3 &lightPoint, const glm::vec3 &lightColor,
+                                         bool shadows) const {
+  float distToLightPoint = glm::length(lightPoint - point);
+  glm::vec3 dirToLightPoint = glm::normalize(lightPoint - point);
+
+  if (shadows) {
+    // cast a ray towards the sample light point
+    Ray shadowRay(point, dirToLightPoint);
+
+    if (Occluded(shadowRay, distToLightPoint, false)) {
+      // we got a hit in the direction of shadowRay, keep in shadow
+      if (RayTree::isActivated()) {
+        // the visualization needs the closest blocker
+        Hit shadowHit;
+        CastRay(shadowRay, shadowHit, false);
+        RayTree::AddShadowSegment(shadowRay, 0.0f, shadowHit.getT());
+      }
+      return glm::vec3(0.0f);
     }
   }
-  return answer;
+
+  // no hit, add light contribution
+  glm::vec3 myLightColor = lightColor / float(M_PI*distToLightPoint*distToLightPoint);
+  return hit.getMaterial()->Shade(ray,hit,dirToLightPoint,myLightColor,args);
 }
 
 // ===========================================================================
 // does the recursive (shadow rays & recursive rays) work
-glm::vec3 RayTracer::TraceRay(Ray &ray, Hit &hit, int bounce_count) const {
+glm::vec3 RayTracer::TraceRay(Ray &ray, Hit &hit, Sampler &sampler, int bounce_count) const {
+  return TraceRay(ray, hit, sampler, bounce_count, true, 0, mesh->lightning_bolt.numSegments());
+}
+
+// the light is the sum of the light of the scene (the background,
+// lights, indirect light) & of each lightning segment, these can be
+// traced separately & added up
+glm::vec3 RayTracer::TraceRay(Ray &ray, Hit &hit, Sampler &sampler, int bounce_count,
+                              bool scene, int first_segment, int last_segment) const {
 
   // First cast a ray and see if we hit anything.
   hit = Hit();
   bool intersect = CastRay(ray,hit,false);
     
-  glm::vec3 answer, normal, point;
+  glm::vec3 answer(0.0f), normal, point;
   Material *m;
 
   // if there is no intersection, simply return the background color
   if (intersect == false) {
-    answer = glm::vec3(srgb_to_linear(mesh->background_color.r),
-                     srgb_to_linear(mesh->background_color.g),
-                     srgb_to_linear(mesh->background_color.b));
+    if (scene) {
+      answer = glm::vec3(srgb_to_linear(mesh->background_color.r),
+                         srgb_to_linear(mesh->background_color.g),
+                         srgb_to_linear(mesh->background_color.b));
+    }
 
     // need to fake some other values for the sake of rendering lightning
     normal = glm::vec3(0.0f);
     point = ray.pointAtParameter(1.0f);
 
-    // NOTE: need to delete m if intersect == false at end
-    m = new Material("", glm::vec3(0.0f), glm::vec3(0.0f), glm::vec3(0.0f), 0.0f);
+    m = background_material;
   }
   else {
     normal = hit.getNormal();
@@ -71,16 +130,16 @@ glm::vec3 RayTracer::TraceRay(Ray &ray, Hit &hit, int bounce_count) const {
 
   // rays coming from the light source are set to white, don't bother to ray trace further.
   if (glm::length(m->getEmittedColor()) > 0.001) {
-    return glm::vec3(1,1,1);
+    return scene ? glm::vec3(1,1,1) : glm::vec3(0,0,0);
   } 
   
   // ----------------------------------------------
   //  start with the indirect light (ambient light)
   glm::vec3 diffuse_color = m->getDiffuseColor(hit.get_s(),hit.get_t());
-  if (args->gather_indirect && intersect) {
+  if (scene && args->gather_indirect && intersect) {
     // photon mapping for more accurate indirect light
     answer = diffuse_color * (photon_mapping->GatherIndirect(point, normal, ray.getDirection()) + args->ambient_light);
-  } else if (intersect) {
+  } else if (scene && intersect) {
     // the usual ray tracing hack for indirect light
     answer = diffuse_color * args->ambient_light;
   }      
@@ -88,7 +147,8 @@ glm::vec3 RayTracer::TraceRay(Ray &ray, Hit &hit, int bounce_count) const {
   // ---------------------------------
   // render the lightning segment by segment
 
-  const int numSegments = mesh->lightning_segments.size();
+  const LightningBolt &bolt = mesh->lightning_bolt;
+  assert (first_segment >= 0 && first_segment <= last_segment && last_segment <= bolt.numSegments());
 
   // some parameters of the lightning
   glm::vec3 lightColor(0.6f, 1.0f, 0.7f);
@@ -98,110 +158,112 @@ glm::vec3 RayTracer::TraceRay(Ray &ray, Hit &hit, int bounce_count) const {
   float maxChannelContribution = 1.0f;
   float maxGlowContribution = 0.08f;
 
-  // find the plane which the lightning lies in. Assumes at least 2 segments exist
-  glm::vec3 p0 = mesh->lightning_segments[0].getStart();
-  glm::vec3 p1 = mesh->lightning_segments[0].getEnd();
-  glm::vec3 p2 = mesh->lightning_segments[1].getStart();
-  glm::vec3 p3 = mesh->lightning_segments[1].getEnd();
-  glm::vec3 n = glm::normalize(glm::cross(p1 - p0, p3 - p2));
+  // solve for the intersection of ray and the plane of the lightning,
+  // only the segments whose glow reaches that point are evaluated
+  if (lightning_grid.isValid()) {
+    glm::vec3 plane_point = lightning_grid.intersectPlane(ray);
+    const int *nearby;
+    int numNearby;
+    lightning_grid.getSegments(plane_point, nearby, numNearby);
 
-  // and solve for the intersection of ray and plane
-  float t = glm::dot(p0 - ray.getOrigin(), n) / glm::dot(ray.getDirection(), n);
+    for (int k=0; k<numNearby; k++) {
+      int segment = nearby[k];
+      if (segment < first_segment || segment >= last_segment) continue;
+      glm::vec3 startPoint = bolt.getStart(segment);
+      glm::vec3 endPoint = bolt.getEnd(segment);
+      lightningWidth = bolt.getRadius(segment);
+      glowWidth = bolt.getGlowWidth(segment);
 
-  glm::vec3 plane_point = ray.getOrigin() + t * ray.getDirection();
+      // -------------------------------------------------
+      // change color based on distance from segment
 
-  for (int i=0; i<numSegments; i++) {
+      glm::vec3 segment_dir = glm::normalize(endPoint - startPoint);
 
-    glm::vec3 startPoint = mesh->lightning_segments[i].getStart();
-    glm::vec3 endPoint = mesh->lightning_segments[i].getEnd();
-    lightningWidth = mesh->lightning_segments[i].getRadius();
-    glowWidth = lightningWidth * 3.0;
-    if (glowWidth < 0.08) glowWidth = 0.08;
+      // get the closest point on the segment to the line
+      float line_t = glm::dot(plane_point - startPoint, segment_dir);
+      line_t = std::max(line_t, 0.0f);
+      line_t = std::min(line_t, glm::length(endPoint - startPoint));
 
-    // -------------------------------------------------
-    // change color based on distance from segment
+      // calculate the distance from plane intersection to that point
+      float dist = glm::distance(plane_point, startPoint + line_t * segment_dir);
 
-    glm::vec3 segment_dir = glm::normalize(endPoint - startPoint);
+      // now add the contribution based on distance
+      float contribution = std::exp(-std::pow(2.0 * dist / lightningWidth, sharpness));
 
-    // get the closest point on the segment to the line
-    float line_t = glm::dot(plane_point - startPoint, segment_dir);
-    line_t = std::max(line_t, 0.0f);
-    line_t = std::min(line_t, glm::length(endPoint - startPoint));
+      // clamp each color separately to the max contribution
+      glm::vec3 result = maxChannelContribution * contribution * lightColor;
 
-    // calculate the distance from plane intersection to that point
-    float dist = glm::distance(plane_point, startPoint + line_t * segment_dir);
+      answer += result;
 
-    // now add the contribution based on distance
-    float contribution = std::exp(-std::pow(2.0 * dist / lightningWidth, sharpness));
+      // now add the glow component
+      contribution = std::exp(-std::pow(dist / glowWidth, 2.0f));
+      result = maxGlowContribution * contribution * lightColor;
 
-    // clamp each color separately to the max contribution
-    glm::vec3 result = maxChannelContribution * contribution * lightColor;
+      answer += result;
+    }
+  }
 
-    answer += result;
+  // ------------------------------------------------
+  // add lighting contribution from each segment as a point light
 
-    // now add the glow component
-    contribution = std::exp(-std::pow(dist / glowWidth, 2.0f));
-    result = maxGlowContribution * contribution * lightColor;
+  // (the segments without a tree are lit one by one)
+  const LightningTree *tree = NULL;
+  if (first_segment == 0 && last_segment == bolt.numSegments()) {
+    tree = &lightning_tree;
+  } else if (first_segment == range_first && last_segment == range_last) {
+    tree = &lightning_range_tree;
+  }
+  bool sample_lights = args->num_light_samples > 0 && tree != NULL && tree->isValid();
+  if (intersect && sample_lights) {
+    // a fixed number of segments (and shadow rays), chosen by their
+    // (estimated) contribution to this point
+    for (int j=0; j<args->num_light_samples; j++) {
+      int segment;
+      float pdf;
+      // (a walk can end at a node whose children are both behind the
+      // surface, that sample is zero, the others still count)
+      if (!tree->Sample(point, normal, sampler, segment, pdf)) continue;
+      glm::vec3 startPoint = bolt.getStart(segment);
+      glm::vec3 endPoint = bolt.getEnd(segment);
+      glm::vec3 lightPoint = 0.5f * (startPoint + endPoint);
+      // soft shadows by uniformly sampling along the segment
+      if (args->num_shadow_samples > 1) {
+        float alpha = sampler.rand();
+        lightPoint = alpha * startPoint + (1 - alpha) * endPoint;
+      }
+      answer += ShadeLightningPoint(ray, hit, point, lightPoint, lightColor, args->num_shadow_samples >= 1) /
+        (pdf * args->num_light_samples);
+    }
+  }
 
-    answer += result;
+  for (int i=first_segment; i<last_segment && intersect && !sample_lights; i++) {
 
-    // ------------------------------------------------
-    // add lighting contribution from each segment as a point light
+    glm::vec3 startPoint = bolt.getStart(i);
+    glm::vec3 endPoint = bolt.getEnd(i);
 
-    if (intersect) {
+    // get the midpoint of the segment to use as a light
+    glm::vec3 lightPoint = 0.5f * (startPoint + endPoint);
+      
+    // soft shadows by uniformly sampling along the segment
+    if (args->num_shadow_samples >= 1) {
+      glm::vec3 shadedColor(0.0f);
 
-      glm::vec3 myLightColor;
+      for (int j=0; j<args->num_shadow_samples; j++) {
 
-      // get the midpoint of the segment to use as a light
-      glm::vec3 lightPoint = 0.5f * (startPoint + endPoint);
-      glm::vec3 dirToLightPoint = glm::normalize(lightPoint - point);
-      float distToLightPoint = glm::length(lightPoint - point);
-      
-      // soft shadows by uniformly sampling along the segment
-      if (args->num_shadow_samples >= 1) {
-        glm::vec3 shadedColor(0.0f);
-
-        for (int j=0; j<args->num_shadow_samples; j++) {
-
-          // random sampling for soft shadows
-          if (args->num_shadow_samples > 1) {
-            float alpha = args->rand();
-            lightPoint = alpha * startPoint + (1 - alpha) * endPoint;
-          }
-
-          distToLightPoint = glm::length(lightPoint - point);
-          dirToLightPoint = glm::normalize(lightPoint - point);
-
-          // cast a ray towards the sample light point
-          Hit shadowHit;
-          Ray shadowRay(point, dirToLightPoint);
-          bool didHit = CastRay(shadowRay, shadowHit, false);
-
-          float distToLightPoint = glm::length(lightPoint-point);
-
-          if (didHit && shadowHit.getT() < distToLightPoint) {
-            // we got a hit in the direction of shadowRay, keep in shadow
-            RayTree::AddShadowSegment(shadowRay, 0.0f, shadowHit.getT());
-          }
-          else {
-            // no hit, add light contribution
-
-            myLightColor = lightColor / float(M_PI*distToLightPoint*distToLightPoint);
-            
-            // add the lighting contribution from this particular light at this point
-            shadedColor += m->Shade(ray,hit,dirToLightPoint,myLightColor,args);
-          }
+        // random sampling for soft shadows
+        if (args->num_shadow_samples > 1) {
+          float alpha = sampler.rand();
+          lightPoint = alpha * startPoint + (1 - alpha) * endPoint;
         }
 
-        answer += shadedColor / (float) args->num_shadow_samples;
-      }
-      else {
-        // just do the normal lighting without shadows
-        myLightColor = lightColor / float(M_PI*distToLightPoint*distToLightPoint);
-        
-        // add the lighting contribution from this segment
-        answer += m->Shade(ray,hit,dirToLightPoint,myLightColor,args);
+        shadedColor += ShadeLightningPoint(ray, hit, point, lightPoint, lightColor, true);
       }
+
+      answer += shadedColor / (float) args->num_shadow_samples;
+    }
+    else {
+      // just do the normal lighting without shadows
+      answer += ShadeLightningPoint(ray, hit, point, lightPoint, lightColor, false);
     }
   }
 
@@ -223,7 +285,8 @@ glm::vec3 RayTracer::TraceRay(Ray &ray, Hit &hit, int bounce_count) const {
     Ray reflectRay(point, dir);
     Hit reflectHit;
 
-    glm::vec3 reflectedColor = TraceRay(reflectRay, reflectHit, bounce_count - 1);
+    glm::vec3 reflectedColor = TraceRay(reflectRay, reflectHit, sampler, bounce_count - 1,
+                                        scene, first_segment, last_segment);
 
     // draw the debug ray
     RayTree::AddReflectedSegment(reflectRay, 0.0f, reflectHit.getT());
@@ -231,116 +294,7 @@ glm::vec3 RayTracer::TraceRay(Ray &ray, Hit &hit, int bounce_count) const {
     answer += reflectedColor * reflectiveColor;
   }
 
-  // cleanup for fake material if needed
-  if (!intersect) {
-    delete m;
-  }
-  
   return answer; 
 
 }
 
-
-
-void RayTracer::initializeVBOs() {
-  glGenBuffers(1, &pixels_a_VBO);
-  glGenBuffers(1, &pixels_b_VBO);
-  glGenBuffers(1, &pixels_indices_a_VBO);
-  glGenBuffers(1, &pixels_indices_b_VBO);
-  render_to_a = true;
-}
-
-
-void RayTracer::resetVBOs() {
-
-  pixels_a.clear();
-  pixels_b.clear();
-
-  pixels_indices_a.clear();
-  pixels_indices_b.clear();
-
-  render_to_a = true;
-}
-
-void RayTracer::setupVBOs() {
-
-  glBindBuffer(GL_ARRAY_BUFFER,pixels_a_VBO); 
-  glBufferData(GL_ARRAY_BUFFER,sizeof(VBOPosNormalColor)*pixels_a.size(),&pixels_a[0],GL_STATIC_DRAW); 
-  glBindBuffer(GL_ARRAY_BUFFER,pixels_b_VBO); 
-  glBufferData(GL_ARRAY_BUFFER,sizeof(VBOPosNormalColor)*pixels_b.size(),&pixels_b[0],GL_STATIC_DRAW); 
-
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,pixels_indices_a_VBO); 
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-	       sizeof(VBOIndexedTri) * pixels_indices_a.size(),
-	       &pixels_indices_a[0], GL_STATIC_DRAW);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,pixels_indices_b_VBO); 
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-	       sizeof(VBOIndexedTri) * pixels_indices_b.size(),
-	       &pixels_indices_b[0], GL_STATIC_DRAW);
-
-}
-
-void RayTracer::drawVBOs() {
-  // turn off lighting
-  glUniform1i(GLCanvas::colormodeID, 0);
-  // turn off depth buffer
-  glDisable(GL_DEPTH_TEST);
-
-  if (render_to_a) {
-    drawVBOs_b();
-    drawVBOs_a();
-  } else {
-    drawVBOs_a();
-    drawVBOs_b();
-  }
-
-  glEnable(GL_DEPTH_TEST);
-}
-
-void RayTracer::drawVBOs_a() {
-  if (pixels_a.size() == 0) return;
-  glBindBuffer(GL_ARRAY_BUFFER, pixels_a_VBO);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,pixels_indices_a_VBO); 
-  glEnableVertexAttribArray(0);
-  glVertexAttribPointer(0,3,GL_FLOAT,GL_FALSE,sizeof(VBOPosNormalColor),(void*)0);
-  glEnableVertexAttribArray(1);
-  glVertexAttribPointer(1,3,GL_FLOAT,GL_FALSE,sizeof(VBOPosNormalColor),(void*)sizeof(glm::vec3) );
-  glEnableVertexAttribArray(2);
-  glVertexAttribPointer(2, 3, GL_FLOAT,GL_FALSE,sizeof(VBOPosNormalColor), (void*)(sizeof(glm::vec3)*2));
-  glEnableVertexAttribArray(3);
-  glVertexAttribPointer(3, 3, GL_FLOAT,GL_FALSE,sizeof(VBOPosNormalColor), (void*)(sizeof(glm::vec3)*2 + sizeof(glm::vec4)));
-  glDrawElements(GL_TRIANGLES,
-                 pixels_indices_a.size()*3,
-                 GL_UNSIGNED_INT, 0);
-  glDisableVertexAttribArray(0);
-  glDisableVertexAttribArray(1);
-  glDisableVertexAttribArray(2);
-  glDisableVertexAttribArray(3);
-}
-
-void RayTracer::drawVBOs_b() {
-  if (pixels_b.size() == 0) return;
-  glBindBuffer(GL_ARRAY_BUFFER, pixels_b_VBO);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,pixels_indices_b_VBO); 
-  glEnableVertexAttribArray(0);
-  glVertexAttribPointer(0,3,GL_FLOAT,GL_FALSE,sizeof(VBOPosNormalColor),(void*)0);
-  glEnableVertexAttribArray(1);
-  glVertexAttribPointer(1,3,GL_FLOAT,GL_FALSE,sizeof(VBOPosNormalColor),(void*)sizeof(glm::vec3) );
-  glEnableVertexAttribArray(2);
-  glVertexAttribPointer(2, 3, GL_FLOAT,GL_FALSE,sizeof(VBOPosNormalColor), (void*)(sizeof(glm::vec3)*2));
-  glEnableVertexAttribArray(3);
-  glVertexAttribPointer(3, 3, GL_FLOAT,GL_FALSE,sizeof(VBOPosNormalColor), (void*)(sizeof(glm::vec3)*2 + sizeof(glm::vec4)));
-  glDrawElements(GL_TRIANGLES,
-                 pixels_indices_b.size()*3,
-                 GL_UNSIGNED_INT, 0);
-  glDisableVertexAttribArray(0);
-  glDisableVertexAttribArray(1);
-  glDisableVertexAttribArray(2);
-  glDisableVertexAttribArray(3);
-}
-
-
-void RayTracer::cleanupVBOs() {
-  glDeleteBuffers(1, &pixels_a_VBO);
-  glDeleteBuffers(1, &pixels_b_VBO);
-}
@@ -6,11 +6,15 @@
 #include "ray.h"
 #include "hit.h"
 #include "vbo_structs.h"
+#include "lightninggrid.h"
+#include "lightningtree.h"
 
 class Mesh;
 class ArgParser;
 class Radiosity;
 class PhotonMapping;
+class Material;
+class Sampler;
 
 // ====================================================================
 // ====================================================================
@@ -21,13 +25,17 @@ class RayTracer {
 public:
 
   // CONSTRUCTOR & DESTRUCTOR
-  RayTracer(Mesh *m, ArgParser *a) {
-    mesh = m;
-    args = a;
-  }  
+  RayTracer(Mesh *m, ArgParser *a);
+  ~RayTracer();
   // set access to the other modules for hybrid rendering options
   void setRadiosity(Radiosity *r) { radiosity = r; }
   void setPhotonMapping(PhotonMapping *pm) { photon_mapping = pm; }
+  // rebuild the index of the lightning glow & the tree of its segments
+  // as lights, must be called whenever the lightning segments change
+  void UpdateLightning();
+  // the tree of segments [first,last) as lights, for the TraceRay of
+  // just those segments (rebuild before tracing each range, not while)
+  void UpdateLightningRange(int first, int last);
 
   void initializeVBOs(); 
   void resetVBOs(); 
@@ -37,20 +45,43 @@ public:
 
   // casts a single ray through the scene geometry and finds the closest hit
   bool CastRay(const Ray &ray, Hit &h, bool use_sphere_patches) const;
+  // for shadow & visibility rays: is anything hit closer than tmax?
+  // (stops at the first hit, no hit information is computed)
+  bool Occluded(const Ray &ray, float tmax, bool use_sphere_patches) const;
 
-  // does the recursive work
-  glm::vec3 TraceRay(Ray &ray, Hit &hit, int bounce_count = 0) const;
+  // does the recursive work (the sampler is used for soft shadows)
+  glm::vec3 TraceRay(Ray &ray, Hit &hit, Sampler &sampler, int bounce_count = 0) const;
+  // only the light of the scene without the lightning (if scene) and
+  // of lightning segments [first_segment,last_segment)
+  glm::vec3 TraceRay(Ray &ray, Hit &hit, Sampler &sampler, int bounce_count,
+                     bool scene, int first_segment, int last_segment) const;
 
 private:
 
   void drawVBOs_a();
   void drawVBOs_b();
 
+  // the light from a point of the lightning at the hit
+  glm::vec3 ShadeLightningPoint(const Ray &ray, const Hit &hit, const glm::vec3 &point,
+                                const glm::vec3 &lightPoint, const glm::vec3 &lightColor,
+                                bool shadows) const;
+
   // REPRESENTATION
   Mesh *mesh;
   ArgParser *args;
   Radiosity *radiosity;
   PhotonMapping *photon_mapping;
+  // the (black) material used when a ray hits nothing, shared by all
+  // rays so TraceRay doesn't allocate
+  Material *background_material;
+  // the lightning segments indexed by their glow, in the lightning plane
+  LightningGrid lightning_grid;
+  // the segments as lights, for importance sampling the direct light
+  LightningTree lightning_tree;
+  // the same for just the segments [range_first,range_last)
+  LightningTree lightning_range_tree;
+  int range_first;
+  int range_last;
 
 public:
   //float pixels_a_size;
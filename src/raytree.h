@@ -1,8 +1,8 @@
 #ifndef _RAY_TREE_H
 #define _RAY_TREE_H
 
-#include "glCanvas.h"
 #include <vector>
+#include <mutex>
 #include "ray.h"
 #include "vbo_structs.h"
 
@@ -44,22 +44,27 @@ public:
   // most of the time the RayTree is NOT activated, so the segments are not updated
   static void Activate() { Clear(); activated = 1; }
   static void Deactivate() { activated = 0; }
+  static bool isActivated() { return activated; }
 
   // when activated, these function calls store the segments of the tree
   static void AddMainSegment(const Ray &ray, float tstart, float tstop) {
     if (!activated) return;
+    std::lock_guard<std::mutex> lock(segments_mutex);
     main_segments.push_back(Segment(ray,tstart,tstop));
   }
   static void AddShadowSegment(const Ray &ray, float tstart, float tstop) {
     if (!activated) return;
+    std::lock_guard<std::mutex> lock(segments_mutex);
     shadow_segments.push_back(Segment(ray,tstart,tstop));
   }
   static void AddReflectedSegment(const Ray &ray, float tstart, float tstop) {
     if (!activated) return;
+    std::lock_guard<std::mutex> lock(segments_mutex);
     reflected_segments.push_back(Segment(ray,tstart,tstop));
   }
   static void AddTransmittedSegment(const Ray &ray, float tstart, float tstop) {
     if (!activated) return;
+    std::lock_guard<std::mutex> lock(segments_mutex);
     transmitted_segments.push_back(Segment(ray,tstart,tstop));
   }
 
@@ -84,6 +89,8 @@ private:
   static std::vector<Segment> shadow_segments;
   static std::vector<Segment> reflected_segments;
   static std::vector<Segment> transmitted_segments;
+  // the segments may be added by several rendering threads
+  static std::mutex segments_mutex;
 
   // VBO
   static GLuint raytree_verts_VBO;
@@ -0,0 +1,61 @@
+#include <cstdlib>
+#include <cstdio>
+
+#include "argparser.h"
+#include "render_image.h"
+#include "radiosity.h"
+#include "photon_mapping.h"
+
+// ====================================================================
+// ====================================================================
+// Headless renderer: loads the scene, optionally solves the radiosity
+// and/or traces the photons, and writes the ray traced image (or the
+// lightning sequence) to file.  No window or OpenGL context is created,
+// so this can run on machines without a display.
+//
+//   render_batch -input scene.obj -size 500 500 -output image.ppm
+//   render_batch -input scene.obj -gather_indirect -sequence frames
+//   render_batch -input scene.obj -sequence "|ffmpeg -i - lightning.mp4"
+//   render_batch -input scene.obj -solve_radiosity -radiosity_cache scene.cache
+// ====================================================================
+
+int main(int argc, char *argv[]) {
+
+  // parse the command line arguments
+  ArgParser args(argc, argv);
+  if (args.input_file == "") {
+    std::cerr << "ERROR: no input file, use -input <file.obj>" << std::endl;
+    return 1;
+  }
+
+  ImageRenderer renderer(&args);
+  renderer.Load();
+
+  if (args.solve_radiosity && !renderer.getRadiosity()->ReadCache()) {
+    // iterate until the solution has converged, the same stopping
+    // criteria as the radiosity animation
+    int iterations = 0;
+    do {
+      renderer.getRadiosity()->Iterate();
+      iterations++;
+    } while (!renderer.getRadiosity()->isConverged());
+    std::cout << "radiosity solved in " << iterations << " iterations" << std::endl;
+    renderer.getRadiosity()->WriteCache();
+  }
+
+  if (args.gather_indirect) {
+    // the photon map is used for the indirect illumination
+    renderer.getPhotonMapping()->TracePhotons();
+  }
+
+  bool success;
+  if (args.render_sequence) {
+    success = renderer.renderSequence(args.sequence_output);
+  } else {
+    success = renderer.renderImage(args.output_file);
+  }
+  return success ? 0 : 1;
+}
+
+// ====================================================================
+// ====================================================================
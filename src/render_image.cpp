@@ -1,9 +1,29 @@
-#include "glCanvas.h"
+#include <cstdio>
+#include <atomic>
+#include <vector>
+
+#include "render_image.h"
 #include "argparser.h"
 #include "utils.h"
 #include "mesh.h"
-#include "lightningsegment.h"
-#include <sys/stat.h>
+#include "camera.h"
+#include "raytracer.h"
+#include "radiosity.h"
+#include "photon_mapping.h"
+#include "raytree.h"
+#include "lightningbolt.h"
+#include "parallel.h"
+#include "sampler.h"
+#include "framewriter.h"
+
+// the image is rendered in square tiles, each tile is one task for
+// the threads
+#define RENDER_TILE_SIZE 16
+
+// with -irradiance_cache, the indirect light is first gathered at
+// every 8th pixel, then every 4th & 2nd (only where the gathers
+// before can't be interpolated), and only then is the image rendered
+#define RENDER_IRRADIANCE_CACHE_STRIDE 8
 
 
 bool matrixToPPM(unsigned int dimx, unsigned int dimy,
@@ -13,7 +33,7 @@ bool matrixToPPM(unsigned int dimx, unsigned int dimy,
   if (!fp) return false;
   fprintf(fp, "P6\n%d %d\n255\n", dimx, dimy);
   for (i = 0; i < dimx; i++) {
-    for (j = 0; j < dimy; j++) 
+    for (j = 0; j < dimy; j++)
       fwrite(matrix[j][dimy-i-1], 1, 3, fp);
   }
   fclose(fp);
@@ -28,64 +48,246 @@ unsigned int linearToByte(float linearColor) {
 }
 
 
-void GLCanvas::renderImage(const char* filename, bool status) {
-  if (status) printf("Rendering image %s\n", filename);
+
+// ====================================================================
+// CONSTRUCTOR, DESTRUCTOR & LOAD
+// ====================================================================
+
+ImageRenderer::ImageRenderer(ArgParser *a) {
+  args = a;
+  mesh = NULL;
+  raytracer = NULL;
+  radiosity = NULL;
+  photon_mapping = NULL;
+  camera = NULL;
+}
+
+ImageRenderer::~ImageRenderer() {
+  delete photon_mapping;
+  delete radiosity;
+  delete raytracer;
+  delete mesh;
+}
+
+void ImageRenderer::Load() {
+  mesh = new Mesh();
+  mesh->Load(args);
+
+  raytracer = new RayTracer(mesh,args);
+  radiosity = new Radiosity(mesh,args);
+  photon_mapping = new PhotonMapping(mesh,args);
+
+  raytracer->setRadiosity(radiosity);
+  raytracer->setPhotonMapping(photon_mapping);
+  radiosity->setRayTracer(raytracer);
+  radiosity->setPhotonMapping(photon_mapping);
+  photon_mapping->setRayTracer(raytracer);
+  photon_mapping->setRadiosity(radiosity);
+
+  // ===========================
+  // initial placement of camera
+  assert (mesh->camera != NULL);
+  camera = mesh->camera;
+}
+
+
+// ====================================================================
+// RENDERING
+// ====================================================================
+
+// trace a ray through pixel (i,j) of the image an return the color
+glm::vec3 ImageRenderer::TraceRay(double i, double j, Sampler &sampler) {
+  return TraceRay(i, j, sampler, sampler, true, 0, mesh->lightning_bolt.numSegments());
+}
+
+
+glm::vec3 ImageRenderer::TraceRay(double i, double j, Sampler &jitter, Sampler &sampler,
+                                  bool scene, int first_segment, int last_segment) {
+
+  // compute and set the pixel color
+  int max_d = std::max(args->width,args->height);
+  glm::vec3 color(0.0f);
+
+  // generate several random samples
+
+  for (int n=0; n < args->num_antialias_samples; n++) {
+    double new_i = i + (jitter.rand() - 0.5);
+    double new_j = j + (jitter.rand() - 0.5);
+
+    // construct & trace a ray through a random point on the pixel
+    double x = (new_i-args->width/2.0)/double(max_d)+0.5;
+    double y = (new_j-args->height/2.0)/double(max_d)+0.5;
+
+    Ray r = camera->generateRay(x,y);
+    Hit hit;
+    color += raytracer->TraceRay(r,hit,sampler,args->num_bounces,scene,first_segment,last_segment);
+    // add that ray for visualization
+    RayTree::AddMainSegment(r,0,hit.getT());
+  }
+
+  // return the average color
+  return color / (float) args->num_antialias_samples;
+}
+
+
+// with -irradiance_cache, the indirect light is gathered (coarse to
+// fine) before the image is rendered
+void ImageRenderer::GatherIrradianceCache() {
+  int dimx = args->width;
+  int dimy = args->height;
+  int tiles_x = (dimx + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+  int tiles_y = (dimy + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+  int num_tiles = tiles_x * tiles_y;
+
+  // the gathers of each pass are used from the next pass on (so the
+  // image doesn't depend on which thread gathered first)
+  int pass = 0;
+  for (int stride = RENDER_IRRADIANCE_CACHE_STRIDE; stride > 1; stride /= 2, pass++) {
+    ParallelFor(num_tiles, args->num_threads, [&](int tile) {
+        int i_start = (tile % tiles_x) * RENDER_TILE_SIZE;
+        int j_start = (tile / tiles_x) * RENDER_TILE_SIZE;
+        int i_end = std::min(i_start + RENDER_TILE_SIZE, dimx);
+        int j_end = std::min(j_start + RENDER_TILE_SIZE, dimy);
+        Sampler sampler(args->seed, SAMPLER_IRRADIANCE_CACHE, pass * num_tiles + tile);
+        for (int i = i_start; i < i_end; i += stride) {
+          for (int j = j_start; j < j_end; j += stride) {
+            // (only the indirect light is needed, not the lightning)
+            TraceRay((double)i, (double)j, sampler, sampler, true, 0, 0);
+          }
+        }
+      });
+    photon_mapping->CommitIrradianceCache();
+  }
+}
+
+
+bool ImageRenderer::renderImage(const std::string &filename, bool status) {
+  if (status) printf("Rendering image %s\n", filename.c_str());
 
   int dimx = args->width;
   int dimy = args->height;
 
+  // the aspect ratio of the rays must match the image (not the window)
+  camera->width = dimx;
+  camera->height = dimy;
+
   unsigned char*** image = new unsigned char**[dimx];
   for (int i = 0; i < dimx; i++) {
     image[i] = new unsigned char*[dimy];
     for (int j = 0; j < dimy; j++) {
       image[i][j] = new unsigned char[3];
-      glm::vec3 color = TraceRay((double)i, (double)j);
-      image[i][j][0] = linearToByte(color.x);
-      image[i][j][1] = linearToByte(color.y);
-      image[i][j][2] = linearToByte(color.z);
-    }
-    if (i % 30 == 0 && status) {
-      printf("%.1f%% done\n", (float)i * 100.0 / (float)dimx);
     }
   }
 
-  if (!matrixToPPM(dimx, dimy, image, filename)) 
+  // the tiles are rendered in parallel, each thread writes only the
+  // pixels of its own tiles (each tile has its own random stream, so
+  // the image only depends on the seed)
+  int tiles_x = (dimx + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+  int tiles_y = (dimy + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+  int num_tiles = tiles_x * tiles_y;
+  std::atomic<int> tiles_done(0);
+
+  if (args->gather_indirect && args->irradiance_cache > 0) GatherIrradianceCache();
+
+  ParallelFor(num_tiles, args->num_threads, [&](int tile) {
+      int i_start = (tile % tiles_x) * RENDER_TILE_SIZE;
+      int j_start = (tile / tiles_x) * RENDER_TILE_SIZE;
+      int i_end = std::min(i_start + RENDER_TILE_SIZE, dimx);
+      int j_end = std::min(j_start + RENDER_TILE_SIZE, dimy);
+      Sampler sampler(args->seed, SAMPLER_PIXELS, tile);
+      for (int i = i_start; i < i_end; i++) {
+        for (int j = j_start; j < j_end; j++) {
+          glm::vec3 color = TraceRay((double)i, (double)j, sampler);
+          image[i][j][0] = linearToByte(color.x);
+          image[i][j][1] = linearToByte(color.y);
+          image[i][j][2] = linearToByte(color.z);
+        }
+      }
+      int done = ++tiles_done;
+      if (status && (done * 10) / num_tiles != ((done-1) * 10) / num_tiles) {
+        printf("%.1f%% done\n", done * 100.0 / (float)num_tiles);
+      }
+    });
+  // the next image (e.g., of a sequence) starts with these gathers too
+  photon_mapping->CommitIrradianceCache();
+
+  bool success = matrixToPPM(dimx, dimy, image, filename.c_str());
+  if (!success)
     printf("Could not write to file\n");
   else if (status)
-    printf("Done writing image %s\n", filename);
+    printf("Done writing image %s\n", filename.c_str());
+
+  for (int i = 0; i < dimx; i++) {
+    for (int j = 0; j < dimy; j++) {
+      delete [] image[i][j];
+    }
+    delete [] image[i];
+  }
+  delete [] image;
+  return success;
 }
 
 
-void GLCanvas::renderSequence(const char* dirname) {
-  
+bool ImageRenderer::renderSequence(const std::string &target) {
+
   printf("Rendering lightning sequence\n");
 
-  // Create directory for files
-  const int err = mkdir(dirname, S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
-  if (err == -1) {
-    printf("Could not create directory\n");
-    return;
-  } 
+  int dimx = args->width;
+  int dimy = args->height;
+  FrameWriter writer;
+  if (!writer.Open(target, dimx, dimy)) return false;
+
+  camera->width = dimx;
+  camera->height = dimy;
+  int tiles_x = (dimx + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+  int tiles_y = (dimy + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+  int num_tiles = tiles_x * tiles_y;
 
-  std::vector<LightningSegment> segments(mesh->lightning_segments);
-  mesh->lightning_segments.clear(); 
-  char filebuf[64];
   int segments_per_image = 10;
-  int c_index = 0;
-  
-  printf("Writing %lu files\n", segments.size() / segments_per_image);
-  
-  for (unsigned int i = 0; i < segments.size() / segments_per_image; i++) {
-    c_index = i * segments_per_image;
-    snprintf(filebuf, 64, "%s/out%d.ppm", dirname, i);
-    renderImage(filebuf, false);
-    printf("File %s written\n", filebuf);
-    std::vector<LightningSegment> added(&segments[c_index], 
-                                        &segments[c_index+segments_per_image]);
-    mesh->lightning_segments.insert(mesh->lightning_segments.end(),
-                                    added.begin(), added.end());
+  int num_frames = mesh->lightning_bolt.numSegments() / segments_per_image;
+
+  printf("Writing %d frames\n", num_frames);
+
+  // frame f shows the first f * segments_per_image segments.  The light
+  // of the scene & of each segment add up, so the scene is traced once
+  // (for frame 0), then each frame adds the light of just its new
+  // segments to the frame before.  The rays of a pixel go through the
+  // same points in every frame (the jitter is a separate stream).
+  std::vector<glm::vec3> colors(dimx*dimy,glm::vec3(0,0,0));
+  if (args->gather_indirect && args->irradiance_cache > 0) GatherIrradianceCache();
+
+  for (int f = 0; f < num_frames; f++) {
+    bool scene = (f == 0);
+    int first_segment = std::max(0, (f-1) * segments_per_image);
+    int last_segment = f * segments_per_image;
+    // (to sample the lights of just the new segments)
+    if (args->num_light_samples > 0) raytracer->UpdateLightningRange(first_segment,last_segment);
+    ParallelFor(num_tiles, args->num_threads, [&](int tile) {
+        int i_start = (tile % tiles_x) * RENDER_TILE_SIZE;
+        int j_start = (tile / tiles_x) * RENDER_TILE_SIZE;
+        int i_end = std::min(i_start + RENDER_TILE_SIZE, dimx);
+        int j_end = std::min(j_start + RENDER_TILE_SIZE, dimy);
+        Sampler jitter(args->seed, SAMPLER_PIXELS, tile);
+        Sampler sampler(args->seed, SAMPLER_SEQUENCE, f * num_tiles + tile);
+        for (int i = i_start; i < i_end; i++) {
+          for (int j = j_start; j < j_end; j++) {
+            colors[i*dimy+j] += TraceRay((double)i, (double)j, jitter, sampler,
+                                         scene, first_segment, last_segment);
+          }
+        }
+      });
+    if (scene) photon_mapping->CommitIrradianceCache();
+    // (written while the next frame is traced)
+    writer.AddFrame(colors);
   }
 
-  printf("Done writing images\n");
-  
+  bool success = writer.Close();
+  if (!success)
+    printf("Could not write the sequence to %s\n", target.c_str());
+  else
+    printf("Done writing images\n");
+  return success;
 }
+
+// ====================================================================
+// ====================================================================
@@ -0,0 +1,78 @@
+#ifndef _RENDER_IMAGE_H_
+#define _RENDER_IMAGE_H_
+
+#include <string>
+#include <glm/glm.hpp>
+
+class ArgParser;
+class Mesh;
+class RayTracer;
+class Radiosity;
+class PhotonMapping;
+class Camera;
+class Sampler;
+
+// ====================================================================
+// ====================================================================
+// Loads the scene, connects the rendering modules and writes ray
+// traced images to file.  This class makes no OpenGL calls, it is
+// shared by the interactive viewer (GLCanvas) and the headless batch
+// renderer.
+
+class ImageRenderer {
+
+public:
+
+  // ========================
+  // CONSTRUCTOR & DESTRUCTOR
+  ImageRenderer(ArgParser *a);
+  ~ImageRenderer();
+  // load the mesh and create the raytracer, radiosity & photon mapping
+  void Load();
+
+  // =========
+  // ACCESSORS
+  Mesh* getMesh() const { return mesh; }
+  RayTracer* getRayTracer() const { return raytracer; }
+  Radiosity* getRadiosity() const { return radiosity; }
+  PhotonMapping* getPhotonMapping() const { return photon_mapping; }
+  Camera* getCamera() const { return camera; }
+
+  // =========
+  // RENDERING
+  // trace a ray through pixel (i,j) of the image and return the color
+  // (safe to call from several threads at once, each with its own
+  // sampler)
+  glm::vec3 TraceRay(double i, double j, Sampler &sampler);
+  // only the light of the scene (if scene) and/or of lightning
+  // segments [first_segment,last_segment), the rays go through the
+  // pixel at points from the jitter sampler
+  glm::vec3 TraceRay(double i, double j, Sampler &jitter, Sampler &sampler,
+                     bool scene, int first_segment, int last_segment);
+  // render the whole image (args->width x args->height) to a .ppm
+  // file, the tiles of the image are rendered by args->num_threads
+  bool renderImage(const std::string &filename, bool status=true);
+  // render the lightning bolt growing segment by segment, to a new
+  // directory of .ppm files, a video stream or a command (see
+  // FrameWriter).  The scene is traced once, each frame only traces
+  // the segments added.
+  bool renderSequence(const std::string &target);
+
+private:
+
+  // HELPER FUNCTIONS
+  void GatherIrradianceCache();
+
+  // REPRESENTATION
+  ArgParser *args;
+  Mesh *mesh;
+  RayTracer *raytracer;
+  Radiosity *radiosity;
+  PhotonMapping *photon_mapping;
+  Camera *camera;
+};
+
+// ====================================================================
+// ====================================================================
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef _SAMPLER_H_
+#define _SAMPLER_H_
+
+#include <stdint.h>
+
+// the independent random streams of one seed, so e.g., the lightning
+// bolt doesn't change when the number of photons does
+enum SAMPLER_STREAM { SAMPLER_LIGHTNING, SAMPLER_PIXELS, SAMPLER_PHOTONS,
+                      SAMPLER_FORM_FACTORS, SAMPLER_IRRADIANCE_CACHE, SAMPLER_SEQUENCE };
+
+// ====================================================================
+// ====================================================================
+// A small, fast random number generator (PCG32, by Melissa O'Neill)
+// for all of the sampling.  Each piece of parallel work (an image
+// tile, a chunk of photons, ...) makes its own sampler from the
+// global seed (-seed) and the index of the work, so the results
+// don't depend on the number of threads or on which thread did the
+// work.  A sampler must not be shared between threads.
+
+class Sampler {
+
+public:
+
+  // ========================
+  // CONSTRUCTORS
+  Sampler() { Seed(0,0); }
+  Sampler(uint64_t seed, uint64_t stream) { Seed(seed,stream); }
+  // the stream for the index-th piece of work of the given kind
+  Sampler(uint64_t seed, SAMPLER_STREAM which, int index) {
+    Seed(seed,(uint64_t(which) << 32) | uint32_t(index)); }
+
+  void Seed(uint64_t seed, uint64_t stream) {
+    state = 0;
+    increment = (stream << 1) | 1;
+    nextUInt();
+    state += seed;
+    nextUInt();
+  }
+
+  // ==========
+  // GENERATION
+  uint32_t nextUInt() {
+    uint64_t old = state;
+    state = old * 6364136223846793005ULL + increment;
+    uint32_t xorshifted = uint32_t(((old >> 18) ^ old) >> 27);
+    uint32_t rot = uint32_t(old >> 59);
+    return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+  }
+  // a random real in [0,1)
+  float rand() { return (nextUInt() >> 8) * (1.0f / 16777216.0f); }
+
+private:
+
+  // REPRESENTATION
+  uint64_t state;
+  uint64_t increment;
+};
+
+// ====================================================================
+// ====================================================================
+
+#endif
@@ -37,6 +37,11 @@ bool Sphere::intersect(const Ray &r, Hit &h) const {
 
   float t = std::min(t_plus, t_minus);
 
+  // only report the hit if it is closer than the current closest hit
+  if (t >= h.getT()) {
+    return false;
+  }
+
   glm::vec3 hit = r.getOrigin() + r.getDirection() * t;
 
   // calculate the normal
@@ -18,6 +18,8 @@ public:
 
   // for ray tracing
   virtual bool intersect(const Ray &r, Hit &h) const;
+  BoundingBox getBoundingBox() const {
+    return BoundingBox(center-glm::vec3(radius),center+glm::vec3(radius)); }
 
   // for lightning
   glm::vec3 closestPoint(glm::vec3 point);
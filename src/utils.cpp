@@ -1,6 +1,5 @@
 #include <iostream>
 
-#include "glCanvas.h"
 #include "utils.h"
 
 
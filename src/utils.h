@@ -1,15 +1,14 @@
 #ifndef _UTILS_H
 #define _UTILS_H
 
-#include <GL/glew.h>
-#include <GLFW/glfw3.h>
+#include <cmath>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <vector>
 
-#include "glCanvas.h"
 #include "vbo_structs.h"
 #include "argparser.h"
+#include "sampler.h"
 
 // ======================================================================
 
@@ -90,12 +89,12 @@ inline glm::vec3 ComputeTriNormal(const glm::vec3 &p1, const glm::vec3 &p2, cons
 }
 
 // utility function to generate random numbers used for sampling
-inline glm::vec3 RandomUnitVector() {
+inline glm::vec3 RandomUnitVector(Sampler &sampler) {
   glm::vec3 tmp;
   while (true) {
-    tmp = glm::vec3(2*GLCanvas::args->rand()-1,  // random real in [-1,1]
-                    2*GLCanvas::args->rand()-1,  // random real in [-1,1]
-                    2*GLCanvas::args->rand()-1); // random real in [-1,1]
+    tmp = glm::vec3(2*sampler.rand()-1,  // random real in [-1,1]
+                    2*sampler.rand()-1,  // random real in [-1,1]
+                    2*sampler.rand()-1); // random real in [-1,1]
     if (glm::length(tmp) < 1) break;
   }
   tmp = glm::normalize(tmp);
@@ -111,8 +110,8 @@ inline glm::vec3 MirrorDirection(const glm::vec3 &normal, const glm::vec3 &incom
 
 // compute a random diffuse direction
 // (not the same as a uniform random direction on the hemisphere)
-inline glm::vec3 RandomDiffuseDirection(const glm::vec3 &normal) {
-  glm::vec3 answer = normal+RandomUnitVector();
+inline glm::vec3 RandomDiffuseDirection(const glm::vec3 &normal, Sampler &sampler) {
+  glm::vec3 answer = normal+RandomUnitVector(sampler);
   return glm::normalize(answer);
 }
 
@@ -1,6 +1,12 @@
 #ifndef __VBO_STRUCTS_H__
 #define __VBO_STRUCTS_H__
 
+#include <glm/glm.hpp>
+
+// the VBO handles are stored in classes shared with the headless
+// renderer, so don't require the OpenGL headers just for this type
+typedef unsigned int GLuint;
+
 // ======================================================================
 // helper structures for VBOs, for rendering (note, the data stored in
 // each of these is application specific, adjust as needed!)